@@ -0,0 +1,129 @@
+//////////////////////////////////////////////////////////////////////////
+// Compares the allocators for small objects: plain malloc, the old
+//	MemoryPool and the SizeClassAllocator of FastAllocObjectBase
+//////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "core/memory.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#define _BATCH_SIZE 4096
+#define _ROUNDS 2000
+
+struct MallocAllocator
+{
+	static const char* name() { return "malloc"; }
+	static void* allocate(size_t _size) { return malloc(_size); }
+	static void free(void *_ptr) { ::free(_ptr); }
+};
+
+struct PoolAllocator
+{
+	typedef MemoryPool<8192, 16, 4> t_memoryPool;
+
+	static t_memoryPool& getMemoryPool()
+	{
+		static _THREAD_LOCAL t_memoryPool* pool = NULL;
+		if (pool == NULL)
+			pool = new t_memoryPool;
+
+		return *pool;
+	}
+
+	static const char* name() { return "MemoryPool"; }
+	static void* allocate(size_t _size) { return getMemoryPool().allocate(_size); }
+	static void free(void *_ptr) { t_memoryPool::free(_ptr); }
+};
+
+struct SizeClassAllocatorBench
+{
+	static const char* name() { return "SizeClassAllocator"; }
+	static void* allocate(size_t _size) { return SizeClassAllocator::allocate(_size); }
+	static void free(void *_ptr) { SizeClassAllocator::free(_ptr); }
+};
+
+//Sizes of the objects the renderer allocates most: small primitives,
+//	intersections and shading state
+static size_t objectSize(size_t _i)
+{
+	static const size_t sizes[] = {16, 32, 48, 64, 96, 128, 256};
+	return sizes[_i % (sizeof(sizes) / sizeof(sizes[0]))];
+}
+
+//Every thread allocates a batch and frees it again, in reverse
+//	or interleaved order
+template<class ta_alloc>
+double localBatches(int _threads)
+{
+	double start = omp_get_wtime();
+	#pragma omp parallel num_threads(_threads)
+	{
+		std::vector<void*> ptrs(_BATCH_SIZE);
+		for(int round = 0; round < _ROUNDS; round++)
+		{
+			for(size_t i = 0; i < _BATCH_SIZE; i++)
+			{
+				ptrs[i] = ta_alloc::allocate(objectSize(i));
+				*(size_t*)ptrs[i] = i;
+			}
+			for(size_t i = 0; i < _BATCH_SIZE; i += 2)
+				ta_alloc::free(ptrs[i]);
+			for(size_t i = _BATCH_SIZE; i > 0; i -= 2)
+				ta_alloc::free(ptrs[i - 1]);
+		}
+	}
+	return omp_get_wtime() - start;
+}
+
+//Each thread frees the batch its neighbour allocated in the previous round
+template<class ta_alloc>
+double crossThreadBatches(int _threads)
+{
+	std::vector<std::vector<void*> > batches(_threads, std::vector<void*>(_BATCH_SIZE));
+	double start = omp_get_wtime();
+	#pragma omp parallel num_threads(_threads)
+	{
+		int thread = omp_get_thread_num();
+		for(int round = 0; round < _ROUNDS; round++)
+		{
+			std::vector<void*> &own = batches[thread];
+			for(size_t i = 0; i < _BATCH_SIZE; i++)
+				own[i] = ta_alloc::allocate(objectSize(i));
+
+			#pragma omp barrier
+			std::vector<void*> &other = batches[(thread + 1) % _threads];
+			for(size_t i = 0; i < _BATCH_SIZE; i++)
+				ta_alloc::free(other[i]);
+			#pragma omp barrier
+		}
+	}
+	return omp_get_wtime() - start;
+}
+
+template<class ta_alloc>
+void run(int _threads, bool _crossThread)
+{
+	printf("%-20s local 1 thread: %7.3f s  local %d threads: %7.3f s",
+		ta_alloc::name(), localBatches<ta_alloc>(1), _threads, localBatches<ta_alloc>(_threads));
+	//MemoryPool is not thread safe, objects must be freed by the thread that allocated them
+	if(_crossThread)
+		printf("  cross thread: %7.3f s", crossThreadBatches<ta_alloc>(_threads));
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : omp_get_max_threads();
+	if(threads < 2)
+		threads = 2;
+
+	printf("%d rounds of %d objects\n", _ROUNDS, _BATCH_SIZE);
+	run<MallocAllocator>(threads, true);
+	run<PoolAllocator>(threads, false);
+	run<SizeClassAllocatorBench>(threads, true);
+
+	return 0;
+}
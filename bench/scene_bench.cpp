@@ -0,0 +1,439 @@
+//////////////////////////////////////////////////////////////////////////
+// Builds, traversal, rendering and photon mapping on procedural scenes
+//	(a triangle soup, spheres, glass objects, a terrain with many
+//	lights) for each acceleration structure. Reports build time,
+//	memory and rays per second as a table and as JSON, to compare
+//	versions. A measurement that takes longer than _TIME_BUDGET stops
+//	there, its rate is that of the rays traced so far and the result
+//	is marked as incomplete (* in the table).
+//	Arguments: [soup triangles] [JSON file], the JSON goes next to the
+//	executable by default
+//////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "rt/geometry_group.h"
+#include "rt/renderer.h"
+#include "impl/basic_primitives.h"
+#include "impl/phong_shaders.h"
+#include "impl/perspective_camera.h"
+#include "impl/integrator.h"
+#include "impl/photonMapping_Integrator.h"
+#include "impl/samplers.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+
+#define _SOUP_TRIANGLES 20000
+#define _WIDTH 160
+#define _HEIGHT 120
+#define _RANDOM_RAYS 65536
+#define _PHOTONS 100000
+#define _REPETITIONS 3 //The best rate of the repetitions is reported
+#define _TIME_BUDGET 1.0 //Seconds per measurement
+
+//Every run gets the same scenes, independent of the rand of the platform
+static uint s_seed = 1;
+
+static float randomFloat(float _min, float _max)
+{
+	s_seed ^= s_seed << 13;
+	s_seed ^= s_seed >> 17;
+	s_seed ^= s_seed << 5;
+	return _min + (_max - _min) * (float)(s_seed & 0xFFFFFF) / (float)0xFFFFFF;
+}
+
+static Point randomPoint(float _size)
+{
+	return Point(randomFloat(-_size, _size), randomFloat(-_size, _size), randomFloat(-_size, _size));
+}
+
+static Vector randomVector(float _size)
+{
+	return Vector(randomFloat(-_size, _size), randomFloat(-_size, _size), randomFloat(-_size, _size));
+}
+
+struct Materials
+{
+	SmartPtr<DefaultPhongShader> diffuse;
+	SmartPtr<MirrorPhongShader> mirror;
+	SmartPtr<RefractivePhongShader> glass;
+
+	Materials()
+	{
+		diffuse = new DefaultPhongShader;
+		diffuse->diffuseCoef = float4(0.6f, 0.5f, 0.4f, 0);
+		diffuse->ambientCoef = diffuse->diffuseCoef;
+		diffuse->specularCoef = float4::rep(0.2f);
+		diffuse->specularExponent = 20;
+
+		mirror = new MirrorPhongShader;
+		mirror->diffuseCoef = float4::rep(0.1f);
+		mirror->ambientCoef = mirror->diffuseCoef;
+		mirror->specularCoef = float4::rep(0.4f);
+		mirror->specularExponent = 40;
+		mirror->reflCoef = 0.7f;
+
+		glass = new RefractivePhongShader;
+		glass->diffuseCoef = float4(0.05f, 0.1f, 0.05f, 0);
+		glass->ambientCoef = glass->diffuseCoef;
+		glass->specularCoef = float4::rep(0.5f);
+		glass->specularExponent = 100;
+		glass->transparency = float4::rep(0.8f);
+		glass->refractionIndex = 1.5f;
+	}
+};
+
+struct BenchScene
+{
+	const char *name;
+	std::vector<Primitive*> primitives;
+	std::vector<PointLightSource> lights;
+	Point eye, lookAt;
+
+	void addLight(const Point &_position, float _intensity)
+	{
+		PointLightSource light;
+		light.position = _position;
+		light.intensity = float4::rep(_intensity);
+		light.falloff = float4(1, 0, 0, 0);
+		lights.push_back(light);
+	}
+
+	//A height field of 2 * _size * _size triangles over the square
+	//	_center + [-5, 5] * _u + [-5, 5] * _v, the heights go along _up
+	void addTerrain(int _size, const Point &_center, const Vector &_u, const Vector &_v,
+		const Vector &_up, PluggableShader *_shader)
+	{
+		float step = 10.f / _size;
+		for(int i = 0; i < _size; i++)
+			for(int j = 0; j < _size; j++)
+			{
+				Point p[4];
+				for(int k = 0; k < 4; k++)
+				{
+					float s = -5 + (i + k % 2) * step, t = -5 + (j + k / 2) * step;
+					p[k] = _center + s * _u + t * _v + (0.4f * sinf(s * 1.3f) * cosf(t * 0.9f)) * _up;
+				}
+				primitives.push_back(new Triangle(p[0], p[1], p[2], _shader));
+				primitives.push_back(new Triangle(p[1], p[3], p[2], _shader));
+			}
+	}
+
+	~BenchScene()
+	{
+		for(size_t i = 0; i < primitives.size(); i++)
+			delete primitives[i];
+	}
+};
+
+//Small random triangles in a cube
+static void createSoup(BenchScene &_scene, Materials &_materials, int _triangles)
+{
+	_scene.name = "soup";
+	for(int i = 0; i < _triangles; i++)
+	{
+		Point p = randomPoint(4);
+		_scene.primitives.push_back(new Triangle(p, p + randomVector(0.3f), p + randomVector(0.3f),
+			i % 4 == 0 ? _materials.mirror.data() : _materials.diffuse.data()));
+	}
+	_scene.addLight(Point(2, 8, 8), 60);
+	_scene.eye = Point(0, 0, 12);
+	_scene.lookAt = Point(0, 0, 0);
+}
+
+//A grid of diffuse and mirror spheres on a plane
+static void createSpheres(BenchScene &_scene, Materials &_materials)
+{
+	_scene.name = "spheres";
+	_scene.primitives.push_back(new InfinitePlane(Point(0, 0, 0), Vector(0, 1, 0), _materials.diffuse.data()));
+	for(int i = 0; i < 16; i++)
+		for(int j = 0; j < 16; j++)
+			_scene.primitives.push_back(new Sphere(Point(-4.5f + i * 0.6f, 0.25f, -4.5f + j * 0.6f), 0.25f,
+				(i + j) % 3 == 0 ? (PluggableShader*)_materials.mirror.data() : _materials.diffuse.data()));
+	_scene.addLight(Point(3, 6, 4), 40);
+	_scene.addLight(Point(-4, 5, -2), 40);
+	_scene.eye = Point(0, 4, 7);
+	_scene.lookAt = Point(0, 0, -1);
+}
+
+//Glass spheres in front of a tessellated wall, for refraction and caustics
+static void createGlass(BenchScene &_scene, Materials &_materials)
+{
+	_scene.name = "glass";
+	_scene.primitives.push_back(new InfinitePlane(Point(0, -1, 0), Vector(0, 1, 0), _materials.diffuse.data()));
+	for(int i = 0; i < 5; i++)
+		for(int j = 0; j < 5; j++)
+			_scene.primitives.push_back(new Sphere(Point(-3 + i * 1.5f, -0.4f, -2 + j * 1.2f), 0.55f, _materials.glass.data()));
+	_scene.addTerrain(48, Point(0, 4, -5), Vector(1, 0, 0), Vector(0, 1, 0), Vector(0, 0, 1), _materials.diffuse.data());
+	_scene.addLight(Point(0, 6, 3), 60);
+	_scene.eye = Point(0, 2, 8);
+	_scene.lookAt = Point(0, 0, -1);
+}
+
+//A terrain lit by a grid of 64 lights
+static void createLights(BenchScene &_scene, Materials &_materials)
+{
+	_scene.name = "lights";
+	_scene.addTerrain(96, Point(0, 0, 0), Vector(1, 0, 0), Vector(0, 0, 1), Vector(0, 1, 0), _materials.diffuse.data());
+	for(int i = 0; i < 8; i++)
+		for(int j = 0; j < 8; j++)
+			_scene.addLight(Point(-4.5f + i * 1.3f, 2, -4.5f + j * 1.3f), 0.6f);
+	_scene.eye = Point(0, 5, 7);
+	_scene.lookAt = Point(0, 0, -1);
+}
+
+struct Result
+{
+	const char *scene, *structure;
+	size_t primitives, lights, bytes;
+	double buildSeconds, primaryRays, randomRays, renderSamples; //Per second
+	bool complete;
+};
+
+struct PhotonResult
+{
+	const char *structure;
+	double shootSeconds, photons, renderSamples; //Per second
+	bool complete;
+};
+
+static const char *s_structureNames[] = {"BVH", "SAH BVH", "SAH KD-Tree"};
+
+//The renderer and the builds talk a lot, the table is printed with printf
+static std::streambuf *s_coutBuffer = NULL;
+
+static void muteCout()
+{
+	s_coutBuffer = std::cout.rdbuf(NULL);
+}
+
+static void unmuteCout()
+{
+	std::cout.rdbuf(s_coutBuffer);
+	std::cout.clear();
+}
+
+//The best rays per second of tracing _rays to their closest hit,
+//	clears _complete if the time budget did not suffice for all rays
+static double traceRays(const GeometryGroup &_group, const std::vector<Ray> &_rays, bool &_complete)
+{
+	double best = 0;
+	for(int r = 0; r < _REPETITIONS; r++)
+	{
+		double start = omp_get_wtime();
+		size_t traced = 0;
+		while(traced < _rays.size())
+		{
+			PathArena::Scope scope;
+			_group.intersect(_rays[traced++], FLT_MAX);
+			if(traced % 256 == 0 && omp_get_wtime() - start > _TIME_BUDGET)
+				break;
+		}
+		best = std::max(best, traced / (omp_get_wtime() - start));
+		_complete = _complete && traced == _rays.size();
+	}
+	return best;
+}
+
+//Renders a pass of the tile renderer with ray packets and returns the
+//	pixel samples per second, clears _complete if the time budget did
+//	not suffice for all pixels
+static double renderImage(Integrator *_integrator, Camera *_camera, uint _width, uint _height,
+	const std::string &_fileName, bool &_complete)
+{
+	SmartPtr<Image> img = new Image(_width, _height);
+	Renderer r;
+	r.integrator = _integrator;
+	r.camera = _camera;
+	r.sampler = new DefaultSampler;
+	r.target = img;
+	r.progressivePasses = 1;
+	r.timeBudget = (float)_TIME_BUDGET;
+	r.writeInterval = 0;
+	r.progressiveFile = _fileName;
+
+	double start = omp_get_wtime();
+	r.renderProgressive(16);
+	double time = omp_get_wtime() - start;
+	_complete = _complete && r.getPrimaryRays() == (size_t)_width * _height;
+	return r.getPrimaryRays() / time;
+}
+
+static void benchScene(const BenchScene &_scene, const std::vector<Ray> &_randomRays,
+	const std::string &_prefix, std::vector<Result> &_results)
+{
+	SmartPtr<Camera> camera = new PerspectiveCamera(_scene.eye, _scene.lookAt, Vector(0, 1, 0),
+		60, std::make_pair((uint)_WIDTH, (uint)_HEIGHT));
+	std::vector<Ray> primaryRays;
+	for(int y = 0; y < _HEIGHT; y++)
+		for(int x = 0; x < _WIDTH; x++)
+			primaryRays.push_back(camera->getPrimaryRay(x + 0.5f, y + 0.5f));
+
+	for(int structure = 0; structure < 3; structure++)
+	{
+		Result res;
+		res.scene = _scene.name;
+		res.structure = s_structureNames[structure];
+		res.primitives = _scene.primitives.size();
+		res.lights = _scene.lights.size();
+		res.complete = true;
+
+		muteCout();
+		GeometryGroup group(structure);
+		group.primitives = _scene.primitives;
+		double start = omp_get_wtime();
+		group.rebuildIndex();
+		res.buildSeconds = omp_get_wtime() - start;
+		res.bytes = group.getIndexMemoryUsage();
+
+		res.primaryRays = traceRays(group, primaryRays, res.complete);
+		res.randomRays = traceRays(group, _randomRays, res.complete);
+
+		SmartPtr<IntegratorImpl> integrator = new IntegratorImpl;
+		integrator->scene = &group;
+		integrator->lightSources = _scene.lights;
+		integrator->ambientLight = float4::rep(0.1f);
+		res.renderSamples = renderImage(integrator.data(), camera.data(), _WIDTH, _HEIGHT,
+			_prefix + "." + _scene.name + ".png", res.complete);
+		unmuteCout();
+
+		printf("%-8s %-12s %8lu %9.4f %10lu %15.3f %14.3f %17.2f%s\n", res.scene, res.structure,
+			(unsigned long)res.primitives, res.buildSeconds, (unsigned long)(res.bytes / 1024),
+			res.primaryRays * 1e-6, res.randomRays * 1e-6, res.renderSamples * 1e-3, res.complete ? "" : " *");
+		fflush(stdout);
+		_results.push_back(res);
+	}
+}
+
+//Shoots and balances the photons in the glass scene and renders it with
+//	the photon map, at a quarter of the size
+static void benchPhotons(const BenchScene &_scene, const std::string &_prefix, std::vector<PhotonResult> &_results)
+{
+	SmartPtr<Camera> camera = new PerspectiveCamera(_scene.eye, _scene.lookAt, Vector(0, 1, 0),
+		60, std::make_pair((uint)_WIDTH / 2, (uint)_HEIGHT / 2));
+
+	for(int structure = 0; structure < 3; structure++)
+	{
+		PhotonResult res;
+		res.structure = s_structureNames[structure];
+		res.complete = true;
+
+		muteCout();
+		GeometryGroup group(structure);
+		group.primitives = _scene.primitives;
+		group.rebuildIndex();
+
+		SmartPtr<PhotonMap_Integrator> integrator = new PhotonMap_Integrator;
+		integrator->scene = &group;
+		integrator->lightSources = _scene.lights;
+		integrator->ambientLight = float4::rep(0.1f);
+		integrator->totalNumberOfPhotons = _PHOTONS;
+
+		double start = omp_get_wtime();
+		integrator->start_photonmapping();
+		res.shootSeconds = omp_get_wtime() - start;
+		res.photons = _PHOTONS / res.shootSeconds;
+		res.renderSamples = renderImage(integrator.data(), camera.data(), _WIDTH / 2, _HEIGHT / 2,
+			_prefix + ".photons.png", res.complete);
+		unmuteCout();
+
+		printf("%-12s %16.3f %13.3f %17.2f%s\n", res.structure, res.shootSeconds, res.photons * 1e-6,
+			res.renderSamples * 1e-3, res.complete ? "" : " *");
+		fflush(stdout);
+		_results.push_back(res);
+	}
+}
+
+static void writeJSON(const std::string &_fileName, int _soupTriangles,
+	const std::vector<Result> &_results, const std::vector<PhotonResult> &_photons)
+{
+	FILE *f = fopen(_fileName.c_str(), "w");
+	if(f == NULL)
+	{
+		printf("Could not write %s\n", _fileName.c_str());
+		return;
+	}
+
+	fprintf(f, "{\n\t\"config\": {\"soupTriangles\": %d, \"width\": %d, \"height\": %d, \"randomRays\": %d, "
+		"\"photons\": %d, \"simd\": \"%s\", \"statistics\": %d},\n",
+		_soupTriangles, _WIDTH, _HEIGHT, _RANDOM_RAYS, _PHOTONS,
+		SIMD_AVX ? "AVX" : SIMD_SSE ? "SSE" : "scalar", STATISTICS);
+
+	fprintf(f, "\t\"results\": [\n");
+	for(size_t i = 0; i < _results.size(); i++)
+	{
+		const Result &r = _results[i];
+		fprintf(f, "\t\t{\"scene\": \"%s\", \"structure\": \"%s\", \"primitives\": %lu, \"lights\": %lu, "
+			"\"buildSeconds\": %g, \"memoryBytes\": %lu, \"primaryRaysPerSecond\": %g, "
+			"\"randomRaysPerSecond\": %g, \"renderSamplesPerSecond\": %g, \"complete\": %s}%s\n",
+			r.scene, r.structure, (unsigned long)r.primitives, (unsigned long)r.lights, r.buildSeconds,
+			(unsigned long)r.bytes, r.primaryRays, r.randomRays, r.renderSamples,
+			r.complete ? "true" : "false", i + 1 < _results.size() ? "," : "");
+	}
+	fprintf(f, "\t],\n\t\"photons\": [\n");
+	for(size_t i = 0; i < _photons.size(); i++)
+	{
+		const PhotonResult &r = _photons[i];
+		fprintf(f, "\t\t{\"scene\": \"glass\", \"structure\": \"%s\", \"shootSeconds\": %g, "
+			"\"photonsPerSecond\": %g, \"renderSamplesPerSecond\": %g, \"complete\": %s}%s\n",
+			r.structure, r.shootSeconds, r.photons, r.renderSamples,
+			r.complete ? "true" : "false", i + 1 < _photons.size() ? "," : "");
+	}
+	fprintf(f, "\t]\n}\n");
+	fclose(f);
+
+	printf("written to %s\n", _fileName.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	int soupTriangles = argc > 1 ? atoi(argv[1]) : _SOUP_TRIANGLES;
+	//The images are written next to the executable as well
+	std::string prefix = argv[0];
+	std::string jsonFile = argc > 2 ? std::string(argv[2]) : prefix + ".json";
+
+	//The same rays for all scenes, from inside the scenes in all directions
+	std::vector<Ray> randomRays(_RANDOM_RAYS);
+	for(size_t i = 0; i < randomRays.size(); i++)
+	{
+		randomRays[i].o = randomPoint(5);
+		randomRays[i].d = ~randomVector(1);
+	}
+
+	Materials materials;
+	std::vector<Result> results;
+	std::vector<PhotonResult> photons;
+
+	printf("%d x %d pixels, %d random rays, float4 with %s\n", _WIDTH, _HEIGHT, _RANDOM_RAYS,
+		SIMD_SSE ? "SSE" : "scalar code");
+	printf("%-8s %-12s %8s %9s %10s %15s %14s %17s\n", "scene", "structure", "prims", "build s",
+		"memory KB", "primary Mrays/s", "random Mrays/s", "render ksamples/s");
+
+	BenchScene glass;
+	createGlass(glass, materials);
+	{
+		BenchScene soup;
+		createSoup(soup, materials, soupTriangles);
+		benchScene(soup, randomRays, prefix, results);
+	}
+	{
+		BenchScene spheres;
+		createSpheres(spheres, materials);
+		benchScene(spheres, randomRays, prefix, results);
+	}
+	benchScene(glass, randomRays, prefix, results);
+	{
+		BenchScene lights;
+		createLights(lights, materials);
+		benchScene(lights, randomRays, prefix, results);
+	}
+
+	printf("* stopped after %g s, the rates are those of the part done\n", _TIME_BUDGET);
+
+	printf("\nphotons in the glass scene: %d photons, %d x %d pixels\n", _PHOTONS, _WIDTH / 2, _HEIGHT / 2);
+	printf("%-12s %16s %13s %17s\n", "structure", "shoot+balance s", "Mphotons/s", "render ksamples/s");
+	benchPhotons(glass, prefix, photons);
+
+	writeJSON(jsonFile, soupTriangles, results, photons);
+	return 0;
+}
@@ -0,0 +1,148 @@
+//////////////////////////////////////////////////////////////////////////
+// Times the intersection/shading loop of the integrator (intersect,
+//	getShader and a few shader calls per ray) with the hit points and
+//	shaders on the heap and in the PathArena, and SmartPtr copies
+//	against moves
+//////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "rt/geometry_group.h"
+#include "impl/basic_primitives.h"
+#include "impl/phong_shaders.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+
+#define _IMAGE_SIZE 256
+#define _ROUNDS 2
+#define _REPETITIONS 5 //The best time of the repetitions is reported
+
+static GeometryGroup *createScene(SmartPtr<DefaultPhongShader> &_shader)
+{
+	_shader = new DefaultPhongShader;
+	_shader->diffuseCoef = float4(0.6f, 0.3f, 0.2f, 0);
+	_shader->ambientCoef = _shader->diffuseCoef;
+	_shader->specularCoef = float4::rep(0.4f);
+	_shader->specularExponent = 40;
+
+	GeometryGroup *scene = new GeometryGroup(0);
+	scene->primitives.push_back(new InfinitePlane(Point(0, 0, 0), Vector(0, 1, 0), _shader.data()));
+	for(int i = 0; i < 8; i++)
+		scene->primitives.push_back(new Sphere(Point(-3.5f + i, 1, -(float)(i % 3)), 0.6f, _shader.data()));
+	for(int i = 0; i < 10; i++)
+		for(int j = 0; j < 10; j++)
+		{
+			float x = -4 + i * 0.8f, z = -8 + j * 0.8f, h = 0.3f * sinf(x) * cosf(z) + 0.5f;
+			scene->primitives.push_back(new Triangle(Point(x, h, z), Point(x + 0.8f, h, z), Point(x, h + 0.4f, z + 0.8f), _shader.data()));
+		}
+	scene->rebuildIndex();
+	return scene;
+}
+
+static Ray primaryRay(int _x, int _y)
+{
+	Ray r;
+	r.o = Point(0, 3, 6);
+	r.d = ~Vector((_x - _IMAGE_SIZE / 2) * (4.f / _IMAGE_SIZE), -1.f - _y * (2.f / _IMAGE_SIZE), -3.f);
+	return r;
+}
+
+//What the integrator does for a hit, without the secondary rays
+static float shadeRay(const GeometryGroup &_scene, const Ray &_ray)
+{
+	Primitive::IntRet ret = _scene.intersect(_ray, FLT_MAX);
+	if(ret.distance >= FLT_MAX || ret.distance < Primitive::INTEPS())
+		return 0;
+
+	SmartPtr<Shader> shader = _scene.getShader(ret);
+	Vector lightD = Point(3, 6, 4) - (_ray.o + ret.distance * _ray.d);
+	float4 col = shader->getAmbientCoefficient() + shader->getReflectance(-_ray.d, lightD);
+	return col.x + col.y + col.z;
+}
+
+//Shades all pixels _ROUNDS times, opening a PathArena::Scope for every
+//	ray if _arena is set
+static double shadingPass(const GeometryGroup &_scene, int _threads, bool _arena, float &_sum)
+{
+	float sum = 0;
+	double start = omp_get_wtime();
+	#pragma omp parallel for num_threads(_threads) schedule(dynamic, 8) reduction(+:sum)
+	for(int y = 0; y < _IMAGE_SIZE * _ROUNDS; y++)
+		for(int x = 0; x < _IMAGE_SIZE; x++)
+		{
+			Ray ray = primaryRay(x, y % _IMAGE_SIZE);
+			if(_arena)
+			{
+				PathArena::Scope scope;
+				sum += shadeRay(_scene, ray);
+			}
+			else
+				sum += shadeRay(_scene, ray);
+		}
+	_sum = sum;
+	return omp_get_wtime() - start;
+}
+
+static double shadingLoop(const GeometryGroup &_scene, int _threads, bool _arena, float &_sum)
+{
+	double best = DBL_MAX;
+	for(int i = 0; i < _REPETITIONS; i++)
+		best = std::min(best, shadingPass(_scene, _threads, _arena, _sum));
+	return best;
+}
+
+//Rotates a vector of smart pointers, once with copies and once with moves
+static void smartPtrLoop(const SmartPtr<DefaultPhongShader> &_shader)
+{
+	const size_t count = 1024, rounds = 4000;
+	std::vector<SmartPtr<Shader> > ptrs(count, _shader);
+
+	double start = omp_get_wtime();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		SmartPtr<Shader> first = ptrs[0];
+		for(size_t i = 1; i < count; i++)
+			ptrs[i - 1] = ptrs[i];
+		ptrs[count - 1] = first;
+	}
+	double copyTime = omp_get_wtime() - start;
+
+	start = omp_get_wtime();
+	for(size_t r = 0; r < rounds; r++)
+	{
+		SmartPtr<Shader> first = std::move(ptrs[0]);
+		for(size_t i = 1; i < count; i++)
+			ptrs[i - 1] = std::move(ptrs[i]);
+		ptrs[count - 1] = std::move(first);
+	}
+	double moveTime = omp_get_wtime() - start;
+
+	printf("SmartPtr rotation     copy: %7.3f s  move: %7.3f s\n", copyTime, moveTime);
+}
+
+int main(int argc, char *argv[])
+{
+	int threads = argc > 1 ? atoi(argv[1]) : omp_get_max_threads();
+
+	SmartPtr<DefaultPhongShader> shader;
+	GeometryGroup *scene = createScene(shader);
+
+	printf("%d x %d rays, %d rounds\n", _IMAGE_SIZE, _IMAGE_SIZE, _ROUNDS);
+	float heapSum, arenaSum;
+	double heap1 = shadingLoop(*scene, 1, false, heapSum);
+	double arena1 = shadingLoop(*scene, 1, true, arenaSum);
+	printf("shading loop 1 thread     heap: %7.3f s  arena: %7.3f s\n", heap1, arena1);
+	//Only a single thread adds the values in the same order every time
+	if(heapSum != arenaSum)
+		printf("the loops shaded different values: %f %f\n", heapSum, arenaSum);
+	if(threads > 1)
+	{
+		double heapN = shadingLoop(*scene, threads, false, heapSum);
+		double arenaN = shadingLoop(*scene, threads, true, arenaSum);
+		printf("shading loop %d threads   heap: %7.3f s  arena: %7.3f s\n", threads, heapN, arenaN);
+	}
+
+	smartPtrLoop(shader);
+
+	return 0;
+}
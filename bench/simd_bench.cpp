@@ -0,0 +1,125 @@
+//////////////////////////////////////////////////////////////////////////
+// Ray/box and ray/triangle throughput, one ray at a time and eight rays
+//	at a time with float8. Build once as is, once with make bench _AVX=1
+//	and once with make bench _NO_SIMD=1 (after make clean) to compare
+//	the AVX, SSE and scalar versions
+//////////////////////////////////////////////////////////////////////////
+
+#include "stdafx.h"
+#include "core/bbox.h"
+#include "core/util.h"
+#include "rt/bvh.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstdlib>
+
+#define _COUNT 4096
+#define _ROUNDS 2000
+
+static float randomFloat(float _min, float _max)
+{
+	return _min + (_max - _min) * (float)rand() / (float)RAND_MAX;
+}
+
+static Point randomPoint(float _size)
+{
+	return Point(randomFloat(-_size, _size), randomFloat(-_size, _size), randomFloat(-_size, _size));
+}
+
+int main(int argc, char *argv[])
+{
+	srand(1);
+
+	std::vector<Ray> rays(_COUNT);
+	std::vector<BBox> boxes(_COUNT);
+	std::vector<Point> triangles(_COUNT * 3);
+	for(size_t i = 0; i < _COUNT; i++)
+	{
+		rays[i].o = randomPoint(10);
+		rays[i].d = ~(randomPoint(1) - rays[i].o);
+
+		boxes[i] = BBox::empty();
+		boxes[i].extend(randomPoint(2));
+		boxes[i].extend(randomPoint(2));
+
+		for(int j = 0; j < 3; j++)
+			triangles[i * 3 + j] = randomPoint(2);
+	}
+
+	//The rays in packets, for the tests on eight rays at once
+	std::vector<RayPacket> packets(_COUNT / RayPacket::SIZE);
+	for(size_t i = 0; i < _COUNT; i++)
+		packets[i / RayPacket::SIZE].setRay(i % RayPacket::SIZE, rays[i]);
+	for(size_t i = 0; i < packets.size(); i++)
+		packets[i].prepare();
+
+	printf("float4 with %s, float8 with %s\n", SIMD_SSE ? "SSE" : "scalar code",
+		SIMD_AVX ? "AVX" : SIMD_SSE ? "2x SSE" : "scalar code");
+
+	//Every ray against a window of boxes and triangles, so that the data stays in the cache.
+	//	The eight rays of a group share a box and triangle, like in the tests on
+	//	eight rays below, and the boxes are tested like in the traversal of the BVH,
+	//	so that both give the same number of hits
+	uint hits = 0;
+	double start = omp_get_wtime();
+	for(size_t r = 0; r < _ROUNDS; r++)
+		for(size_t i = 0; i < _COUNT; i++)
+		{
+			std::pair<float, float> d = boxes[(i / RayPacket::GROUP_SIZE * RayPacket::GROUP_SIZE + r) % _COUNT].intersect(rays[i]);
+			hits += std::max(Primitive::INTEPS(), d.first) < d.second + Primitive::INTEPS();
+		}
+	double time = omp_get_wtime() - start;
+	printf("ray/box:      %7.2f M tests/s (%u hits)\n", _ROUNDS * _COUNT / time * 1e-6, hits);
+
+	hits = 0;
+	start = omp_get_wtime();
+	for(size_t r = 0; r < _ROUNDS; r++)
+		for(size_t i = 0; i < _COUNT; i++)
+		{
+			size_t t = (i / RayPacket::GROUP_SIZE * RayPacket::GROUP_SIZE + r) % _COUNT * 3;
+			float4 ret = intersectTriangle(triangles[t], triangles[t + 1], triangles[t + 2], rays[i]);
+			hits += ret.w < FLT_MAX && ret.w > 0;
+		}
+	time = omp_get_wtime() - start;
+	printf("ray/triangle: %7.2f M tests/s (%u hits)\n", _ROUNDS * _COUNT / time * 1e-6, hits);
+
+	//The same, but every box and triangle is tested against a group of 8 rays.
+	//	The boxes are tested like in the packet traversal of the BVH
+	const uint groupMask = (1u << RayPacket::GROUP_SIZE) - 1;
+	float8 best[RayPacket::GROUPS], entry[RayPacket::GROUPS];
+	for(uint g = 0; g < RayPacket::GROUPS; g++)
+		best[g] = float8::rep(FLT_MAX);
+
+	hits = 0;
+	start = omp_get_wtime();
+	for(size_t r = 0; r < _ROUNDS; r++)
+		for(size_t i = 0; i < _COUNT; i += RayPacket::GROUP_SIZE)
+		{
+			const RayPacket &packet = packets[i / RayPacket::SIZE];
+			uint g = i % RayPacket::SIZE / RayPacket::GROUP_SIZE;
+			uint mask = packetBoxMask(packet, boxes[(i + r) % _COUNT], groupMask << (RayPacket::GROUP_SIZE * g), best, entry);
+			hits += countBits(mask);
+		}
+	time = omp_get_wtime() - start;
+	printf("ray8/box:     %7.2f M tests/s (%u hits)\n", _ROUNDS * _COUNT / time * 1e-6, hits);
+
+	hits = 0;
+	start = omp_get_wtime();
+	for(size_t r = 0; r < _ROUNDS; r++)
+		for(size_t i = 0; i < _COUNT; i += RayPacket::GROUP_SIZE)
+		{
+			size_t t = (i + r) % _COUNT * 3;
+			const RayPacket &packet = packets[i / RayPacket::SIZE];
+			float8 u, v;
+			float8 dist = intersectTriangle8(triangles[t], triangles[t + 1], triangles[t + 2],
+				packet.groups[i % RayPacket::SIZE / RayPacket::GROUP_SIZE], u, v);
+
+			uint mask = ((dist < float8::rep(FLT_MAX)) & (dist > float8::rep(0))).getMask();
+			for(; mask != 0; mask &= mask - 1)
+				hits++;
+		}
+	time = omp_get_wtime() - start;
+	printf("ray8/triangle:%7.2f M tests/s (%u hits)\n", _ROUNDS * _COUNT / time * 1e-6, hits);
+
+	return 0;
+}
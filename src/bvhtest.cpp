@@ -38,6 +38,9 @@ public:
 
 void doit()
 {
+	// wall clock spans of the phases and tiles, see the trace at the end
+	Trace::setRecording(true);
+
 	//Image img(600, 400);
 	Image img(1280, 960);
 
@@ -190,7 +193,7 @@ void doit()
 	//	std::make_pair(img.width(), img.height()),0.9f,0.0f,1.f,4,false);
 
     PerspectiveLensCamera cam4(Point(30.f, 6.f, 0), Point(4,2.f,0), Vector(0, 1, 0), 50,
-		std::make_pair(img.width(), img.height()),0.9f,0.3f,1.f,16,true);
+		std::make_pair(img.width(), img.height()),0.9f,0.3f,1.f,1,true);
 
     //PerspectiveLensCamera cam1(Point(30.f, 0.f, 0.f), Point(0, 0, 0), Vector(0, 1, 0), 60,
 	//	std::make_pair(img.width(), img.height()),0.9f,0.0f,1.f,4,true);
@@ -236,17 +239,34 @@ void doit()
 	DefaultSampler samp;
 	samp.addRef();
 
-	HaltonSampleGenerator halton;
-	halton.sampleCount = 4;
+	// the lens positions come from the sampler, so a single
+	// ray per sample is enough for the depth of field.
+	// The sobol samples of a pixel do not depend on the
+	// tiles rendered before, so resuming gives the same image
+	SobolSampler sobol;
+	sobol.addRef();
+	sobol.sampleCount = 16;
 
 	//Render
 	Renderer r;
 	r.integrator = &integrator;
 	r.target = &img;
-	r.sampler = &halton;
+	r.sampler = &sobol;
 
 	r.camera = &cam4;
-	r.render(32,23);
+	// an interrupted render resumes from the checkpoint, the
+	// checkpoint holds the tiles instead of the per row PNGs
+	r.checkpointFile = "frey_leonhardt_rc.checkpoint";
+	// per pixel cost images (time, with make _STATS=1 also nodes and
+	// primitives) next to the image, renders without ray packets
+	//r.costImagePrefix = "frey_leonhardt_rc";
+	r.render(32,0);
 	img.writePNG("frey_leonhardt_rc.png");
 
+	// with make _STATS=1
+	Statistics::report(std::cout, "frey_leonhardt_rc.stats.json");
+
+	// open in chrome://tracing or Perfetto
+	Trace::write("frey_leonhardt_rc.trace.json");
+
 }
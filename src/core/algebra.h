@@ -6,6 +6,10 @@
 
 #include "defs.h"
 
+#if SIMD_SSE
+	#include <emmintrin.h>
+#endif
+
 #pragma region Structures on 4 components (float4 and int4)
 
 #define _DEF_BIN_OP4(_OP)                                                      \
@@ -39,7 +43,9 @@
 	const t_scalar& operator[] (int _index) const                              \
 	{                                                                          \
 		return (reinterpret_cast<const t_scalar*>(this))[_index];              \
-	}                                                                          \
+	}
+
+#define _DEF_SHUFFLE4                                                          \
 	template<int _i1, int _i2, int _i3, int _i4>                               \
 	const t_this shuffle() const                                               \
 	{                                                                          \
@@ -83,9 +89,93 @@ friend t_this operator _OP (const _TARG &_v, const t_this &_t)                 \
 	return ret _OP##= _v;                                                      \
 }
 
+#if SIMD_SSE
+//The SSE versions of the operations. The results are the same as those
+//	of the scalar versions
+
+//The components share their storage with an SSE register, the
+//	compiler can keep the values in registers between the operations
+#define _DEF_SIMD_CONSTR_AND_ACCESSORS4(_NAME, _SIMD_TYPE, _SETR)              \
+	union                                                                      \
+	{                                                                          \
+		_SIMD_TYPE m_simd;                                                     \
+		struct { t_scalar x, y, z, w; };                                       \
+	};                                                                         \
+	_NAME() {}                                                                 \
+	_NAME(t_scalar _x, t_scalar _y,                                            \
+		t_scalar _z, t_scalar _w)                                              \
+		: m_simd(_SETR(_x, _y, _z, _w))                                        \
+		{}                                                                     \
+	t_scalar& operator[] (int _index)                                          \
+	{                                                                          \
+		return (reinterpret_cast<t_scalar*>(this))[_index];                    \
+	}                                                                          \
+	const t_scalar& operator[] (int _index) const                              \
+	{                                                                          \
+		return (reinterpret_cast<const t_scalar*>(this))[_index];              \
+	}                                                                          \
+	explicit _NAME(__m128 _v) { setSimd(_v); }                                 \
+	explicit _NAME(__m128i _v) { setSimd(_v); }
+
+#define _DEF_SIMD_SHUFFLE4(_INTRIN, _GET)                                      \
+	template<int _i1, int _i2, int _i3, int _i4>                               \
+	const t_this shuffle() const                                               \
+	{                                                                          \
+		return t_this(_INTRIN(_GET(), _MM_SHUFFLE(_i4, _i3, _i2, _i1)));       \
+	}
+
+#define _DEF_SIMD_BIN_OP4(_OP, _INTRIN)                                        \
+	const t_this operator _OP (const t_this &_v) const                         \
+	{                                                                          \
+		return t_this(_INTRIN(simdFloat(), _v.simdFloat()));                   \
+	}                                                                          \
+	t_this& operator _OP##= (const t_this &_v)                                 \
+	{                                                                          \
+		return *this = *this _OP _v;                                           \
+	}
+
+#define _DEF_SIMD_CMPOP(_OP, _INTRIN)                                          \
+	const t_cmpResult operator _OP (const t_this& _val) const                  \
+	{                                                                          \
+		return t_cmpResult(_INTRIN(simdFloat(), _val.simdFloat()));            \
+	}
+
+#define _DEF_SIMD_LOGOP(_OP, _TARG, _INTRIN)                                   \
+t_this& operator _OP##= (const _TARG &_v)                                      \
+{                                                                              \
+	return *this = *this _OP _v;                                               \
+}                                                                              \
+const t_this operator _OP (const _TARG &_v) const                              \
+{                                                                              \
+	return t_this(_INTRIN(simdFloat(), _v.simdFloat()));                       \
+}
+
+#define _DEF_SIMD_LOGOP_SYM(_OP, _TARG, _INTRIN)                               \
+friend t_this operator _OP (const _TARG &_v, const t_this &_t)                 \
+{                                                                              \
+	return t_this(_INTRIN(_t.simdFloat(), _v.simdFloat()));                    \
+}
+
+#define _SIMD_SHUFFLE_PS(_V, _MASK) _mm_shuffle_ps(_V, _V, _MASK)
+
+//getMask puts .x to bit 3, movemask to bit 0
+#define _DEF_SIMD_GETMASK                                                      \
+	int getMask() const                                                        \
+	{                                                                          \
+		__m128 v = simdFloat();                                                \
+		return _mm_movemask_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3))); \
+	}
+#endif
+
 struct Point;
 struct Vector;
 
+//The SSE versions of int4 and float4 put the components into an anonymous struct
+#if defined(__GNUC__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
 //A 4 component int32 value
 struct int4
 {
@@ -95,7 +185,31 @@ struct int4
 
 	//Constructors: default and int4(x, y, z, w)
 	//Can also access the object using the [] operator
+#if SIMD_SSE
+	_DEF_SIMD_CONSTR_AND_ACCESSORS4(int4, __m128i, _mm_setr_epi32)
+
+	__m128 simdFloat() const { return _mm_castsi128_ps(m_simd); }
+	__m128i simdInt() const { return m_simd; }
+	void setSimd(__m128 _v) { m_simd = _mm_castps_si128(_v); }
+	void setSimd(__m128i _v) { m_simd = _v; }
+	_DEF_SIMD_SHUFFLE4(_mm_shuffle_epi32, simdInt)
+
+	//Bitwise operations with results from comparison. Very convenient for implementing
+	//	per-component conditionals in the form (a _OP_ b ? a : b).
+	_DEF_SIMD_LOGOP(&, int4, _mm_and_ps);
+	_DEF_SIMD_LOGOP(|, int4, _mm_or_ps);
+	_DEF_SIMD_LOGOP(^, int4, _mm_xor_ps);
+
+	const t_this operator~() const
+	{
+		return t_this(_mm_xor_si128(simdInt(), _mm_set1_epi32(-1)));
+	}
+
+	//Returns a mask containing the sign bit of each component
+	_DEF_SIMD_GETMASK
+#else
 	_DEF_CONSTR_AND_ACCESSORS4(int4)
+	_DEF_SHUFFLE4
 
 	//Bitwise operations with results from comparison. Very convenient for implementing
 	//	per-component conditionals in the form (a _OP_ b ? a : b).
@@ -119,6 +233,7 @@ struct int4
 	{
 		return (((uint)x >> 31) << 3) | (((uint)y >> 31) << 2) | (((uint)z >> 31) << 1) | ((uint)w >> 31);
 	}
+#endif
 };
 
 //The float4 class can be used for color and vector calculations
@@ -130,7 +245,16 @@ struct float4
 
 	//Constructors: default and float4(x, y, z, w)
 	//Can also access the object using the [] operator
+#if SIMD_SSE
+	_DEF_SIMD_CONSTR_AND_ACCESSORS4(float4, __m128, _mm_setr_ps)
+
+	__m128 simdFloat() const { return m_simd; }
+	__m128i simdInt() const { return _mm_castps_si128(m_simd); }
+	void setSimd(__m128 _v) { m_simd = _v; }
+	void setSimd(__m128i _v) { m_simd = _mm_castsi128_ps(_v); }
+#else
 	_DEF_CONSTR_AND_ACCESSORS4(float4)
+#endif
 
 	//Creates a float4 from a point, by setting the .w component to 1
 	float4(const Point&);
@@ -138,6 +262,47 @@ struct float4
 	//Creates a float4 from a vector, by setting the .w component to 0
 	float4(const Vector&);
 
+#if SIMD_SSE
+	_DEF_SIMD_SHUFFLE4(_SIMD_SHUFFLE_PS, simdFloat)
+
+	//float4 supports per-component +, -, * and /. Thus float4(1, 2, 3, 4) * float4(2, 2, 2, 2) gives float4(2, 4, 6, 8)
+	_DEF_SIMD_BIN_OP4(+, _mm_add_ps);
+	_DEF_SIMD_BIN_OP4(-, _mm_sub_ps);
+	_DEF_SIMD_BIN_OP4(*, _mm_mul_ps);
+	_DEF_SIMD_BIN_OP4(/, _mm_div_ps);
+
+	//Per-component comparison operations. Return int4. For each component, the return value
+	//	is -1 if the condition holds and 0 otherwise. You can use the getMask to see the result
+	//	in a more compact form
+	_DEF_SIMD_CMPOP(<, _mm_cmplt_ps);
+	_DEF_SIMD_CMPOP(<=, _mm_cmple_ps);
+	_DEF_SIMD_CMPOP(>, _mm_cmpgt_ps);
+	_DEF_SIMD_CMPOP(>=, _mm_cmpge_ps);
+	_DEF_SIMD_CMPOP(==, _mm_cmpeq_ps);
+	_DEF_SIMD_CMPOP(!=, _mm_cmpneq_ps);
+
+	//Bitwise operations with results from comparison. Very convenient for implementing
+	//	per-component conditionals in the form (a _OP_ b ? a : b).
+	_DEF_SIMD_LOGOP(&, int4, _mm_and_ps);
+	_DEF_SIMD_LOGOP_SYM(&, int4, _mm_and_ps);
+	_DEF_SIMD_LOGOP(&, float4, _mm_and_ps);
+
+	_DEF_SIMD_LOGOP(|, int4, _mm_or_ps);
+	_DEF_SIMD_LOGOP_SYM(|, int4, _mm_or_ps);
+	_DEF_SIMD_LOGOP(|, float4, _mm_or_ps);
+
+	_DEF_SIMD_LOGOP(^, int4, _mm_xor_ps);
+	_DEF_SIMD_LOGOP_SYM(^, int4, _mm_xor_ps);
+	_DEF_SIMD_LOGOP(^, float4, _mm_xor_ps);
+
+	//An unary minus
+	const t_this operator- () const
+	{
+		return t_this(_mm_xor_ps(simdFloat(), _mm_set1_ps(-0.f)));
+	}
+#else
+	_DEF_SHUFFLE4
+
 	//float4 supports per-component +, -, * and /. Thus float4(1, 2, 3, 4) * float4(2, 2, 2, 2) gives float4(2, 4, 6, 8)
 	_DEF_BIN_OP4(+);
 	_DEF_BIN_OP4(-);
@@ -145,7 +310,7 @@ struct float4
 	_DEF_BIN_OP4(/);
 
 	//Per-component comparison operations. Return int4. For each component, the return value
-	//	is 0 if the condition holds and -1 otherwise. You can use the getMask to see the result
+	//	is -1 if the condition holds and 0 otherwise. You can use the getMask to see the result
 	//	in a more compact form
 	_DEF_CMPOP(<);
 	_DEF_CMPOP(<=);
@@ -171,6 +336,7 @@ struct float4
 
 	//An unary minus
 	_DEF_UNARY_MINUS4;
+#endif
 
 	//A replication function. You can use float4::rep(4.f) as a shortcut to float4(4.f, 4.f, 4.f, 4.f)
 	_DEF_REP4;
@@ -191,22 +357,36 @@ struct float4
 	//A component-wise minimum between two float4s
 	static const float4 min(const float4 & _v1, const float4 & _v2)
 	{
+#if SIMD_SSE
+		//minps returns the second operand if the first is not smaller,
+		//	like std::min(_v1, _v2) returns _v1 unless _v2 is smaller
+		return float4(_mm_min_ps(_v2.simdFloat(), _v1.simdFloat()));
+#else
 		return float4(
 			std::min(_v1.x, _v2.x), std::min(_v1.y, _v2.y),
 			std::min(_v1.z, _v2.z), std::min(_v1.w, _v2.w)
 			);
+#endif
 	}
 
 	//A component-wise maximum between two float4s
 	static const float4 max(const float4 & _v1, const float4 & _v2)
 	{
+#if SIMD_SSE
+		return float4(_mm_max_ps(_v2.simdFloat(), _v1.simdFloat()));
+#else
 		return float4(
 			std::max(_v1.x, _v2.x), std::max(_v1.y, _v2.y),
 			std::max(_v1.z, _v2.z), std::max(_v1.w, _v2.w)
 			);
+#endif
 	}
 };
 
+#if defined(__GNUC__)
+	#pragma GCC diagnostic pop
+#endif
+
 #pragma endregion
 
 
@@ -298,11 +478,11 @@ struct Vector
 		return x * _v.x + y * _v.y + z * _v.z;
 	}
 
-	//Cross product
+	//Cross product. The same as float4::cross, but without packing the
+	//	components into a float4
 	const Vector operator %(const Vector& _v) const
 	{
-		float4 t = float4(*this).cross(float4(_v));
-		return Vector(t.x, t.y, t.z);
+		return Vector(y * _v.z - z * _v.y, z * _v.x - x * _v.z, x * _v.y - y * _v.x);
 	}
 
 	//Length of the vector
@@ -366,8 +546,13 @@ struct Point
 	}
 };
 
+#if SIMD_SSE
+inline float4::float4(const Point& _v) : m_simd(_mm_setr_ps(_v.x, _v.y, _v.z, 1)) {}
+inline float4::float4(const Vector& _v) : m_simd(_mm_setr_ps(_v.x, _v.y, _v.z, 0)) {}
+#else
 inline float4::float4(const Point& _v) {x = _v.x; y = _v.y; z = _v.z; w = 1;}
 inline float4::float4(const Vector& _v) {x = _v.x; y = _v.y; z = _v.z; w = 0;}
+#endif
 
 #pragma endregion
 
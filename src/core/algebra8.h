@@ -0,0 +1,350 @@
+#ifndef __INCLUDE_GUARD_D72E30D6_DB14_4E45_BFA7_413ECFE80A36
+#define __INCLUDE_GUARD_D72E30D6_DB14_4E45_BFA7_413ECFE80A36
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "algebra.h"
+
+#if SIMD_AVX
+	#include <immintrin.h>
+#endif
+
+//Structure of arrays types on 8 lanes: float8, mask8, Point8 and Vector8.
+//	They process 8 rays, triangles, photons, ... with one instruction per
+//	operation. With AVX (SIMD_AVX) a float8 is one register, otherwise it is
+//	a pair of float4s. Each lane is computed like the scalar float code, so
+//	kernels on 8 lanes give the same results as their scalar versions.
+
+#pragma region Structures on 8 lanes (float8 and mask8)
+
+#if SIMD_AVX
+
+#define _DEF_CONSTR_AND_ACCESSORS8(_NAME)                                      \
+	__m256 m_simd;                                                             \
+	_NAME() {}                                                                 \
+	explicit _NAME(__m256 _v) : m_simd(_v) {}                                  \
+	t_scalar& operator[] (int _index)                                          \
+	{                                                                          \
+		return (reinterpret_cast<t_scalar*>(this))[_index];                    \
+	}                                                                          \
+	const t_scalar& operator[] (int _index) const                              \
+	{                                                                          \
+		return (reinterpret_cast<const t_scalar*>(this))[_index];              \
+	}
+
+#define _DEF_OP8(_OP, _TARG, _RET, _INTRIN)                                    \
+	const _RET operator _OP (const _TARG &_v) const                            \
+	{                                                                          \
+		return _RET(_INTRIN(m_simd, _v.m_simd));                               \
+	}
+
+#define _DEF_CMPOP8(_OP, _PRED)                                                \
+	const mask8 operator _OP (const t_this &_v) const                          \
+	{                                                                          \
+		return mask8(_mm256_cmp_ps(m_simd, _v.m_simd, _PRED));                 \
+	}
+
+#else
+
+//Without AVX the lanes are split into two halves of 4
+#define _DEF_CONSTR_AND_ACCESSORS8(_NAME)                                      \
+	t_half lo, hi;                                                             \
+	_NAME() {}                                                                 \
+	_NAME(const t_half &_lo, const t_half &_hi) : lo(_lo), hi(_hi) {}          \
+	t_scalar& operator[] (int _index)                                          \
+	{                                                                          \
+		return (reinterpret_cast<t_scalar*>(this))[_index];                    \
+	}                                                                          \
+	const t_scalar& operator[] (int _index) const                              \
+	{                                                                          \
+		return (reinterpret_cast<const t_scalar*>(this))[_index];              \
+	}
+
+#define _DEF_OP8(_OP, _TARG, _RET, _INTRIN)                                    \
+	const _RET operator _OP (const _TARG &_v) const                            \
+	{                                                                          \
+		return _RET(lo _OP _v.lo, hi _OP _v.hi);                               \
+	}
+
+#define _DEF_CMPOP8(_OP, _PRED)                                                \
+	const mask8 operator _OP (const t_this &_v) const                          \
+	{                                                                          \
+		return mask8(lo _OP _v.lo, hi _OP _v.hi);                              \
+	}
+
+#endif
+
+#define _DEF_ASSIGN_OP8(_OP, _TARG)                                            \
+	t_this& operator _OP##= (const _TARG &_v)                                  \
+	{                                                                          \
+		return *this = *this _OP _v;                                           \
+	}
+
+//The result of a comparison of two float8s. All bits of a lane are set
+//	if the condition holds for it and clear otherwise
+struct mask8
+{
+	typedef mask8 t_this;
+	typedef int t_scalar;
+	typedef int4 t_half;
+
+	_DEF_CONSTR_AND_ACCESSORS8(mask8)
+
+	_DEF_OP8(&, mask8, mask8, _mm256_and_ps);
+	_DEF_OP8(|, mask8, mask8, _mm256_or_ps);
+	_DEF_OP8(^, mask8, mask8, _mm256_xor_ps);
+	_DEF_ASSIGN_OP8(&, mask8);
+	_DEF_ASSIGN_OP8(|, mask8);
+	_DEF_ASSIGN_OP8(^, mask8);
+
+	const t_this operator~() const
+	{
+#if SIMD_AVX
+		return t_this(_mm256_xor_ps(m_simd, _mm256_castsi256_ps(_mm256_set1_epi32(-1))));
+#else
+		return t_this(~lo, ~hi);
+#endif
+	}
+
+	//Returns a mask with bit i set if the condition holds for lane i.
+	//	Unlike in int4::getMask, the first lane is in bit 0
+	uint getMask() const
+	{
+#if SIMD_AVX
+		return (uint)_mm256_movemask_ps(m_simd);
+#else
+		return halfMask(lo) | halfMask(hi) << 4;
+#endif
+	}
+
+	bool any() const { return getMask() != 0; }
+	bool all() const { return getMask() == 255; }
+	bool none() const { return getMask() == 0; }
+
+#if !SIMD_AVX
+private:
+	//int4::getMask puts .x to bit 3
+	static uint halfMask(const int4 &_v)
+	{
+		uint m = (uint)_v.getMask();
+		return (m >> 3 & 1) | (m >> 1 & 2) | (m << 1 & 4) | (m << 3 & 8);
+	}
+#endif
+};
+
+//8 floats, one per lane
+struct float8
+{
+	typedef float8 t_this;
+	typedef float t_scalar;
+	typedef float4 t_half;
+
+	//Constructors: default, from a register or from two float4s.
+	//Can also access the lanes using the [] operator
+	_DEF_CONSTR_AND_ACCESSORS8(float8)
+
+	//A replication function. float8::rep(4.f) has 4.f in all lanes
+	static t_this rep(t_scalar _v)
+	{
+#if SIMD_AVX
+		return t_this(_mm256_set1_ps(_v));
+#else
+		return t_this(float4::rep(_v), float4::rep(_v));
+#endif
+	}
+
+	//Per-lane +, -, * and /
+	_DEF_OP8(+, float8, float8, _mm256_add_ps);
+	_DEF_OP8(-, float8, float8, _mm256_sub_ps);
+	_DEF_OP8(*, float8, float8, _mm256_mul_ps);
+	_DEF_OP8(/, float8, float8, _mm256_div_ps);
+	_DEF_ASSIGN_OP8(+, float8);
+	_DEF_ASSIGN_OP8(-, float8);
+	_DEF_ASSIGN_OP8(*, float8);
+	_DEF_ASSIGN_OP8(/, float8);
+
+	//An unary minus
+	const t_this operator- () const
+	{
+#if SIMD_AVX
+		return t_this(_mm256_xor_ps(m_simd, _mm256_set1_ps(-0.f)));
+#else
+		return t_this(-lo, -hi);
+#endif
+	}
+
+	//Per-lane comparison operations, returning a mask8
+	_DEF_CMPOP8(<, _CMP_LT_OQ);
+	_DEF_CMPOP8(<=, _CMP_LE_OQ);
+	_DEF_CMPOP8(>, _CMP_GT_OQ);
+	_DEF_CMPOP8(>=, _CMP_GE_OQ);
+	_DEF_CMPOP8(==, _CMP_EQ_OQ);
+	_DEF_CMPOP8(!=, _CMP_NEQ_UQ);
+
+	//Per lane _mask ? _v1 : _v2
+	static const float8 select(const mask8 &_mask, const float8 &_v1, const float8 &_v2)
+	{
+#if SIMD_AVX
+		return float8(_mm256_blendv_ps(_v2.m_simd, _v1.m_simd, _mask.m_simd));
+#else
+		return float8(
+			(_mask.lo & _v1.lo) | (~_mask.lo & _v2.lo),
+			(_mask.hi & _v1.hi) | (~_mask.hi & _v2.hi)
+			);
+#endif
+	}
+
+	//Per-lane minimum and maximum, with the semantics of std::min and std::max
+	static const float8 min(const float8 &_v1, const float8 &_v2)
+	{
+#if SIMD_AVX
+		return float8(_mm256_min_ps(_v2.m_simd, _v1.m_simd));
+#else
+		return float8(float4::min(_v1.lo, _v2.lo), float4::min(_v1.hi, _v2.hi));
+#endif
+	}
+
+	static const float8 max(const float8 &_v1, const float8 &_v2)
+	{
+#if SIMD_AVX
+		return float8(_mm256_max_ps(_v2.m_simd, _v1.m_simd));
+#else
+		return float8(float4::max(_v1.lo, _v2.lo), float4::max(_v1.hi, _v2.hi));
+#endif
+	}
+
+	//The absolute value of each lane
+	static const float8 abs(const float8 &_v)
+	{
+#if SIMD_AVX
+		return float8(_mm256_andnot_ps(_mm256_set1_ps(-0.f), _v.m_simd));
+#else
+		int4 noSign(0x7fffffff, 0x7fffffff, 0x7fffffff, 0x7fffffff);
+		return float8(_v.lo & noSign, _v.hi & noSign);
+#endif
+	}
+
+	//Horizontal reductions over the 8 lanes. The lanes are added in the
+	//	same order with and without AVX
+	float reduceMin() const
+	{
+		float4 v = float4::min(half(0), half(1));
+		return std::min(std::min(v.x, v.z), std::min(v.y, v.w));
+	}
+
+	float reduceMax() const
+	{
+		float4 v = float4::max(half(0), half(1));
+		return std::max(std::max(v.x, v.z), std::max(v.y, v.w));
+	}
+
+	float reduceAdd() const
+	{
+		float4 v = half(0) + half(1);
+		return (v.x + v.z) + (v.y + v.w);
+	}
+
+	//Lanes 0 to 3 or 4 to 7
+	const float4 half(int _index) const
+	{
+#if SIMD_AVX
+		return float4(_index == 0 ? _mm256_castps256_ps128(m_simd) : _mm256_extractf128_ps(m_simd, 1));
+#else
+		return _index == 0 ? lo : hi;
+#endif
+	}
+};
+
+#pragma endregion
+
+#pragma region Points and vectors on 8 lanes (Point8 and Vector8)
+
+//8 vectors, with one float8 per coordinate
+struct Vector8
+{
+	typedef Vector8 t_this;
+	typedef float8 t_scalar;
+
+	//Constructors: default and Vector8(x, y, z)
+	//Can also access the coordinates using the [] operator
+	_DEF_CONSTR_AND_ACCESSORS3(Vector8);
+
+	//Vector8(_v, _v, ...)
+	static t_this rep(const Vector &_v)
+	{
+		return t_this(float8::rep(_v.x), float8::rep(_v.y), float8::rep(_v.z));
+	}
+
+	void set(int _lane, const Vector &_v)
+	{
+		x[_lane] = _v.x; y[_lane] = _v.y; z[_lane] = _v.z;
+	}
+
+	const Vector get(int _lane) const
+	{
+		return Vector(x[_lane], y[_lane], z[_lane]);
+	}
+
+	_DEF_BIN_OP3(+, Vector8); //Vector8 + Vector8 -> Vector8 and Vector8 += Vector8
+	_DEF_BIN_OP3(-, Vector8); //Vector8 - Vector8 -> Vector8 and Vector8 -= Vector8
+
+	_DEF_SCALAR_OP3(*, float8); //Vector8 * float8 -> Vector8 and Vector8 *= float8
+	_DEF_SCALAR_OP3_SYM(*, float8); //float8 * Vector8 -> Vector8
+	_DEF_SCALAR_OP3(/, float8); //Vector8 / float8 and Vector8 /= float8
+
+	//Unary minus
+	_DEF_UNARY_MINUS3;
+
+	//Dot product per lane
+	const float8 operator* (const Vector8& _v) const
+	{
+		return x * _v.x + y * _v.y + z * _v.z;
+	}
+
+	//Cross product per lane
+	const Vector8 operator %(const Vector8& _v) const
+	{
+		return Vector8(y * _v.z - z * _v.y, z * _v.x - x * _v.z, x * _v.y - y * _v.x);
+	}
+};
+
+//8 points, with one float8 per coordinate
+struct Point8
+{
+	typedef Point8 t_this;
+	typedef float8 t_scalar;
+
+	//Constructors: default and Point8(x, y, z)
+	//Can also access the coordinates using the [] operator
+	_DEF_CONSTR_AND_ACCESSORS3(Point8);
+
+	//Point8(_v, _v, ...)
+	static t_this rep(const Point &_v)
+	{
+		return t_this(float8::rep(_v.x), float8::rep(_v.y), float8::rep(_v.z));
+	}
+
+	void set(int _lane, const Point &_v)
+	{
+		x[_lane] = _v.x; y[_lane] = _v.y; z[_lane] = _v.z;
+	}
+
+	const Point get(int _lane) const
+	{
+		return Point(x[_lane], y[_lane], z[_lane]);
+	}
+
+	_DEF_BIN_OP3(+, Vector8); //Point8 + Vector8 -> Point8 and Point8 += Vector8
+	_DEF_BIN_OP3(-, Vector8); //Point8 - Vector8 -> Point8 and Point8 -= Vector8
+
+	//Point8 - Point8 -> Vector8
+	const Vector8 operator- (const Point8& _v) const
+	{
+		return Vector8(x - _v.x, y - _v.y, z - _v.z);
+	}
+};
+
+#pragma endregion
+
+#endif //__INCLUDE_GUARD_D72E30D6_DB14_4E45_BFA7_413ECFE80A36
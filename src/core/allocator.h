@@ -0,0 +1,320 @@
+#ifndef __INCLUDE_GUARD_425862F7_89D6_42CE_A22E_1B03D2CCEF88
+#define __INCLUDE_GUARD_425862F7_89D6_42CE_A22E_1B03D2CCEF88
+#ifdef _MSC_VER
+	#pragma once
+	#include <intrin.h>
+	#include <malloc.h>
+#endif
+
+#include "defs.h"
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+#define _ALLOC_SPAN_SIZE 65536 //Size and alignment of a span
+#define _ALLOC_SPAN_HEADER 128 //Objects start behind the header
+#define _ALLOC_GRANULARITY 16 //Object sizes and alignment
+#define _ALLOC_SIZE_CLASSES 64 //Objects up to 1 KB are in size classes
+#define _ALLOC_MAX_EMPTY_SPANS 2 //Empty spans kept per size class
+#define _ALLOC_MAX_CACHED_SPANS 16 //Released spans kept for any size class
+
+//A memory allocator with fixed size classes for small objects.
+//	Each thread has its own heap of spans (64 KB blocks of objects of one
+//	size class), so allocations do not need locks. Any thread may free an
+//	object: the owner of the span puts it into the free list of the span,
+//	other threads push it onto a lock-free remote free list of the span.
+//	The first remote free also queues the span at the owning heap, which
+//	collects the queued spans once it runs out of free objects.
+//	The span of an object is found by aligning its address, so objects
+//	have no header. Larger objects get a span of their own.
+//Spans released by a size class are cached by the heap and reused by
+//	any size class, since aligned allocations of a span are expensive
+//	(glibc maps and unmaps them). The spans of a thread that ends are
+//	not released.
+class SizeClassAllocator
+{
+	struct Heap;
+
+	struct Span
+	{
+		Heap *owner; //NULL for a large object
+		Span *prev, *next; //In the list of spans with free objects
+		Span *nextQueued; //In the queue of spans with remote frees
+		void *freeList;
+		byte *bump, *end; //The objects that were never allocated
+		void * volatile remoteFree;
+		uint sizeClass;
+		uint used; //Allocated objects that were not freed to the owner
+		bool reachable; //Active or in the list of spans with free objects
+	};
+
+	struct Heap
+	{
+		Span *active[_ALLOC_SIZE_CLASSES];
+		Span *available[_ALLOC_SIZE_CLASSES];
+		uint emptySpans[_ALLOC_SIZE_CLASSES];
+		void * volatile queued;
+		Span *cached; //Released spans, linked by next
+		uint cachedSpans;
+	};
+
+public:
+
+	static void* allocate(size_t _size)
+	{
+		size_t sizeClass = (_size + _ALLOC_GRANULARITY - 1) / _ALLOC_GRANULARITY;
+		if(sizeClass > _ALLOC_SIZE_CLASSES)
+			return allocateLarge(_size);
+		sizeClass = sizeClass > 0 ? sizeClass - 1 : 0;
+
+		Heap &heap = getHeap();
+		Span *span = heap.active[sizeClass];
+		if(span == NULL || (span->freeList == NULL && span->bump == span->end))
+		{
+			//The heap finds the span again once an object in it is freed
+			if(span != NULL)
+				span->reachable = false;
+			span = heap.active[sizeClass] = nextSpan(heap, (uint)sizeClass);
+		}
+
+		void *ret;
+		if(span->freeList != NULL)
+		{
+			ret = span->freeList;
+			span->freeList = *(void**)ret;
+		}
+		else
+		{
+			ret = span->bump;
+			span->bump += objectSize(sizeClass);
+		}
+
+		if(span->used++ == 0)
+			heap.emptySpans[sizeClass]--;
+		return ret;
+	}
+
+	static void free(void *_ptr)
+	{
+		if(_ptr == NULL)
+			return;
+
+		Span *span = (Span*)((size_t)_ptr & ~(size_t)(_ALLOC_SPAN_SIZE - 1));
+		if(span->owner == NULL)
+		{
+			freeAligned(span);
+			return;
+		}
+
+		if(span->owner == heapPtr())
+		{
+			*(void**)_ptr = span->freeList;
+			span->freeList = _ptr;
+			if(--span->used == 0 || !span->reachable)
+				freed(*span->owner, span);
+			return;
+		}
+
+		//Push onto the remote free list. The thread that makes the list
+		//	non-empty queues the span at its owner
+		void *head;
+		do
+		{
+			head = span->remoteFree;
+			*(void**)_ptr = head;
+		} while(_InterlockedCompareExchangePointer(&span->remoteFree, _ptr, head) != head);
+
+		if(head == NULL)
+		{
+			Heap *owner = span->owner;
+			void *queued;
+			do
+			{
+				queued = owner->queued;
+				span->nextQueued = (Span*)queued;
+			} while(_InterlockedCompareExchangePointer(&owner->queued, (void*)span, queued) != queued);
+		}
+	}
+
+private:
+
+	static size_t objectSize(size_t _sizeClass) { return (_sizeClass + 1) * _ALLOC_GRANULARITY; }
+
+	static Heap*& heapPtr()
+	{
+		static _THREAD_LOCAL Heap *heap = NULL;
+		return heap;
+	}
+
+	static Heap& getHeap()
+	{
+		Heap *&heap = heapPtr();
+		if(heap == NULL)
+		{
+			heap = (Heap*)malloc(sizeof(Heap));
+			if(heap == NULL)
+				throw std::bad_alloc();
+			memset(heap, 0, sizeof(Heap));
+		}
+		return *heap;
+	}
+
+	static void* allocateAligned(size_t _size)
+	{
+		void *ret;
+#ifdef _MSC_VER
+		ret = _aligned_malloc(_size, _ALLOC_SPAN_SIZE);
+#else
+		if(posix_memalign(&ret, _ALLOC_SPAN_SIZE, _size) != 0)
+			ret = NULL;
+#endif
+		if(ret == NULL)
+			throw std::bad_alloc();
+		return ret;
+	}
+
+	static void freeAligned(void *_ptr)
+	{
+#ifdef _MSC_VER
+		_aligned_free(_ptr);
+#else
+		::free(_ptr);
+#endif
+	}
+
+	static void* allocateLarge(size_t _size)
+	{
+		Span *span = (Span*)allocateAligned(_ALLOC_SPAN_HEADER + _size);
+		span->owner = NULL;
+		return (byte*)span + _ALLOC_SPAN_HEADER;
+	}
+
+	static void link(Heap &_heap, Span *_span)
+	{
+		Span *&head = _heap.available[_span->sizeClass];
+		_span->prev = NULL;
+		_span->next = head;
+		if(head != NULL)
+			head->prev = _span;
+		head = _span;
+		_span->reachable = true;
+	}
+
+	static void unlink(Heap &_heap, Span *_span)
+	{
+		if(_span->prev != NULL)
+			_span->prev->next = _span->next;
+		else
+			_heap.available[_span->sizeClass] = _span->next;
+		if(_span->next != NULL)
+			_span->next->prev = _span->prev;
+		_span->reachable = false;
+	}
+
+	//Bookkeeping after objects went back to the free list of a span
+	//	of the heap. Unreachable spans get listed as available, and spans
+	//	that became empty are released if the heap keeps enough empty
+	//	spans of the size class
+	static void freed(Heap &_heap, Span *_span)
+	{
+		if(!_span->reachable)
+			link(_heap, _span);
+
+		if(_span->used == 0)
+		{
+			if(_heap.active[_span->sizeClass] != _span
+				&& _heap.emptySpans[_span->sizeClass] >= _ALLOC_MAX_EMPTY_SPANS)
+			{
+				unlink(_heap, _span);
+				release(_heap, _span);
+			}
+			else
+				_heap.emptySpans[_span->sizeClass]++;
+		}
+	}
+
+	//Puts an empty span into the cache of the heap, or frees it if
+	//	the cache is full
+	static void release(Heap &_heap, Span *_span)
+	{
+		if(_heap.cachedSpans >= _ALLOC_MAX_CACHED_SPANS)
+		{
+			freeAligned(_span);
+			return;
+		}
+
+		_span->next = _heap.cached;
+		_heap.cached = _span;
+		_heap.cachedSpans++;
+	}
+
+	//Moves the remote frees of all queued spans to their free lists
+	static void collectRemoteFrees(Heap &_heap)
+	{
+		Span *span = (Span*)_InterlockedExchangePointer(&_heap.queued, NULL);
+		while(span != NULL)
+		{
+			//Read the link first, the span can be queued again as soon
+			//	as its remote free list is empty
+			Span *next = span->nextQueued;
+			void *list = _InterlockedExchangePointer(&span->remoteFree, NULL);
+			_ASSERT(list != NULL);
+
+			uint count = 0;
+			void *last = list;
+			for(void *obj = list; obj != NULL; obj = *(void**)obj)
+			{
+				last = obj;
+				count++;
+			}
+			*(void**)last = span->freeList;
+			span->freeList = list;
+			span->used -= count;
+			freed(_heap, span);
+
+			span = next;
+		}
+	}
+
+	//A span of the size class with free objects, the active span
+	//	of the class is exhausted
+	static Span* nextSpan(Heap &_heap, uint _sizeClass)
+	{
+		if(_heap.available[_sizeClass] == NULL && _heap.queued != NULL)
+			collectRemoteFrees(_heap);
+
+		Span *span = _heap.available[_sizeClass];
+		if(span != NULL)
+		{
+			unlink(_heap, span);
+			span->reachable = true;
+			return span;
+		}
+
+		span = _heap.cached;
+		if(span != NULL)
+		{
+			_heap.cached = span->next;
+			_heap.cachedSpans--;
+		}
+		else
+			span = (Span*)allocateAligned(_ALLOC_SPAN_SIZE);
+
+		span->owner = &_heap;
+		span->prev = span->next = span->nextQueued = NULL;
+		span->freeList = NULL;
+		span->remoteFree = NULL;
+		span->sizeClass = _sizeClass;
+		span->used = 0;
+		span->reachable = true;
+
+		size_t size = objectSize(_sizeClass);
+		span->bump = (byte*)span + _ALLOC_SPAN_HEADER;
+		span->end = span->bump + (_ALLOC_SPAN_SIZE - _ALLOC_SPAN_HEADER) / size * size;
+
+		_heap.emptySpans[_sizeClass]++;
+		return span;
+	}
+};
+
+#endif //__INCLUDE_GUARD_425862F7_89D6_42CE_A22E_1B03D2CCEF88
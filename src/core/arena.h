@@ -0,0 +1,175 @@
+#ifndef __INCLUDE_GUARD_BEE9AA8D_3A04_4A83_9B0E_CA37240AA3E4
+#define __INCLUDE_GUARD_BEE9AA8D_3A04_4A83_9B0E_CA37240AA3E4
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "defs.h"
+#include "memory.h"
+#include "stats.h"
+#include <algorithm>
+#include <vector>
+
+#define _ARENA_BLOCK_SIZE 65536
+#define _ARENA_ALIGNMENT 16
+
+//A per-thread bump allocator for the objects that live only while one
+//	camera sample is shaded (hit points, hit shaders). An allocation moves
+//	a pointer, a free does nothing and the memory of all objects is
+//	reclaimed at once, when the outermost PathArena::Scope of the thread
+//	ends. The blocks are kept for the next sample.
+//Use:
+//	{
+//		PathArena::Scope scope;
+//		... trace the sample, objects derived from ArenaRefCntBase
+//			are allocated in the arena ...
+//	}
+class PathArena
+{
+	struct Block
+	{
+		byte *begin, *end;
+	};
+
+	std::vector<Block> m_blocks;
+	size_t m_block; //The block allocations are taken from
+	byte *m_pos;
+	uint m_scopes;
+
+	PathArena() : m_block(0), m_pos(NULL), m_scopes(0) {}
+
+	static PathArena*& arenaPtr()
+	{
+		static _THREAD_LOCAL PathArena *arena = NULL;
+		return arena;
+	}
+
+	void* allocateInNextBlock(size_t _size)
+	{
+		if(m_pos != NULL)
+			m_block++;
+		while(m_block < m_blocks.size() && (size_t)(m_blocks[m_block].end - m_blocks[m_block].begin) < _size)
+			m_block++;
+
+		if(m_block == m_blocks.size())
+		{
+			size_t size = std::max(_size, (size_t)_ARENA_BLOCK_SIZE);
+			Block block;
+			block.begin = (byte*)malloc(size);
+			if(block.begin == NULL)
+				throw std::bad_alloc();
+			block.end = block.begin + size;
+			m_blocks.push_back(block);
+		}
+
+		m_pos = m_blocks[m_block].begin + _size;
+		return m_blocks[m_block].begin;
+	}
+
+public:
+
+	//Objects derived from ArenaRefCntBase, which are created while a scope
+	//	of the thread exists, are allocated in its arena. The arena is
+	//	reset when the outermost scope ends, the objects must be deleted
+	//	by then and must not be passed to other threads
+	class Scope
+	{
+		PathArena &m_arena;
+
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+
+	public:
+		Scope() : m_arena(get()) { m_arena.m_scopes++; }
+		~Scope()
+		{
+			if(--m_arena.m_scopes == 0)
+				m_arena.reset();
+		}
+	};
+
+	//The arena of the calling thread
+	static PathArena& get()
+	{
+		PathArena *&arena = arenaPtr();
+		if(arena == NULL)
+			arena = new PathArena;
+		return *arena;
+	}
+
+	//The arena of the calling thread, if it is inside a scope
+	static PathArena* active()
+	{
+		PathArena *arena = arenaPtr();
+		return arena != NULL && arena->m_scopes > 0 ? arena : NULL;
+	}
+
+	//The arena of the calling thread, if it has one
+	static PathArena* current() { return arenaPtr(); }
+
+	void* allocate(size_t _size)
+	{
+		_size = (_size + _ARENA_ALIGNMENT - 1) & ~(size_t)(_ARENA_ALIGNMENT - 1);
+		if(m_pos != NULL && (size_t)(m_blocks[m_block].end - m_pos) >= _size)
+		{
+			void *ret = m_pos;
+			m_pos += _size;
+			return ret;
+		}
+		return allocateInNextBlock(_size);
+	}
+
+	//Whether _ptr is in one of the blocks used since the last reset
+	bool owns(const void *_ptr) const
+	{
+		if(m_pos == NULL)
+			return false;
+		for(size_t i = 0; i <= m_block; i++)
+			if(_ptr >= m_blocks[i].begin && _ptr < m_blocks[i].end)
+				return true;
+		return false;
+	}
+
+	void reset()
+	{
+		m_block = 0;
+		m_pos = NULL;
+	}
+};
+
+//A base for reference counted objects, which are allocated in the
+//	PathArena of the thread while a PathArena::Scope exists and on the
+//	heap otherwise. SmartPtr works with both, deleting an object in the
+//	arena runs its destructor but leaves the memory to the arena.
+//Objects created inside a scope never leave the thread, so their reference
+//	counts are changed non-atomically.
+struct ArenaRefCntBase : public RefCntBase
+{
+	ArenaRefCntBase() { initRefCntPolicy(); }
+	ArenaRefCntBase(const ArenaRefCntBase &_other) : RefCntBase(_other) { initRefCntPolicy(); }
+
+	void *operator new(size_t _size)
+	{
+		_STAT_INC(SC_HitAllocations);
+		PathArena *arena = PathArena::active();
+		if(arena != NULL)
+			return arena->allocate(_size);
+		return SizeClassAllocator::allocate(_size);
+	}
+
+	void operator delete (void * _obj)
+	{
+		PathArena *arena = PathArena::current();
+		if(arena == NULL || !arena->owns(_obj))
+			SizeClassAllocator::free(_obj);
+	}
+
+private:
+	void initRefCntPolicy()
+	{
+		if(PathArena::active() != NULL)
+			setRefCntPolicy(RCP_ThreadConfined);
+	}
+};
+
+#endif //__INCLUDE_GUARD_BEE9AA8D_3A04_4A83_9B0E_CA37240AA3E4
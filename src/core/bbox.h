@@ -24,10 +24,7 @@ struct BBox
 
 		float4 div = _ray.d;
 		int4 cmp = (div > float4::rep(-EPS)) & (div < float4::rep(EPS));
-		for(int i = 0; i < 4; i++)
-			if(cmp[i] != 0)
-			div[i] = EPS;
-		//div = (cmp & float4::rep(EPS)) | (~cmp & div);
+		div = (cmp & float4::rep(EPS)) | (~cmp & div);
 
 		float4 t1 = (v1 - _ray.o) / div;
 		float4 t2 = (v2 - _ray.o) / div;
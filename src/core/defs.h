@@ -23,8 +23,10 @@ typedef unsigned long   ulong;
 #define _FORCE_INLINE
 #define _ALIGNOF __alignof__
 #define modf modff
-#define _InterlockedIncrement(_X) __sync_fetch_and_add(_X, 1)
-#define _InterlockedDecrement(_X) __sync_fetch_and_sub(_X, 1)
+#define _InterlockedIncrement(_X) __sync_add_and_fetch(_X, 1)
+#define _InterlockedDecrement(_X) __sync_sub_and_fetch(_X, 1)
+#define _InterlockedCompareExchangePointer(_X, _NEW, _OLD) __sync_val_compare_and_swap(_X, _OLD, _NEW)
+#define _InterlockedExchangePointer(_X, _NEW) __sync_lock_test_and_set(_X, _NEW)
 #else
 #define _THREAD_LOCAL __declspec(thread)
 #define _FORCE_INLINE __forceinline
@@ -44,6 +46,27 @@ typedef unsigned long   ulong;
 #define ACC_STRUCT 0
 #endif
 
+//use SSE for float4 and int4 if the target has it, unless NO_SIMD is set to 1
+#define SIMD_SSE 0
+#if NO_SIMD!=1 && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#undef SIMD_SSE
+#define SIMD_SSE 1
+#endif
+
+//use AVX for float8 and mask8 if the target has it (for example with -mavx)
+#define SIMD_AVX 0
+#if SIMD_SSE && defined(__AVX__)
+#undef SIMD_AVX
+#define SIMD_AVX 1
+#endif
+
+//count rays, traversal steps, ... (see core/stats.h) if STATS is set to 1
+#define STATISTICS 0
+#if STATS==1
+#undef STATISTICS
+#define STATISTICS 1
+#endif
+
 // tell gcc to ignore certain warnings
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 #pragma GCC diagnostic ignored "-Wreorder"
@@ -1,5 +1,6 @@
 #include "stdafx.h"
 #include "image.h"
+#include "trace.h"
 
 #ifdef __unix
 #include <png.h>
@@ -68,6 +69,7 @@ void abort_(const char * s, ...)
 
 void Image::writePNG(std::string _fileName)
 {
+	TraceSpan span("write " + _fileName, "io");
 
 #ifdef _WIN32
 	using namespace Gdiplus;
@@ -182,6 +184,7 @@ void Image::writePNG(std::string _fileName)
 
 void Image::readPNG(std::string _fileName)
 {
+	TraceSpan span("read " + _fileName, "io");
 #ifdef _WIN32
 	using namespace Gdiplus;
 
@@ -250,18 +253,18 @@ void Image::readPNG(std::string _fileName)
 
 	png_read_info(png_ptr, info_ptr);
 
-	m_width = info_ptr->width;
-	m_height = info_ptr->height;
+	m_width = png_get_image_width(png_ptr, info_ptr);
+	m_height = png_get_image_height(png_ptr, info_ptr);
 	/*color_type = info_ptr->color_type;
 	bit_depth = info_ptr->bit_depth;*/
 
 	int number_of_passes = png_set_interlace_handling(png_ptr);
 	png_read_update_info(png_ptr, info_ptr);
 
-	std::vector<png_byte> byteData (info_ptr->rowbytes * m_height);
+	std::vector<png_byte> byteData (png_get_rowbytes(png_ptr, info_ptr) * m_height);
 	std::vector<png_byte*> rowData(m_height);
 	for(int i = 0; i < m_height; i++)
-		rowData[i] = i * info_ptr->rowbytes + &byteData.front();
+		rowData[i] = i * png_get_rowbytes(png_ptr, info_ptr) + &byteData.front();
 
 	/* read file */
 	if (setjmp(png_jmpbuf(png_ptr)))
@@ -282,7 +285,7 @@ void Image::readPNG(std::string _fileName)
 			v.z = (float)(*b++) / 255.f;
 			v.y = (float)(*b++) / 255.f;
 			v.x = (float)(*b++) / 255.f;
-			if(info_ptr->channels == 4)
+			if(png_get_channels(png_ptr, info_ptr) == 4)
 				b++;
 			v.w = 0.f;
 		}
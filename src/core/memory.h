@@ -9,6 +9,8 @@
 #endif
 
 #include "defs.h"
+#include "allocator.h"
+#include <utility>
 
 //A hash table implementation with, with no empty checks
 //This class is for internal use only. Use at your own risk
@@ -185,32 +187,31 @@ public:
 
 
 //Derive your classes from this class if you need
-//	high performance frequent allocations/deallocations
+//	high performance frequent allocations/deallocations.
+//	The objects may be deleted by any thread
 class FastAllocObjectBase
 {
-
-	typedef MemoryPool<8192, 16, 4> t_memoryPool;
-	static t_memoryPool& getMemoryPool()
-	{
-		static _THREAD_LOCAL t_memoryPool* pool = NULL;
-		if (pool == NULL)
-			pool = new t_memoryPool;
-
-		return *pool;
-	};
-
 public:
 
 	void *operator new(size_t _size)
 	{
-		return getMemoryPool().allocate(_size);
+		return SizeClassAllocator::allocate(_size);
 	}
 	void operator delete (void * _obj)
 	{
-		getMemoryPool().free(_obj);
+		SizeClassAllocator::free(_obj);
 	}
 };
 
+//How the reference count of an object is changed
+enum RefCntPolicy
+{
+	//Atomically, the object can be referenced from several threads
+	RCP_Shared,
+	//Non-atomically, the object never leaves the thread that created it
+	RCP_ThreadConfined
+};
+
 //A base for reference counted objects. A reference counted object
 //	is deleted automatically, once it's reference count drops to 0.
 //Derived from FastAllocObjectBase and thus suited for frequent
@@ -218,37 +219,50 @@ public:
 struct RefCntBase : public FastAllocObjectBase
 {
 	long m_refCnt;
+	bool m_threadConfined;
 public:
 	RefCntBase()
-		: m_refCnt(0)
+		: m_refCnt(0), m_threadConfined(false)
 	{}
 
 	RefCntBase(const RefCntBase&)
-		: m_refCnt(0)
+		: m_refCnt(0), m_threadConfined(false)
 	{}
 
 	void addRef()
 	{
 #ifdef _OPENMP
-		_InterlockedIncrement(&m_refCnt);
-#else
+		if(!m_threadConfined)
+		{
+			_InterlockedIncrement(&m_refCnt);
+			return;
+		}
+#endif
 		m_refCnt++;
-#endif 
 	}
 
+	//Returns the new reference count
 	long release()
 	{
+		long ret;
 #ifdef _OPENMP
-		long ret = _InterlockedDecrement(&m_refCnt);
-#else
-		long ret = --m_refCnt;
+		if(!m_threadConfined)
+			ret = _InterlockedDecrement(&m_refCnt);
+		else
 #endif
-		if(m_refCnt == 0)
+			ret = --m_refCnt;
+
+		if(ret == 0)
 			delete this;
 
 		return ret;
 	}
 
+	RefCntPolicy getRefCntPolicy() const { return m_threadConfined ? RCP_ThreadConfined : RCP_Shared; }
+
+	//Set the policy before the object is referenced from anywhere
+	void setRefCntPolicy(RefCntPolicy _policy) { m_threadConfined = _policy == RCP_ThreadConfined; }
+
 	RefCntBase& operator=(const RefCntBase& _other)
 	{
 		return *this;
@@ -282,12 +296,27 @@ class SmartPtr
 	template<class ta_ptr>
 	SmartPtr& assign (ta_ptr* _data)
 	{
-		if(m_pointer != NULL)
-			m_pointer->release();
-
+		//Reference the new object first, it may be the same as the old one
+		T *old = m_pointer;
 		m_pointer = static_cast<T*>(_data);
 		if(m_pointer != NULL)
 			m_pointer->addRef();
+
+		if(old != NULL)
+			old->release();
+		return *this;
+	}
+
+	//Takes over the reference of _other
+	template<class ta_other>
+	SmartPtr& move (SmartPtr<ta_other>& _other)
+	{
+		T *old = m_pointer;
+		m_pointer = static_cast<T*>(_other.m_pointer);
+		_other.m_pointer = NULL;
+
+		if(old != NULL)
+			old->release();
 		return *this;
 	}
 
@@ -307,6 +336,12 @@ public:
 
 	SmartPtr(const SmartPtr& _other) : m_pointer(NULL) { assign(_other.m_pointer);}
 
+	//Moving a smart pointer leaves the reference count alone
+	template<class ta_other>
+	SmartPtr(SmartPtr<ta_other>&& _other) : m_pointer(NULL) { move(_other);}
+
+	SmartPtr(SmartPtr&& _other) : m_pointer(NULL) { move(_other);}
+
 	template<class ta_other>
 	SmartPtr& operator= (const SmartPtr<ta_other>& _other)
 	{ return assign(_other.m_pointer); }
@@ -314,6 +349,13 @@ public:
 	SmartPtr& operator= (const SmartPtr& _other)
 	{ return assign(_other.m_pointer); }
 
+	template<class ta_other>
+	SmartPtr& operator= (SmartPtr<ta_other>&& _other)
+	{ return move(_other); }
+
+	SmartPtr& operator= (SmartPtr&& _other)
+	{ return this != &_other ? move(_other) : *this; }
+
 	T* operator-> () { return m_pointer; }
 	const T* operator-> () const { return m_pointer; }
 
@@ -6,6 +6,14 @@
 
 #include "algebra.h"
 
+//Offsets of a hit point and of the ray direction when moving by one pixel
+//	in x and y direction on the image plane
+struct HitDifferentials
+{
+	Vector dPdx, dPdy;
+	Vector dDdx, dDdy;
+};
+
 //A ray class
 struct Ray
 {
@@ -15,11 +23,19 @@ struct Ray
 	float curRefractionIndex; // current refraction index (defaul t= air at sea level)
 	//boolean inObject;
 
+	//Optional ray differentials: the auxiliary rays through the neighbouring
+	//	pixels in x and y direction. Only valid if hasDifferentials is set.
+	//	Texture filtering falls back to the finest level for rays without them
+	bool hasDifferentials;
+	Point rxOrigin, ryOrigin;
+	Vector rxDirection, ryDirection;
+
 	Ray()
 	{
         //astRefractionIndex = 1.00029f;
         curRefractionIndex = 1.00029f;
         //inObject = false;
+		hasDifferentials = false;
 	}
 	Ray(const Point &_o, const Vector &_d)
 		: o(_o), d(_d)
@@ -27,12 +43,37 @@ struct Ray
         //lastRefractionIndex = 1.00029f;
 		curRefractionIndex = 1.00029f;
         //inObject = false;
+		hasDifferentials = false;
 	}
 
 	Point getPoint(float _distance)
 	{
 		return o + _distance * d;
 	}
+
+	//Intersects the auxiliary rays with the tangent plane at a hit point.
+	//	The normal does not need to be normalized. Returns false if the ray
+	//	has no differentials or an auxiliary ray is parallel to the plane
+	bool getHitDifferentials(const Point &_hit, const Vector &_normal, HitDifferentials &_diff) const
+	{
+		if(!hasDifferentials)
+			return false;
+
+		float nx = _normal * rxDirection;
+		float ny = _normal * ryDirection;
+		if(nx == 0.f || ny == 0.f)
+			return false;
+
+		float tx = (_normal * (_hit - rxOrigin)) / nx;
+		float ty = (_normal * (_hit - ryOrigin)) / ny;
+
+		_diff.dPdx = (rxOrigin + tx * rxDirection) - _hit;
+		_diff.dPdy = (ryOrigin + ty * ryDirection) - _hit;
+		_diff.dDdx = rxDirection - d;
+		_diff.dDdy = ryDirection - d;
+
+		return true;
+	}
 };
 
 class ShadowRay : public Ray
@@ -0,0 +1,111 @@
+#ifndef __INCLUDE_GUARD_BF7421E2_36B4_4870_B7BC_AC0BB2EB0DF4
+#define __INCLUDE_GUARD_BF7421E2_36B4_4870_B7BC_AC0BB2EB0DF4
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "ray.h"
+#include "algebra8.h"
+#include <algorithm>
+
+//8 rays in structure of arrays layout, one float8 per coordinate
+struct Ray8
+{
+	Point8 o; //origins
+	Vector8 d; //directions
+
+	void set(int _lane, const Ray &_r)
+	{
+		o.set(_lane, _r.o);
+		d.set(_lane, _r.d);
+	}
+};
+
+//A packet of up to 16 rays, for example the primary rays of a 4x4 pixel
+//	block. Besides the rays themselves, the packet keeps them transposed
+//	in groups of eight rays (Ray8), so that a box or a triangle can be
+//	tested against eight rays at once.
+struct RayPacket
+{
+	enum { SIZE = 16, GROUP_SIZE = 8, GROUPS = SIZE / GROUP_SIZE };
+
+	Ray rays[SIZE];
+	//Bit i is set if rays[i] is used
+	uint activeMask;
+
+	//The transposed rays. Inactive rays repeat the first active one, so
+	//	that they do not produce NaNs
+	Ray8 groups[GROUPS];
+	//The transposed directions for box tests. Components close to 0 are
+	//	replaced with a small positive value, like in BBox::intersect
+	Vector8 boxDirs[GROUPS];
+
+	//Bounds of the origins and reciprocal directions of the active rays.
+	//	Only valid if hasFrustum is set, which requires the direction
+	//	components to have the same sign for all rays on each axis
+	bool hasFrustum;
+	Point originMin, originMax;
+	Vector invDirMin, invDirMax;
+
+	RayPacket() : activeMask(0), hasFrustum(false) {}
+
+	bool isActive(uint _ray) const { return (activeMask >> _ray & 1) != 0; }
+
+	//Sets a ray and marks it as active
+	void setRay(uint _ray, const Ray &_r)
+	{
+		rays[_ray] = _r;
+		activeMask |= 1u << _ray;
+	}
+
+	//Fills the transposed data and the frustum. Call after setting the rays
+	void prepare()
+	{
+		//The same as in BBox::intersect
+		const float EPS = 0.0000001f;
+
+		hasFrustum = activeMask != 0;
+		originMin = originMax = rays[firstActive()].o;
+		float dirMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+		float dirMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+		for(uint i = 0; i < SIZE; i++)
+		{
+			// inactive rays repeat the first active one, so that they do not
+			//	produce NaNs in the box tests
+			const Ray &r = isActive(i) ? rays[i] : rays[firstActive()];
+			float div[3];
+			for(int a = 0; a < 3; a++)
+			{
+				div[a] = r.d[a] > -EPS && r.d[a] < EPS ? EPS : r.d[a];
+				if(isActive(i))
+				{
+					originMin[a] = std::min(originMin[a], r.o[a]);
+					originMax[a] = std::max(originMax[a], r.o[a]);
+					dirMin[a] = std::min(dirMin[a], div[a]);
+					dirMax[a] = std::max(dirMax[a], div[a]);
+				}
+			}
+
+			groups[i / GROUP_SIZE].set(i % GROUP_SIZE, r);
+			boxDirs[i / GROUP_SIZE].set(i % GROUP_SIZE, Vector(div[0], div[1], div[2]));
+		}
+
+		for(int a = 0; a < 3 && hasFrustum; a++)
+		{
+			hasFrustum = dirMin[a] > 0 || dirMax[a] < 0;
+			invDirMin[a] = 1.f / dirMax[a];
+			invDirMax[a] = 1.f / dirMin[a];
+		}
+	}
+
+	uint firstActive() const
+	{
+		for(uint i = 0; i < SIZE; i++)
+			if(isActive(i))
+				return i;
+		return 0;
+	}
+};
+
+#endif //__INCLUDE_GUARD_BF7421E2_36B4_4870_B7BC_AC0BB2EB0DF4
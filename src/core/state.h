@@ -6,13 +6,34 @@
 
 #include "defs.h"
 
+//The slots of the state block. Every key is stored in its own slot,
+//	add a slot here when adding a key
+enum StateSlotId
+{
+	SS_Depth,
+	SS_Count
+};
+
+//The size of a slot, the type of a key has to fit into it
+#define _STATE_SLOT_SIZE 8
+
+//Declares a state key _NAME with a value of type _TYPE in slot _SLOT
+#define _DECLARE_STATE_KEY(_NAME, _TYPE, _SLOT)                                \
+	struct _NAME                                                               \
+	{                                                                          \
+		typedef _TYPE t_data;                                                  \
+		enum { slot = _SLOT };                                                 \
+	};                                                                         \
+
 //A generic state object
 //Keys are types
 //To use:
 //	Define your own struct, which you will use as a key
 //	Inside the struct, define the type of the value by typdefing t_data
+//	and the slot it is stored in by an enum value slot (from StateSlotId),
+//	or use _DECLARE_STATE_KEY
 //For example:
-//	struct InRefractiveObjectKey { typedef bool t_data; };
+//	_DECLARE_STATE_KEY(InRefractiveObjectKey, bool, SS_InRefractiveObject)
 //	...
 //	o.state.value<InRefractiveObjectKey>() = false;
 //	...
@@ -31,50 +52,37 @@
 //	to the final radiance of the ray path, and data which
 //	can help you do refractions (speed of light in the current
 //	media for example).
-//Note: Be carefull with multiple threads! Each thread takes some state
-//	space which is later on not freed. If you create and destroy threads
-//	frequently or if you create too many threads, you might run out of
-//	state space!
+//Each thread has one block of all slots, the values start as zeros.
+//	The block belongs to the thread, not to the state object: all state
+//	objects used by a thread see the same values, and a copy of a state
+//	object shares them too. An integrator which calls into another one
+//	has to restore the values it needs afterwards. Threads of nested
+//	parallel regions have blocks of their own. The values should be
+//	plain data, they are neither constructed nor destructed.
 class StateObject
 {
-	enum {_MAX_KEYS = 16384};
-
-	void* m_stateData[_MAX_KEYS];
-
-	static long getNextTypeIndex()
+	union Slot
 	{
-		static long gFirstFreeIndex = 0;
-		long ret;
-#pragma omp critical
-		{
-			ret = gFirstFreeIndex++;
-		}
+		byte data[_STATE_SLOT_SIZE];
+		double alignment;
+	};
 
-		return ret;
+	static Slot* getBlock()
+	{
+		static _THREAD_LOCAL Slot block[SS_Count];
+		return block;
 	}
+
 public:
 
-	StateObject()
-	{
-		memset(m_stateData, 0, sizeof(m_stateData));
-	}
-		
 	template <class KEY>
 	typename KEY::t_data& value()
 	{
-		static _THREAD_LOCAL long gTypeIndex = -1;
-		if(gTypeIndex == -1)
-			gTypeIndex = getNextTypeIndex();
-
-		void *ret = m_stateData[gTypeIndex];
-		if(ret == NULL)
-		{
-			ret = new typename KEY::t_data;
-			_ASSERT(gTypeIndex < _MAX_KEYS);
-			m_stateData[gTypeIndex] = ret;
-		}
+		static_assert(sizeof(typename KEY::t_data) <= _STATE_SLOT_SIZE, "state value does not fit into a slot");
+		static_assert((int)KEY::slot < (int)SS_Count, "state slot out of range");
 
-		return *(typename KEY::t_data *)ret;
+		Slot &ret = getBlock()[KEY::slot];
+		return *(typename KEY::t_data *)ret.data;
 	}
 
 };
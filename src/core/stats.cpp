@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "stats.h"
+
+#define _LABEL_WIDTH 24
+
+struct CounterInfo
+{
+	const char *label; //In the summary
+	const char *key; //In the JSON file
+};
+
+static const CounterInfo s_counterInfo[SC_Count] =
+{
+	{"primary rays", "primaryRays"},
+	{"shadow rays", "shadowRays"},
+	{"reflection rays", "reflectionRays"},
+	{"refraction rays", "refractionRays"},
+	{"photon rays", "photonRays"},
+	{"nodes traversed", "nodesTraversed"},
+	{"primitives tested", "primitivesTested"},
+	{"hit allocations", "hitAllocations"},
+	{"photon nodes visited", "photonNodesVisited"}
+};
+
+#if STATISTICS
+static void printLabel(std::ostream &_out, const std::string &_label)
+{
+	_out << _label << std::string(_label.size() < _LABEL_WIDTH ? _LABEL_WIDTH - _label.size() : 1, ' ');
+}
+#endif
+
+//The blocks of all threads that ever counted
+static void * volatile s_counters = NULL;
+
+static std::vector<Statistics::Build> s_builds;
+
+Statistics::Counters* Statistics::registerThread()
+{
+	Counters *ret = new Counters;
+	memset(ret, 0, sizeof(Counters));
+
+	void *head;
+	do
+	{
+		head = s_counters;
+		ret->next = (Counters*)head;
+	} while(_InterlockedCompareExchangePointer(&s_counters, (void*)ret, head) != head);
+
+	return ret;
+}
+
+unsigned long long Statistics::total(StatCounter _counter)
+{
+	unsigned long long ret = 0;
+	for(Counters *c = (Counters*)s_counters; c != NULL; c = c->next)
+		ret += c->values[_counter];
+	return ret;
+}
+
+void Statistics::addBuild(const Build &_build)
+{
+	#pragma omp critical(statistics_builds)
+	s_builds.push_back(_build);
+}
+
+void Statistics::report(std::ostream &_out, const std::string &_jsonFile)
+{
+#if STATISTICS
+	unsigned long long totals[SC_Count];
+	for(int i = 0; i < SC_Count; i++)
+		totals[i] = total((StatCounter)i);
+
+	unsigned long long rays = totals[SC_PrimaryRays] + totals[SC_ShadowRays]
+		+ totals[SC_ReflectionRays] + totals[SC_RefractionRays] + totals[SC_PhotonRays];
+
+	_out << "Statistics:" << std::endl;
+	for(int i = 0; i < SC_Count; i++)
+	{
+		printLabel(_out, s_counterInfo[i].label);
+		_out << totals[i] << std::endl;
+	}
+	if(rays > 0)
+	{
+		printLabel(_out, "nodes per ray");
+		_out << (double)totals[SC_NodesTraversed] / rays << std::endl;
+		printLabel(_out, "primitives per ray");
+		_out << (double)totals[SC_PrimitivesTested] / rays << std::endl;
+	}
+	for(size_t i = 0; i < s_builds.size(); i++)
+		_out << s_builds[i].structure << " build: " << s_builds[i].primitives << " primitives, "
+			<< s_builds[i].nodes << " nodes, " << s_builds[i].leaves << " leaves, "
+			<< s_builds[i].bytes / 1024 << " KB, "
+			<< s_builds[i].seconds << " s" << std::endl;
+
+	std::ofstream json(_jsonFile.c_str());
+	if(!json)
+	{
+		_out << "Could not write " << _jsonFile << std::endl;
+		return;
+	}
+
+	json << "{" << std::endl << "\t\"counters\": {" << std::endl;
+	for(int i = 0; i < SC_Count; i++)
+		json << "\t\t\"" << s_counterInfo[i].key << "\": " << totals[i]
+			<< (i + 1 < SC_Count ? "," : "") << std::endl;
+	json << "\t}," << std::endl << "\t\"builds\": [" << std::endl;
+	for(size_t i = 0; i < s_builds.size(); i++)
+		json << "\t\t{\"structure\": \"" << s_builds[i].structure
+			<< "\", \"primitives\": " << s_builds[i].primitives
+			<< ", \"nodes\": " << s_builds[i].nodes
+			<< ", \"leaves\": " << s_builds[i].leaves
+			<< ", \"bytes\": " << s_builds[i].bytes
+			<< ", \"seconds\": " << s_builds[i].seconds << "}"
+			<< (i + 1 < s_builds.size() ? "," : "") << std::endl;
+	json << "\t]" << std::endl << "}" << std::endl;
+#endif
+}
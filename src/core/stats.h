@@ -0,0 +1,90 @@
+#ifndef __INCLUDE_GUARD_CE593CB3_D747_4FE6_9917_EC3A7AC056DD
+#define __INCLUDE_GUARD_CE593CB3_D747_4FE6_9917_EC3A7AC056DD
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "defs.h"
+#include <ostream>
+#include <string>
+
+//The events counted by Statistics
+enum StatCounter
+{
+	SC_PrimaryRays,
+	SC_ShadowRays,
+	SC_ReflectionRays,
+	SC_RefractionRays,
+	SC_PhotonRays,
+	SC_NodesTraversed, //BVH and kd-tree nodes, once per ray or ray packet
+	SC_PrimitivesTested, //Ray/primitive intersection tests
+	SC_HitAllocations, //Hit points and hit shaders (ArenaRefCntBase)
+	SC_PhotonNodesVisited, //Photon map nodes visited by nearest photon searches
+	SC_Count
+};
+
+//Counters of a run, to find out why a scene renders slowly. Each thread
+//	counts into a block of its own without synchronization, report sums
+//	the blocks of all threads. The counting is compiled in only with
+//	STATISTICS (make _STATS=1), the _STAT_INC and _STAT_ADD macros are
+//	empty otherwise.
+//The builds of the acceleration structures are recorded as well.
+class Statistics
+{
+public:
+	struct Build
+	{
+		std::string structure;
+		size_t primitives, nodes, leaves, bytes;
+		double seconds;
+	};
+
+	//Adds _count to a counter of the calling thread
+	static void add(StatCounter _counter, unsigned long long _count)
+	{
+		threadCounters().values[_counter] += _count;
+	}
+
+	//A counter of the calling thread
+	static unsigned long long value(StatCounter _counter)
+	{
+		return threadCounters().values[_counter];
+	}
+
+	//The sum of a counter over all threads
+	static unsigned long long total(StatCounter _counter);
+
+	static void addBuild(const Build &_build);
+
+	//Prints a summary to _out and writes the counters and the builds as
+	//	JSON to _jsonFile. Does nothing without STATISTICS
+	static void report(std::ostream &_out, const std::string &_jsonFile);
+
+private:
+	struct Counters
+	{
+		unsigned long long values[SC_Count];
+		Counters *next;
+		//The counters of two threads never share a cache line
+		byte padding[64];
+	};
+
+	static Counters& threadCounters()
+	{
+		static _THREAD_LOCAL Counters *counters = NULL;
+		if(counters == NULL)
+			counters = registerThread();
+		return *counters;
+	}
+
+	static Counters* registerThread();
+};
+
+#if STATISTICS
+#define _STAT_ADD(_COUNTER, _COUNT) Statistics::add(_COUNTER, _COUNT)
+#else
+#define _STAT_ADD(_COUNTER, _COUNT)
+#endif
+#define _STAT_INC(_COUNTER) _STAT_ADD(_COUNTER, 1)
+
+#endif //__INCLUDE_GUARD_CE593CB3_D747_4FE6_9917_EC3A7AC056DD
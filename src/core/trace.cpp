@@ -0,0 +1,92 @@
+#include "stdafx.h"
+#include "trace.h"
+
+struct TraceEvent
+{
+	std::string name;
+	const char *category;
+	double begin, end;
+	int thread;
+};
+
+bool Trace::s_recording = false;
+
+static std::vector<TraceEvent> s_events;
+//The time stamps in the trace are relative to the start of the recording
+static double s_start = 0;
+
+void Trace::setRecording(bool _recording)
+{
+	if(_recording && !s_recording)
+		s_start = now();
+	s_recording = _recording;
+}
+
+void Trace::addSpan(const std::string &_name, const char *_category, double _begin, double _end)
+{
+	if(!s_recording)
+		return;
+
+	TraceEvent event;
+	event.name = _name;
+	event.category = _category;
+	event.begin = _begin;
+	event.end = _end;
+	event.thread = omp_get_thread_num();
+
+	#pragma omp critical(trace_events)
+	s_events.push_back(event);
+}
+
+static void writeString(std::ostream &_out, const std::string &_str)
+{
+	_out << '"';
+	for(size_t i = 0; i < _str.size(); i++)
+	{
+		if(_str[i] == '"' || _str[i] == '\\')
+			_out << '\\';
+		_out << _str[i];
+	}
+	_out << '"';
+}
+
+bool Trace::write(const std::string &_fileName)
+{
+	std::ofstream out(_fileName.c_str());
+	if(!out)
+	{
+		std::cout << "Could not write " << _fileName << std::endl;
+		return false;
+	}
+
+	std::vector<TraceEvent> events;
+	#pragma omp critical(trace_events)
+	events = s_events;
+
+	//Complete events ("X") with microseconds, and a name for each thread
+	out << "{\"traceEvents\": [" << std::endl;
+	std::vector<bool> named;
+	for(size_t i = 0; i < events.size(); i++)
+	{
+		const TraceEvent &e = events[i];
+		if(named.size() <= (size_t)e.thread)
+			named.resize(e.thread + 1, false);
+		if(!named[e.thread])
+		{
+			named[e.thread] = true;
+			out << "\t{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << e.thread
+				<< ", \"args\": {\"name\": \"thread " << e.thread << "\"}}," << std::endl;
+		}
+
+		out << "\t{\"name\": ";
+		writeString(out, e.name);
+		out << ", \"cat\": \"" << e.category << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.thread
+			<< ", \"ts\": " << (long long)((e.begin - s_start) * 1e6)
+			<< ", \"dur\": " << (long long)((e.end - e.begin) * 1e6) << "}"
+			<< (i + 1 < events.size() ? "," : "") << std::endl;
+	}
+	out << "], \"displayTimeUnit\": \"ms\"}" << std::endl;
+
+	std::cout << "Trace with " << events.size() << " spans written to " << _fileName << std::endl;
+	return true;
+}
@@ -0,0 +1,76 @@
+#ifndef __INCLUDE_GUARD_CBB501F4_D579_4497_BC5E_92B8DF8C321F
+#define __INCLUDE_GUARD_CBB501F4_D579_4497_BC5E_92B8DF8C321F
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "defs.h"
+#include <omp.h>
+#include <string>
+
+//Wall clock spans of the phases of a run (scene load, acceleration
+//	structure builds, photon mapping, rendering, PNG writes) and of the
+//	rendered tiles. The spans are always timed, but only kept while
+//	recording is on. Write saves them in the Chrome trace event format,
+//	to look at load balance and idle time in chrome://tracing or
+//	Perfetto. The threads of the trace are the OpenMP thread numbers.
+class Trace
+{
+public:
+	//Keeps the spans that end from now on, or stops keeping them
+	static void setRecording(bool _recording);
+	static bool isRecording() { return s_recording; }
+
+	//Wall clock time in seconds, not the cpu time of clock()
+	static double now() { return omp_get_wtime(); }
+
+	//Adds a span of the calling thread, if recording
+	static void addSpan(const std::string &_name, const char *_category, double _begin, double _end);
+
+	//Writes the spans kept so far as Chrome trace JSON
+	static bool write(const std::string &_fileName);
+
+private:
+	static bool s_recording;
+};
+
+//A span from its construction to its destruction or to end()
+//Use:
+//	{
+//		TraceSpan span("build BVH", "build");
+//		...
+//		std::cout << span.end() << " s" << std::endl;
+//	}
+class TraceSpan
+{
+	std::string m_name;
+	const char *m_category;
+	double m_begin, m_end;
+	bool m_ended;
+
+	TraceSpan(const TraceSpan&);
+	TraceSpan& operator=(const TraceSpan&);
+
+public:
+	TraceSpan(const std::string &_name, const char *_category = "phase")
+		: m_name(_name), m_category(_category), m_begin(Trace::now()), m_end(0), m_ended(false) {}
+
+	~TraceSpan() { end(); }
+
+	//Ends the span, if it has not ended yet, and returns its length in seconds
+	double end()
+	{
+		if(!m_ended)
+		{
+			m_end = Trace::now();
+			m_ended = true;
+			Trace::addSpan(m_name, m_category, m_begin, m_end);
+		}
+		return m_end - m_begin;
+	}
+
+	//The seconds since the span began
+	double elapsed() const { return Trace::now() - m_begin; }
+};
+
+#endif //__INCLUDE_GUARD_CBB501F4_D579_4497_BC5E_92B8DF8C321F
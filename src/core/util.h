@@ -5,6 +5,29 @@
 #endif
 
 #include "../core/algebra.h"
+#include "../core/ray_packet.h"
+
+//The number of set bits in _mask
+inline uint countBits(uint _mask)
+{
+	uint ret = 0;
+	for(; _mask != 0; _mask &= _mask - 1)
+		ret++;
+	return ret;
+}
+
+//The index of the lowest set bit in _mask, which must not be 0
+inline uint lowestBit(uint _mask)
+{
+	_ASSERT(_mask != 0);
+	uint ret = 0;
+	while((_mask & 1) == 0)
+	{
+		_mask >>= 1;
+		ret++;
+	}
+	return ret;
+}
 
 //This routine intersects a ray with a triangle
 //Returns:
@@ -39,4 +62,33 @@ inline float4 intersectTriangle(
 	return ret;
 }
 
+//Intersects a triangle with 8 rays, doing the same computations as
+//	intersectTriangle for each ray
+//Returns the distances to the intersections, FLT_MAX for the rays that
+//	miss, and writes the barycentric coordinates of _p1 and _p2 to _u and _v
+inline float8 intersectTriangle8(
+	const Point &_p1, const Point &_p2, const Point &_p3,
+	const Ray8 &_rays, float8 &_u, float8 &_v)
+{
+	Vector8 e1 = Vector8::rep(_p1 - _p3);
+	Vector8 e2 = Vector8::rep(_p2 - _p3);
+
+	Vector8 pvec = _rays.d % e2;
+	float8 det = e1 * pvec;
+
+	Vector8 tvec = _rays.o - Point8::rep(_p3);
+	Vector8 qvec = tvec % e1;
+
+	_u = tvec * pvec / det;
+	_v = _rays.d * qvec / det;
+
+	//intersectTriangle compares with doubles, these float constants give
+	//	the same results for all float values
+	mask8 hit = float8::abs(det) > float8::rep(0.00001f);
+	hit &= ~((_u < float8::rep(-0.00001f)) | (_v < float8::rep(-0.00001f))
+		| (_u + _v >= float8::rep(1.00002f)));
+
+	return float8::select(hit, e2 * qvec / det, float8::rep(FLT_MAX));
+}
+
 #endif //__UTIL_H_INCLUDED_6DEB3409_AA7C_48E0_AEDC_5A40687E23E6
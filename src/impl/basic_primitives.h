@@ -11,9 +11,15 @@
 
 #define SMALL_NUM  0.00000001
 
-struct BasicPrimitiveHitPoint : public RefCntBase
+struct BasicPrimitiveHitPoint : public ArenaRefCntBase
 {
 	Point hit;
+
+	//A copy of the ray, if it carried differentials. The differentials
+	//	are computed in getMaterialHit, for the closest hit only. The
+	//	packet traversal may intersect a copy of the packet, so the hit
+	//	cannot point to the ray
+	Ray ray;
 };
 
 //An infinite plane
@@ -41,23 +47,31 @@ struct InfinitePlane : public Primitive
 
 			SmartPtr<BasicPrimitiveHitPoint> hit(new BasicPrimitiveHitPoint);
 			hit->hit = _ray.o + _ray.d * dist;
-			ret.hitInfo = hit;
+			if(_ray.hasDifferentials)
+				hit->ray = _ray;
+			ret.hitInfo = std::move(hit);
 			ret.distance = dist;
 		}
 
 		return ret;
 	}
 
-	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const
 	{
-		SmartPtr<PluggableShader> ret = shader->clone();
+		const BasicPrimitiveHitPoint *hit = static_cast<const BasicPrimitiveHitPoint*>(_intData.hitInfo.data());
 
-		SmartPtr<BasicPrimitiveHitPoint> hit = _intData.hitInfo;
+		_attr.position = hit->hit;
+		_attr.hasNormal = true;
+		_attr.normal = *(Vector*)&equation;
+		_attr.hasDifferentials = hit->ray.getHitDifferentials(hit->hit, *(Vector*)&equation, _attr.differentials);
 
-		ret->setPosition(hit->hit);
-		ret->setNormal(*(Vector*)&equation);
+		return shader.data();
+	}
 
-		return ret;
+	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	{
+		HitAttributes attr;
+		return createHitShader(getMaterialHit(_intData, attr), attr);
 	}
 
 	virtual BBox getBBox() const
@@ -135,7 +149,7 @@ struct InfiniteLine : public Primitive
             //  return ret;
             SmartPtr<BasicPrimitiveHitPoint> hit(new BasicPrimitiveHitPoint);
 			hit->hit = _ray.o + sc * u;
-			ret.hitInfo = hit;
+			ret.hitInfo = std::move(hit);
 			ret.distance = (sc * u).len();
         }
 
@@ -157,15 +171,19 @@ struct InfiniteLine : public Primitive
 		*/
 	}
 
-	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const
 	{
-		SmartPtr<PluggableShader> ret = shader->clone();
+		const BasicPrimitiveHitPoint *hit = static_cast<const BasicPrimitiveHitPoint*>(_intData.hitInfo.data());
 
-		SmartPtr<BasicPrimitiveHitPoint> hit = _intData.hitInfo;
+		_attr.position = hit->hit;
 
-		ret->setPosition(hit->hit);
+		return shader.data();
+	}
 
-		return ret;
+	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	{
+		HitAttributes attr;
+		return createHitShader(getMaterialHit(_intData, attr), attr);
 	}
 
 	virtual BBox getBBox() const
@@ -207,28 +225,39 @@ struct Sphere : public Primitive
 
 			SmartPtr<BasicPrimitiveHitPoint> hit = new BasicPrimitiveHitPoint;
 			hit->hit = _ray.o + _ray.d * dist;
-			ret.hitInfo = hit;
+			if(_ray.hasDifferentials)
+				hit->ray = _ray;
+			ret.hitInfo = std::move(hit);
 			ret.distance = dist;
 		}
 
 		return ret;
 	}
 
-	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const
 	{
+		const BasicPrimitiveHitPoint *hit = static_cast<const BasicPrimitiveHitPoint*>(_intData.hitInfo.data());
 
-		SmartPtr<PluggableShader> ret = shader->clone();
-		SmartPtr<BasicPrimitiveHitPoint> hit = _intData.hitInfo;
+		_attr.position = hit->hit;
+		_attr.hasNormal = true;
+		_attr.normal = hit->hit - center;
+		_attr.hasDifferentials = hit->ray.getHitDifferentials(hit->hit, _attr.normal, _attr.differentials);
 
-		ret->setPosition(hit->hit);
-		ret->setNormal(hit->hit - center);
+		return shader.data();
+	}
 
-		return ret;
+	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	{
+		HitAttributes attr;
+		return createHitShader(getMaterialHit(_intData, attr), attr);
 	}
 
 	virtual BBox getBBox() const
 	{
-		return BBox::empty();
+		BBox box = BBox::empty();
+		box.extend(center - Vector(radius, radius, radius));
+		box.extend(center + Vector(radius, radius, radius));
+		return box;
 	}
 };
 
@@ -252,35 +281,68 @@ struct Triangle : public Primitive
 		ret.distance = intRes.w;
 
 		if(intRes.w != FLT_MAX)
-		{
+			ret.hitInfo = createHitPoint(_ray, intRes.w);
 
-			SmartPtr<BasicPrimitiveHitPoint> hit = new BasicPrimitiveHitPoint;
-			hit->hit = _ray.o + _ray.d * intRes.w;
+		return ret;
+	}
 
-			ret.hitInfo = hit;
+	virtual uint intersectGroup(const RayPacket &_packet, uint _group, uint _mask,
+		const float8 &_best, IntRet *_ret) const
+	{
+		float8 u, v;
+		float8 dist = intersectTriangle8(p1, p2, p3, _packet.groups[_group], u, v);
+
+		uint ret = _mask & ((dist > float8::rep(INTEPS())) & (dist < _best)).getMask();
+		for(uint i = 0; i < RayPacket::GROUP_SIZE; i++)
+		{
+			if((ret >> i & 1) == 0)
+				continue;
+
+			_ret[i].distance = dist[i];
+			_ret[i].hitInfo = createHitPoint(_packet.rays[RayPacket::GROUP_SIZE * _group + i], dist[i]);
 		}
 
 		return ret;
 	}
 
-	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const
 	{
-		SmartPtr<PluggableShader> ret = shader->clone();
-		SmartPtr<BasicPrimitiveHitPoint> hit = _intData.hitInfo;
+		const BasicPrimitiveHitPoint *hit = static_cast<const BasicPrimitiveHitPoint*>(_intData.hitInfo.data());
 
-		ret->setPosition(hit->hit);
+		_attr.position = hit->hit;
 
 		Vector e1 = ~(p2 - p1);
 		Vector e2 = ~(p3 - p1);
-		Vector norm = ~(e1 % e2);
-		ret->setNormal(norm);
+		_attr.hasNormal = true;
+		_attr.normal = ~(e1 % e2);
+		_attr.hasDifferentials = hit->ray.getHitDifferentials(hit->hit, (p2 - p1) % (p3 - p1), _attr.differentials);
 
-		return ret; // wasnt here before
+		return shader.data();
+	}
+
+	virtual SmartPtr<Shader> getShader(IntRet _intData) const
+	{
+		HitAttributes attr;
+		return createHitShader(getMaterialHit(_intData, attr), attr);
 	}
 
 	virtual BBox getBBox() const
 	{
-		return BBox::empty();
+		BBox box = BBox::empty();
+		box.extend(p1);
+		box.extend(p2);
+		box.extend(p3);
+		return box;
+	}
+
+private:
+	SmartPtr<BasicPrimitiveHitPoint> createHitPoint(const Ray &_ray, float _distance) const
+	{
+		SmartPtr<BasicPrimitiveHitPoint> hit = new BasicPrimitiveHitPoint;
+		hit->hit = _ray.o + _ray.d * _distance;
+		if(_ray.hasDifferentials)
+			hit->ray = _ray;
+		return hit;
 	}
 };
 
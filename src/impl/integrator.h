@@ -5,6 +5,9 @@
 #endif
 
 #include "../rt/basic_definitions.h"
+#include "../rt/geometry_group.h"
+#include "phong_shaders.h"
+#include "../core/util.h"
 
 struct PointLightSource
 {
@@ -14,10 +17,7 @@ struct PointLightSource
 };
 
 
-struct DepthStateKey
-{
-	typedef int t_data;
-};
+_DECLARE_STATE_KEY(DepthStateKey, int, SS_Depth)
 
 class IntegratorImpl : public Integrator
 {
@@ -29,7 +29,7 @@ public:
 	float4 ambientLight;
     float curRefractionIndex;
 
-	IntegratorImpl()
+	IntegratorImpl() : scene(NULL)
 	{
 		state.value<DepthStateKey>() = 0;
 	}
@@ -39,15 +39,24 @@ public:
         return curRefractionIndex;
     }
 
+	virtual size_t getPrimitiveCount() const
+	{
+		return scene != NULL ? scene->primitives.size() : 0;
+	}
 
+
+	//The hit points and shaders of the sample are allocated in the
+	//	PathArena of the thread, which is reset when the outermost
+	//	call returns
 	virtual float4 getRadiance(const Ray &_ray)
 	{
-		state.value<DepthStateKey>()++;
+		PathArena::Scope arenaScope;
+		int &depth = state.value<DepthStateKey>();
+		depth++;
 
 		float4 col = float4::rep(0); // storing the color
-		float4 shadow = float4::rep(1.0f); // determines the light dimming
 
-		if(state.value<DepthStateKey>() < _MAX_BOUNCES)
+		if(depth < _MAX_BOUNCES)
 		{
 		    //std::cout << "integrator cur: " << _ray.curRefractionIndex << std::endl;
 		    curRefractionIndex = _ray.curRefractionIndex;
@@ -55,44 +64,121 @@ public:
 			Primitive::IntRet ret = scene->intersect(_ray, FLT_MAX);
 			if(ret.distance < FLT_MAX && ret.distance >= Primitive::INTEPS())
 			{
-				SmartPtr<Shader> shader = scene->getShader(ret);
-				if(shader.data() != NULL)
+				HitAttributes attr;
+				const PluggableShader *material = scene->getMaterialHit(ret, attr);
+				if(material != NULL)
+				{
+					ShadeOp op = {this, &_ray, ret.distance, NULL};
+					col += visitShaderKernel(*material, attr, op);
+				}
+				else
 				{
-					col += shader->getAmbientCoefficient() * ambientLight;
+					SmartPtr<Shader> shader = scene->getShader(ret);
+					if(shader.data() != NULL)
+						col += shade(VirtualShaderCalls(*shader), _ray, ret.distance);
+				}
+			}
+		}
 
-					Point intPt = _ray.o + ret.distance * _ray.d;
+		depth--;
 
-					for(std::vector<PointLightSource>::const_iterator it = lightSources.begin(); it != lightSources.end(); it++)
+		return col;
+	}
+
+	//Traces the packet and one shadow packet per light source. The shadow
+	//	rays, which hit something, are traced again with getShadow to get
+	//	the transparency. The secondary rays are traced one by one
+	virtual void getRadiancePacket(const RayPacket &_packet, float4 *_result)
+	{
+		PathArena::Scope arenaScope;
+		int &depth = state.value<DepthStateKey>();
+		depth++;
+
+		for(uint i = 0; i < RayPacket::SIZE; i++)
+			_result[i] = float4::rep(0);
+
+		if(depth < _MAX_BOUNCES)
+		{
+			Primitive::IntRet ret[RayPacket::SIZE];
+			scene->intersectPacket(_packet, ret, false);
+
+			uint hitMask = 0;
+			for(uint i = 0; i < RayPacket::SIZE; i++)
+				if(_packet.isActive(i) && ret[i].distance < FLT_MAX && ret[i].distance >= Primitive::INTEPS())
+					hitMask |= 1u << i;
+
+			size_t lightCount = lightSources.size();
+			m_packetShadows.resize(lightCount * RayPacket::SIZE);
+
+			for(size_t l = 0; l < lightCount; l++)
+			{
+				RayPacket shadowPacket;
+				Primitive::IntRet shadowRet[RayPacket::SIZE];
+				ShadowRay shadowRays[RayPacket::SIZE];
+
+				for(uint i = 0; i < RayPacket::SIZE; i++)
+					if(hitMask >> i & 1)
 					{
-						shadow = visibleLS(intPt, it->position);
-						if(shadow[0] > 0 && shadow[1] > 0 && shadow[2] > 0 && shadow[3] > 0)
-						//if (true)
-						{
-							Vector lightD = it->position - intPt;
-							float4 refl = shader->getReflectance(-_ray.d, lightD);
-							float dist = lightD.len();
-							float fallOff = it->falloff.x / (dist * dist) + it->falloff.y / dist + it->falloff.z;
-							col += shadow * refl * float4::rep(fallOff) * it->intensity;
-						}
+						Point intPt = _packet.rays[i].o + ret[i].distance * _packet.rays[i].d;
+						shadowRays[i] = shadowRay(intPt, lightSources[l].position);
+						shadowRet[i].distance = (shadowRays[i].lightSource - shadowRays[i].o).len();
+						shadowPacket.setRay(i, shadowRays[i]);
 					}
-                    col += shader->getIndirectRadiance(-_ray.d, this);
+
+				if(shadowPacket.activeMask == 0)
+					continue;
+
+				shadowPacket.prepare();
+				_STAT_ADD(SC_ShadowRays, countBits(shadowPacket.activeMask));
+				scene->intersectPacket(shadowPacket, shadowRet, true);
+
+				for(uint i = 0; i < RayPacket::SIZE; i++)
+					if(hitMask >> i & 1)
+						m_packetShadows[i * lightCount + l] = shadowRet[i].hitInfo.data() != NULL ?
+							getShadow(shadowRays[i]) : float4::rep(1.0f);
+			}
+
+			for(uint i = 0; i < RayPacket::SIZE; i++)
+			{
+				if((hitMask >> i & 1) == 0)
+					continue;
+
+				curRefractionIndex = _packet.rays[i].curRefractionIndex;
+
+				HitAttributes attr;
+				const PluggableShader *material = scene->getMaterialHit(ret[i], attr);
+				const float4 *shadows = lightCount > 0 ? &m_packetShadows[i * lightCount] : NULL;
+				if(material != NULL)
+				{
+					ShadeOp op = {this, &_packet.rays[i], ret[i].distance, shadows};
+					_result[i] = visitShaderKernel(*material, attr, op);
+				}
+				else
+				{
+					SmartPtr<Shader> shader = scene->getShader(ret[i]);
+					if(shader.data() != NULL)
+						_result[i] = shade(VirtualShaderCalls(*shader), _packet.rays[i], ret[i].distance, shadows);
 				}
 			}
 		}
 
-		state.value<DepthStateKey>()--;
-
-		return col;
+		depth--;
 	}
 
 	virtual float4 getShadow(ShadowRay &_sr)
 	{
+		PathArena::Scope arenaScope;
+		_STAT_INC(SC_ShadowRays);
         Primitive::IntRet ret = scene->intersect(_sr, FLT_MAX);
         // check if something gets hit in between lightsource and origin of ray
 		if(ret.distance < FLT_MAX && ret.distance < (_sr.lightSource-_sr.o).len() && ret.distance >= Primitive::INTEPS())
         {
-			SmartPtr<Shader> shader = scene->getShader(ret);
-			if(shader.data() != NULL)
+			HitAttributes attr;
+			const PluggableShader *material = scene->getMaterialHit(ret, attr);
+			SmartPtr<Shader> shader;
+			if(material == NULL)
+				shader = scene->getShader(ret);
+			if(material != NULL || shader.data() != NULL)
 			{
 			    _sr.hitCounts++;
 			    // send new shadow ray from hitpoint in same direction with slight offset to prevent floating point errors
@@ -100,6 +186,11 @@ public:
 			    _sr.o = intPt;
 			    //_sr.d = ~_sr.d;
                 //std::cout << "hi " << _sr.hitCounts << " hi2 " << _sr.o[0] << std::endl;
+				if(material != NULL)
+				{
+					TransparencyOp op = {this, &_sr};
+					return visitShaderKernel(*material, attr, op);
+				}
 			    return shader->getTransparency(_sr, this);
 			}
 		}
@@ -108,13 +199,69 @@ public:
         return float4::rep(1.0f);
 	}
 private:
+	//The shadows of the hits of a packet, per hit and light source
+	std::vector<float4> m_packetShadows;
 
-	float4 visibleLS(const Point& _pt, const Point& _pls)
+	//Shades a hit with a shader given by its calls (see StaticShaderCalls).
+	//	_shadows are the results of visibleLS for the light sources, if
+	//	they are known already
+	template<class ta_calls>
+	float4 shade(const ta_calls &_shader, const Ray &_ray, float _distance, const float4 *_shadows = NULL)
+	{
+		float4 col = _shader.getAmbientCoefficient() * ambientLight;
+
+		Point intPt = _ray.o + _distance * _ray.d;
+
+		for(std::vector<PointLightSource>::const_iterator it = lightSources.begin(); it != lightSources.end(); it++)
+		{
+			float4 shadow = _shadows != NULL ? _shadows[it - lightSources.begin()] : visibleLS(intPt, it->position);
+			if(shadow[0] > 0 && shadow[1] > 0 && shadow[2] > 0 && shadow[3] > 0)
+			{
+				Vector lightD = it->position - intPt;
+				float4 refl = _shader.getReflectance(-_ray.d, lightD);
+				float dist = lightD.len();
+				float fallOff = it->falloff.x / (dist * dist) + it->falloff.y / dist + it->falloff.z;
+				col += shadow * refl * float4::rep(fallOff) * it->intensity;
+			}
+		}
+
+		return col + _shader.getIndirectRadiance(-_ray.d, this);
+	}
+
+	//The operations run on the hit shaders through visitShaderKernel
+	struct ShadeOp
+	{
+		IntegratorImpl *integrator;
+		const Ray *ray;
+		float distance;
+		const float4 *shadows;
+
+		template<class ta_calls>
+		float4 operator()(const ta_calls &_shader) const { return integrator->shade(_shader, *ray, distance, shadows); }
+	};
+
+	struct TransparencyOp
+	{
+		IntegratorImpl *integrator;
+		ShadowRay *ray;
+
+		template<class ta_calls>
+		float4 operator()(const ta_calls &_shader) const { return _shader.getTransparency(*ray, integrator); }
+	};
+
+	//The shadow ray from a point to a light source
+	static ShadowRay shadowRay(const Point& _pt, const Point& _pls)
 	{
         ShadowRay r;
         r.lightSource = _pls;
         r.d = ~(_pls - _pt);
         r.o = _pt + Primitive::INTEPS() * r.d;
+        return r;
+	}
+
+	float4 visibleLS(const Point& _pt, const Point& _pls)
+	{
+        ShadowRay r = shadowRay(_pt, _pls);
         //r.d = ~r.d;
 
         //return float4::rep(1.0f);
@@ -27,10 +27,13 @@ private:
 	//This is the structure that is filled from the intersection
 	//	routine and is than passed to the getShader routine, in case
 	//	the face is the closest to the origin of the ray.
-	struct ExtHitPoint : RefCntBase
+	struct ExtHitPoint : ArenaRefCntBase
 	{
 		//The barycentric coordinate (in .x, .y, .z) + the distance (in .w)
 		float4 intResult;
+		//A copy of the ray, if it carried differentials. The differentials
+		//	are computed in getMaterialHit, for the closest hit only
+		Ray ray;
 	};
 
 public:
@@ -79,9 +82,21 @@ public:
 
 		virtual IntRet intersect(const Ray& _ray, float _previousBestDistance ) const;
 
+		virtual uint intersectGroup(const RayPacket &_packet, uint _group, uint _mask,
+			const float8 &_best, IntRet *_ret) const;
+
 		virtual BBox getBBox() const;
 
 	virtual SmartPtr<Shader> getShader(IntRet _intData) const;
+
+		virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const;
+
+	private:
+		//Creates the hit point for the result of intersectTriangle
+		SmartPtr<ExtHitPoint> createHitPoint(const Ray &_ray, const float4 &_intResult) const;
+
+		//Transforms the position differentials of a hit to texture space
+		void getTextureFootprint(const HitDifferentials &_diff, float2 &_dx, float2 &_dy) const;
 	};
 
 	typedef std::vector<Point> t_pointVector;
@@ -4,36 +4,86 @@
 
 SmartPtr<Shader> LWObject::Face::getShader(IntRet _intData) const
 {
-	SmartPtr<ExtHitPoint> hit = _intData.hitInfo;
-
-	SmartPtr<PluggableShader> shader = m_lwObject->materials[material].shader->clone();
+	HitAttributes attr;
+	return createHitShader(getMaterialHit(_intData, attr), attr);
+}
 
-	shader->setPosition(Point::lerp(m_lwObject->vertices[vert1], m_lwObject->vertices[vert2],
-		m_lwObject->vertices[vert3], hit->intResult.x, hit->intResult.y));
+const PluggableShader* LWObject::Face::getMaterialHit(IntRet _intData, HitAttributes &_attr) const
+{
+	const ExtHitPoint *hit = static_cast<const ExtHitPoint*>(_intData.hitInfo.data());
 
+	_attr.position = Point::lerp(m_lwObject->vertices[vert1], m_lwObject->vertices[vert2],
+		m_lwObject->vertices[vert3], hit->intResult.x, hit->intResult.y);
 
-	Vector norm =
+	_attr.hasNormal = true;
+	_attr.normal =
 		m_lwObject->normals[norm1] * hit->intResult.x +
 		m_lwObject->normals[norm2] * hit->intResult.y +
 		m_lwObject->normals[norm3] * hit->intResult.z;
 
-	shader->setNormal(norm);
+	_attr.hasDifferentials = false;
+	if(hit->ray.hasDifferentials)
+	{
+		const Point &p3 = m_lwObject->vertices[vert3];
+		Vector n = (m_lwObject->vertices[vert1] - p3) % (m_lwObject->vertices[vert2] - p3);
+		_attr.hasDifferentials = hit->ray.getHitDifferentials(
+			hit->ray.o + hit->intResult.w * hit->ray.d, n, _attr.differentials);
+	}
 
-	shader->setVertices(m_lwObject->vertices[vert1],m_lwObject->vertices[vert2],m_lwObject->vertices[vert3]);
+	_attr.hasVertices = true;
+	_attr.v1 = m_lwObject->vertices[vert1];
+	_attr.v2 = m_lwObject->vertices[vert2];
+	_attr.v3 = m_lwObject->vertices[vert3];
 
 	if(tex1 != -1 && tex2 != -1 && tex3 != -1)
 	{
-		float2 texPos =
+		_attr.hasTexCoord = true;
+		_attr.texCoord =
 			m_lwObject->texCoords[tex1] * hit->intResult.x +
 			m_lwObject->texCoords[tex2] * hit->intResult.y +
 			m_lwObject->texCoords[tex3] * hit->intResult.z;
 
-		shader->setTextureCoord(texPos);
-
-		shader->setTexels(m_lwObject->texCoords[tex1],m_lwObject->texCoords[tex2],m_lwObject->texCoords[tex3]);
+		_attr.tex1 = m_lwObject->texCoords[tex1];
+		_attr.tex2 = m_lwObject->texCoords[tex2];
+		_attr.tex3 = m_lwObject->texCoords[tex3];
+
+		if(_attr.hasDifferentials)
+			getTextureFootprint(_attr.differentials, _attr.texDx, _attr.texDy);
 	}
 
-	return shader;
+	return m_lwObject->materials[material].shader.data();
+}
+
+//The position differentials lie in the plane of the face. They are expressed
+//	in the triangle's edge basis and mapped to texture space through the texture
+//	coordinates of the vertices.
+void LWObject::Face::getTextureFootprint(const HitDifferentials &_diff, float2 &_dx, float2 &_dy) const
+{
+	const Point &p3 = m_lwObject->vertices[vert3];
+	Vector e1 = m_lwObject->vertices[vert1] - p3;
+	Vector e2 = m_lwObject->vertices[vert2] - p3;
+
+	_dx = float2(0.f, 0.f);
+	_dy = float2(0.f, 0.f);
+
+	float a = e1 * e1, b = e1 * e2, c = e2 * e2;
+	float det = a * c - b * b;
+	if(det <= 1e-12f * a * c) // degenerate face
+		return;
+
+	float2 t1 = m_lwObject->texCoords[tex1] - m_lwObject->texCoords[tex3];
+	float2 t2 = m_lwObject->texCoords[tex2] - m_lwObject->texCoords[tex3];
+
+	const Vector *dP[2] = { &_diff.dPdx, &_diff.dPdy };
+	float2 *result[2] = { &_dx, &_dy };
+
+	for(int i = 0; i < 2; i++)
+	{
+		float de1 = *dP[i] * e1, de2 = *dP[i] * e2;
+		float u = (c * de1 - b * de2) / det;
+		float v = (a * de2 - b * de1) / det;
+		*result[i] = t1 * u + t2 * v;
+	}
 }
 
 
@@ -49,15 +99,45 @@ Primitive::IntRet LWObject::Face::intersect(const Ray& _ray, float _previousBest
 	ret.distance = inter.w;
 
 	if(inter.w < _previousBestDistance)
+		ret.hitInfo = createHitPoint(_ray, inter);
+
+	return ret;
+}
+
+uint LWObject::Face::intersectGroup(const RayPacket &_packet, uint _group, uint _mask,
+	const float8 &_best, IntRet *_ret) const
+{
+	float8 u, v;
+	float8 dist =
+		intersectTriangle8(
+			m_lwObject->vertices[vert1], m_lwObject->vertices[vert2], m_lwObject->vertices[vert3],
+			_packet.groups[_group], u, v
+		);
+
+	uint ret = _mask & ((dist > float8::rep(INTEPS())) & (dist < _best)).getMask();
+	for(uint i = 0; i < RayPacket::GROUP_SIZE; i++)
 	{
-		SmartPtr<ExtHitPoint> hit = new ExtHitPoint;
-		ret.hitInfo = hit;
-		hit->intResult = inter;
+		if((ret >> i & 1) == 0)
+			continue;
+
+		const Ray &ray = _packet.rays[RayPacket::GROUP_SIZE * _group + i];
+		_ret[i].distance = dist[i];
+		_ret[i].hitInfo = createHitPoint(ray, float4(u[i], v[i], 1 - u[i] - v[i], dist[i]));
 	}
 
 	return ret;
 }
 
+SmartPtr<LWObject::ExtHitPoint> LWObject::Face::createHitPoint(const Ray &_ray, const float4 &_intResult) const
+{
+	SmartPtr<ExtHitPoint> hit = new ExtHitPoint;
+	hit->intResult = _intResult;
+	if(_ray.hasDifferentials)
+		hit->ray = _ray;
+
+	return hit;
+}
+
 
 BBox LWObject::Face::getBBox() const
 {
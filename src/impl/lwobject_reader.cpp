@@ -175,9 +175,26 @@ namespace objLoaderUtil
 				SmartPtr<Texture> tex = new Texture;
 				tex->image = img;
 
+				// PNGs have 8 bits per channel, so RGBA8 loses nothing
+				//	and tiles keep bilinear lookups in few cache lines
+				tex->texelFormat = TF_RGBA8;
+				tex->texelLayout = TL_Tiled;
+
                 // set type to height map if applicable
 				if (bumpTex)
+				{
                     tex->textureType = Texture::TT_HateMap;
+					tex->buildStorage();
+				}
+				else
+				{
+					// color textures are minified a lot in the distance
+					tex->generateMipMaps();
+					tex->filterMode = Texture::TFM_Trilinear;
+				}
+
+				// the levels hold all texels, the float image is not needed anymore
+				tex->image = SmartPtr<Image>();
 
 				dest = tex;
 			}
@@ -193,6 +210,7 @@ using namespace objLoaderUtil;
 
 void LWObject::read(const std::string &_fileName, bool _createDefautShaders)
 {
+	TraceSpan span("load " + _fileName, "load");
 	std::ifstream inputStream(_fileName.c_str(), std::ios_base::in);
 	std::string buf;
 
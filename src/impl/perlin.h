@@ -1,45 +1,48 @@
 #ifndef PERLIN_H
 #define PERLIN_H
 
+#include "../core/defs.h"
+#include "../core/algebra.h"
+#include <algorithm>
+
+// Ken Perlin's permutation of 0..255
+#define _PERLIN_PERMUTATION 151,160,137,91,90,15,                                   \
+    131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,    \
+    190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,    \
+    88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,    \
+    77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,    \
+    102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,    \
+    135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,    \
+    5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,    \
+    223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,    \
+    129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,    \
+    251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,    \
+    49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,    \
+    138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
+
 // Perlin noise according to reference implementation
 // at http://mrl.nyu.edu/~perlin/noise/
+// The tables are static and all arithmetic is done in float. noise4
+// evaluates four points at once, noiseOctaves uses it to evaluate
+// several octaves of the same point per call.
 class PerlinNoise
 {
-private:
-
 public:
 
-    static double noise(double x, double y, double z)
-    {
-        int p[512];
-
-        int permutation[] = { 151,160,137,91,90,15,
-                          131,13,201,95,96,53,194,233,7,225,140,36,103,30,69,142,8,99,37,240,21,10,23,
-                          190, 6,148,247,120,234,75,0,26,197,62,94,252,219,203,117,35,11,32,57,177,33,
-                          88,237,149,56,87,174,20,125,136,171,168, 68,175,74,165,71,134,139,48,27,166,
-                          77,146,158,231,83,111,229,122,60,211,133,230,220,105,92,41,55,46,245,40,244,
-                          102,143,54, 65,25,63,161, 1,216,80,73,209,76,132,187,208, 89,18,169,200,196,
-                          135,130,116,188,159,86,164,100,109,198,173,186, 3,64,52,217,226,250,124,123,
-                          5,202,38,147,118,126,255,82,85,212,207,206,59,227,47,16,58,17,182,189,28,42,
-                          223,183,170,213,119,248,152, 2,44,154,163, 70,221,153,101,155,167, 43,172,9,
-                          129,22,39,253, 19,98,108,110,79,113,224,232,178,185, 112,104,218,246,97,228,
-                          251,34,242,193,238,210,144,12,191,179,162,241, 81,51,145,235,249,14,239,107,
-                          49,192,214, 31,181,199,106,157,184, 84,204,176,115,121,50,45,127, 4,150,254,
-                          138,236,205,93,222,114,67,29,24,72,243,141,128,195,78,66,215,61,156,180
-                        };
-
-        for (int i=0; i < 256 ; i++)
-            p[256+i] = p[i] = permutation[i];
-
-        int X = (int)floor(x) & 255,    // FIND UNIT CUBE THAT
-        Y = (int)floor(y) & 255,        // CONTAINS POINT.
-        Z = (int)floor(z) & 255;
-
-        x -= floor(x);      // FIND RELATIVE X,Y,Z
-        y -= floor(y);      // OF POINT IN CUBE.
-        z -= floor(z);
-
-        double u = fade(x), // COMPUTE FADE CURVES
+    static float noise(float x, float y, float z)
+    {
+        const byte *p = permutation();
+
+        float fx = floorf(x), fy = floorf(y), fz = floorf(z);
+        int X = (int)fx & 255,      // FIND UNIT CUBE THAT
+        Y = (int)fy & 255,          // CONTAINS POINT.
+        Z = (int)fz & 255;
+
+        x -= fx;            // FIND RELATIVE X,Y,Z
+        y -= fy;            // OF POINT IN CUBE.
+        z -= fz;
+
+        float u = fade(x),  // COMPUTE FADE CURVES
         v = fade(y),        // FOR EACH OF X,Y,Z.
         w = fade(z);
         int A = p[X  ]+Y, AA = p[A]+Z, AB = p[A+1]+Z,  // HASH COORDINATES OF
@@ -56,25 +59,221 @@ public:
                                         grad(p[BB+1], x-1, y-1, z-1 ))));
     }
 
+    // noise at four points. Only the hashing is done per point, the
+    // gradients and the interpolation work on all four at once
+    static float4 noise4(const float4 &_x, const float4 &_y, const float4 &_z)
+    {
+        float4 fx(floorf(_x.x), floorf(_x.y), floorf(_x.z), floorf(_x.w));
+        float4 fy(floorf(_y.x), floorf(_y.y), floorf(_y.z), floorf(_y.w));
+        float4 fz(floorf(_z.x), floorf(_z.y), floorf(_z.z), floorf(_z.w));
+
+        float4 gx[8], gy[8], gz[8];
+        cornerGradients(fx, fy, fz, gx, gy, gz);
+
+        float4 one = float4::rep(1.f);
+        float4 x0 = _x - fx, y0 = _y - fy, z0 = _z - fz;
+        float4 x1 = x0 - one, y1 = y0 - one, z1 = z0 - one;
+
+        float4 u = fade4(x0), v = fade4(y0), w = fade4(z0);
+
+        return lerp4(w, lerp4(v, lerp4(u, gx[0] * x0 + gy[0] * y0 + gz[0] * z0,
+                                          gx[1] * x1 + gy[1] * y0 + gz[1] * z0),
+                                 lerp4(u, gx[2] * x0 + gy[2] * y1 + gz[2] * z0,
+                                          gx[3] * x1 + gy[3] * y1 + gz[3] * z0)),
+                        lerp4(v, lerp4(u, gx[4] * x0 + gy[4] * y0 + gz[4] * z1,
+                                          gx[5] * x1 + gy[5] * y0 + gz[5] * z1),
+                                 lerp4(u, gx[6] * x0 + gy[6] * y1 + gz[6] * z1,
+                                          gx[7] * x1 + gy[7] * y1 + gz[7] * z1)));
+    }
+
+    // noise and its analytic gradient at four points. The noise is a
+    // trilinear blend of the corner values g_c * (p - c) with the fade
+    // curves as weights, so the gradient is the same blend of the corner
+    // gradients plus the derivative of the fade curves times the
+    // difference of the blended corner values
+    static float4 noiseGrad4(const float4 &_x, const float4 &_y, const float4 &_z,
+        float4 &_dx, float4 &_dy, float4 &_dz)
+    {
+        float4 fx(floorf(_x.x), floorf(_x.y), floorf(_x.z), floorf(_x.w));
+        float4 fy(floorf(_y.x), floorf(_y.y), floorf(_y.z), floorf(_y.w));
+        float4 fz(floorf(_z.x), floorf(_z.y), floorf(_z.z), floorf(_z.w));
+
+        float4 gx[8], gy[8], gz[8];
+        cornerGradients(fx, fy, fz, gx, gy, gz);
+
+        float4 one = float4::rep(1.f);
+        float4 x0 = _x - fx, y0 = _y - fy, z0 = _z - fz;
+        float4 x1 = x0 - one, y1 = y0 - one, z1 = z0 - one;
+
+        float4 n000 = gx[0] * x0 + gy[0] * y0 + gz[0] * z0;
+        float4 n100 = gx[1] * x1 + gy[1] * y0 + gz[1] * z0;
+        float4 n010 = gx[2] * x0 + gy[2] * y1 + gz[2] * z0;
+        float4 n110 = gx[3] * x1 + gy[3] * y1 + gz[3] * z0;
+        float4 n001 = gx[4] * x0 + gy[4] * y0 + gz[4] * z1;
+        float4 n101 = gx[5] * x1 + gy[5] * y0 + gz[5] * z1;
+        float4 n011 = gx[6] * x0 + gy[6] * y1 + gz[6] * z1;
+        float4 n111 = gx[7] * x1 + gy[7] * y1 + gz[7] * z1;
+
+        float4 u = fade4(x0), v = fade4(y0), w = fade4(z0);
+
+        // n = k0 + k1 u + k2 v + k3 w + k4 uv + k5 vw + k6 wu + k7 uvw
+        float4 k1 = n100 - n000;
+        float4 k2 = n010 - n000;
+        float4 k3 = n001 - n000;
+        float4 k4 = n000 - n100 - n010 + n110;
+        float4 k5 = n000 - n010 - n001 + n011;
+        float4 k6 = n000 - n100 - n001 + n101;
+        float4 k7 = n100 + n010 + n001 + n111 - n000 - n110 - n101 - n011;
+
+        _dx = trilerp4(u, v, w, gx) + fadeDerivative4(x0) * (k1 + k4 * v + k6 * w + k7 * v * w);
+        _dy = trilerp4(u, v, w, gy) + fadeDerivative4(y0) * (k2 + k5 * w + k4 * u + k7 * w * u);
+        _dz = trilerp4(u, v, w, gz) + fadeDerivative4(z0) * (k3 + k6 * u + k5 * v + k7 * u * v);
+
+        return n000 + k1 * u + k2 * v + k3 * w + k4 * u * v + k5 * v * w + k6 * w * u + k7 * u * v * w;
+    }
+
+    // noise at a single point, its gradient is returned in _gradient
+    static float noiseGrad(float x, float y, float z, Vector &_gradient)
+    {
+        float4 dx, dy, dz;
+        float4 n = noiseGrad4(float4::rep(x), float4::rep(y), float4::rep(z), dx, dy, dz);
+        _gradient = Vector(dx.x, dy.x, dz.x);
+        return n.x;
+    }
+
+    // evaluates noise(f*x, f*y, f*z) for each of the _count frequencies
+    // into _result, four octaves per noise4 call
+    static void noiseOctaves(float x, float y, float z, const float *_frequencies, float *_result, uint _count)
+    {
+        float4 px = float4::rep(x), py = float4::rep(y), pz = float4::rep(z);
+
+        for (uint i = 0; i < _count; i += 4)
+        {
+            // the last batch repeats the highest frequency
+            float4 f;
+            for (uint k = 0; k < 4; k++)
+                f[k] = _frequencies[std::min(i + k, _count - 1)];
+
+            float4 n = noise4(f * px, f * py, f * pz);
+
+            for (uint k = 0; k < 4 && i + k < _count; k++)
+                _result[i + k] = n[k];
+        }
+    }
+
+
+    // like noiseOctaves, but also returns the gradients of the octaves
+    // with respect to (x, y, z), i.e. already scaled by the frequency
+    static void noiseGradOctaves(float x, float y, float z, const float *_frequencies,
+        float *_result, Vector *_gradients, uint _count)
+    {
+        float4 px = float4::rep(x), py = float4::rep(y), pz = float4::rep(z);
+
+        for (uint i = 0; i < _count; i += 4)
+        {
+            float4 f;
+            for (uint k = 0; k < 4; k++)
+                f[k] = _frequencies[std::min(i + k, _count - 1)];
+
+            float4 dx, dy, dz;
+            float4 n = noiseGrad4(f * px, f * py, f * pz, dx, dy, dz);
+            dx = dx * f;
+            dy = dy * f;
+            dz = dz * f;
+
+            for (uint k = 0; k < 4 && i + k < _count; k++)
+            {
+                _result[i + k] = n[k];
+                _gradients[i + k] = Vector(dx[k], dy[k], dz[k]);
+            }
+        }
+    }
+
 
 private:
 
-    static double fade(double t)
+    // hashes the 8 corners of the unit cubes at (_fx, _fy, _fz) and
+    // looks up their gradients. Corner index is x | y << 1 | z << 2
+    static void cornerGradients(const float4 &_fx, const float4 &_fy, const float4 &_fz,
+        float4 *_gx, float4 *_gy, float4 *_gz)
+    {
+        const byte *p = permutation();
+        const float *g = gradients();
+
+        for (int i = 0; i < 4; i++)
+        {
+            int X = (int)_fx[i] & 255, Y = (int)_fy[i] & 255, Z = (int)_fz[i] & 255;
+            int A = p[X]+Y, AA = p[A]+Z, AB = p[A+1]+Z,
+            B = p[X+1]+Y, BA = p[B]+Z, BB = p[B+1]+Z;
+
+            int hash[8] = { p[AA], p[BA], p[AB], p[BB], p[AA+1], p[BA+1], p[AB+1], p[BB+1] };
+            for (int c = 0; c < 8; c++)
+            {
+                const float *cg = g + 4 * (hash[c] & 15);
+                _gx[c][i] = cg[0];
+                _gy[c][i] = cg[1];
+                _gz[c][i] = cg[2];
+            }
+        }
+    }
+
+    // trilinear blend of 8 corner values, same corner order as above
+    static float4 trilerp4(const float4 &u, const float4 &v, const float4 &w, const float4 *c)
+    {
+        return lerp4(w, lerp4(v, lerp4(u, c[0], c[1]), lerp4(u, c[2], c[3])),
+                        lerp4(v, lerp4(u, c[4], c[5]), lerp4(u, c[6], c[7])));
+    }
+
+    // the permutation, repeated once to avoid wrapping the indices
+    static const byte *permutation()
+    {
+        static const byte p[512] = { _PERLIN_PERMUTATION, _PERLIN_PERMUTATION };
+        return p;
+    }
+
+    // the 12 gradient directions of the reference implementation, indexed
+    // by the low 4 bits of the hash code. The 4th component is padding
+    static const float *gradients()
+    {
+        static const float g[16 * 4] = {
+             1, 1, 0, 0,  -1, 1, 0, 0,   1,-1, 0, 0,  -1,-1, 0, 0,
+             1, 0, 1, 0,  -1, 0, 1, 0,   1, 0,-1, 0,  -1, 0,-1, 0,
+             0, 1, 1, 0,   0,-1, 1, 0,   0, 1,-1, 0,   0,-1,-1, 0,
+             1, 1, 0, 0,   0,-1, 1, 0,  -1, 1, 0, 0,   0,-1,-1, 0
+        };
+        return g;
+    }
+
+    static float fade(float t)
     {
         return t * t * t * (t * (t * 6 - 15) + 10);
     }
 
-    static double lerp(double t, double a, double b)
+    static float4 fade4(const float4 &t)
+    {
+        return t * t * t * (t * (t * float4::rep(6.f) - float4::rep(15.f)) + float4::rep(10.f));
+    }
+
+    static float4 fadeDerivative4(const float4 &t)
+    {
+        float4 s = t * (t - float4::rep(1.f));
+        return float4::rep(30.f) * s * s;
+    }
+
+    static float lerp(float t, float a, float b)
+    {
+        return a + t * (b - a);
+    }
+
+    static float4 lerp4(const float4 &t, const float4 &a, const float4 &b)
     {
         return a + t * (b - a);
     }
 
-    static double grad(int hash, double x, double y, double z)
+    static float grad(int hash, float x, float y, float z)
     {
-        int h = hash & 15;                      // CONVERT LO 4 BITS OF HASH CODE
-        double u = h<8 ? x : y,                 // INTO 12 GRADIENT DIRECTIONS.
-                   v = h<4 ? y : h==12||h==14 ? x : z;
-        return ((h&1) == 0 ? u : -u) + ((h&2) == 0 ? v : -v);
+        const float *g = gradients() + 4 * (hash & 15);  // CONVERT LO 4 BITS OF HASH CODE
+        return g[0] * x + g[1] * y + g[2] * z;           // INTO 12 GRADIENT DIRECTIONS.
     }
 
     // cosine interpolation
@@ -72,16 +72,12 @@ public:
 		Ray ret;
 		ret.o = m_center;
 		ret.d = m_topLeft + _x * m_stepX + _y * m_stepY; // was *4.f
+		ret.hasDifferentials = true;
+		ret.rxOrigin = ret.ryOrigin = m_center;
+		ret.rxDirection = ret.d + m_stepX;
+		ret.ryDirection = ret.d + m_stepY;
 		return ret;
 	}
-
-    virtual std::vector<Ray> getPrimaryRays(float _x, float _y)
-	{
-	    std::vector<Ray> rays;
-		Ray ret = getPrimaryRay(_x, _y);
-        rays.push_back(ret);
-		return rays;
-	}
 };
 
 // a simple orthographic camera.
@@ -109,16 +105,12 @@ public:
 		Ray ret;
 		ret.o = m_center + m_topLeft + _x * m_stepX + _y * m_stepY;
 		ret.d = m_forward;
+		ret.hasDifferentials = true;
+		ret.rxOrigin = ret.o + m_stepX;
+		ret.ryOrigin = ret.o + m_stepY;
+		ret.rxDirection = ret.ryDirection = m_forward;
 		return ret;
 	}
-
-    virtual std::vector<Ray> getPrimaryRays(float _x, float _y)
-	{
-	    std::vector<Ray> rays;
-		Ray ret = getPrimaryRay(_x, _y);
-        rays.push_back(ret);
-		return rays;
-	}
 };
 
 // A perspective camera implementation
@@ -134,9 +126,10 @@ class PerspectiveLensCamera : public PerspectiveCamera
     Vector m_lensCenter;
     Vector m_imageCenter;
     Point m_lookAt;
-
-    std::vector<Point> samplePoints;
 
+    // number of rays per camera sample. The rays go through points of a
+    // hammersley set on the lens, shifted by the lens position of the
+    // sample. With 1 each ray uses the lens position from the sampler
     int samples;
 
 
@@ -210,136 +203,110 @@ public:
 		init(_focalLength, _lensAperture, _lensDistance, _samplePoints, _focusAtLookAt);
 	}
 
+	// a ray through the center of the lens
 	virtual Ray getPrimaryRay(float _x, float _y)
 	{
-	    return getPrimaryRays(_x,_y)[0];
+        if (lensDistance == focalLength) // shouldn't happen
+            return PerspectiveCamera::getPrimaryRay(_x, _y);
+
+        return getLensRay(getFocusPoint(_x, _y), getFocusPoint(_x + 1.f, _y), getFocusPoint(_x, _y + 1.f), m_center + m_lensCenter);
 	}
 
-	virtual std::vector<Ray> getPrimaryRays(float _x, float _y)
+	virtual uint getRaysPerSample() const
 	{
-	    std::vector<Ray> rays;
-
-        if (lensAperture == 0) { // focus at infinity, everything sharp (lens radius = 0)
+        if (lensAperture == 0 || lensDistance == focalLength) { // focus at infinity, everything sharp (lens radius = 0)
             // only one sample needed.
-            samples = 1;
-        }
-
-        if (lensDistance == focalLength) { // shouldn't happen
-            Ray r = PerspectiveLensCamera::getPrimaryRay(_x,_y);
-            rays.push_back(r);
-            return rays;
+            return 1;
         }
-
-	    // lens simulation will flip the image vertically and horizontally,
-	    // therefore invert coordinates here to get a correct image afterwards
-	    _x = resX-_x;
-	    _y = resY-_y;
-
-        // get "normal" primary ray to determine source point on image plane
-	    Ray r = PerspectiveCamera::getPrimaryRay(_x, _y);
-
-	    // source point on image plane
-	    Point p = m_center + r.d;
-
-        //std::cout << "lensDistance: " <<lensDistance << " , focalLength: " << focalLength << std::endl;
-
-        // do crazy shit
-        float o = (focalLength*lensDistance) /  (lensDistance-focalLength);
-        Point lensCenter = m_center+m_lensCenter;
-        Vector pc = Vector(lensCenter-p);
-        float ratio = (pc.len()) / (lensDistance);
-
-        Point q = lensCenter + o*ratio* (~pc);
-
-        //std::cout <<"P: "<< p[0] << "," <<p[1] << "," <<p[2] <<std::endl;
-        //std::cout <<"Q: "<< q[0] << "," <<q[1] << "," <<q[2] <<std::endl;
-	    //Point q = Point(0, 1, -10);
-
-        // generate new samples
-        genSamples();
-        //genSamples(lensAperture, rings, samples, false);
-
-	    // distribution of rays
-	    for (int i = 0; i < samples; i++) {
-            Ray sampleRay;
-            sampleRay.o = samplePoints[i];
-            sampleRay.d = ~(q-samplePoints[i]);
-
-            //std::cout <<"Created sample ray #" << i << ": "<< sampleRay.o[0] << "," <<sampleRay.o[1] << "," <<sampleRay.o[2]
-            //<< " to: " << sampleRay.d[0] << "," <<sampleRay.d[1] << "," << sampleRay.d[2]  << std::endl;
-
-            rays.push_back(sampleRay);
-	    }
-
-		return rays;
+        return (uint)samples;
 	}
 
-private:
-
-    // generates random sample points on the lens and saves
-    // them in samplePoints.
-	void genSamples()
+	virtual void getPrimaryRays(const CameraSample *_samples, uint _count, Ray *_rays)
 	{
-	    samplePoints.clear();
-	    for(int i=0; i<samples; ++i)
-        {
-            // convert to polar coordinates
-            // theta = 2*PI*rand1
-            // r = aperture*sqrt(rand2)*0.5
-            float rd = Random::getRandomFloat(0,1);
-            float theta = 2*PI*rd; // theta angle in interval [0,360)
-            float rd2 = Random::getRandomFloat(0,1);
+	    uint raysPerSample = getRaysPerSample();
 
-            //std::cout << "heyho lets go " << lensAperture << std::endl;
-            float r = 0.5f*lensAperture*sqrt(rd2); // random distance between 0 and radius of lens (0.5f*aperture)
+	    for (uint i = 0; i < _count; i++) {
+            float x = _samples[i].image.x, y = _samples[i].image.y;
+            Ray *rays = _rays + i * raysPerSample;
 
-            // convert polar coordinates to carthesian coodinates
-            // use up vector as x-coordinate for polar coordinates
-            float x = r * cos(theta);
-            float y = r * sin(theta);
-
-            //std::cout << "x: " << x << " and y: " << y << std::endl;
-
-            Point samplePoint = m_center + (m_lensCenter + m_right * x + m_up * y);
+            if (lensDistance == focalLength) { // shouldn't happen
+                rays[0] = PerspectiveCamera::getPrimaryRay(x, y);
+                continue;
+            }
 
-            //std::cout <<"Created sample point #" << i << ": "<< samplePoint[0] << "," <<samplePoint[1] << "," <<samplePoint[2] <<std::endl;
+            Point q = getFocusPoint(x, y);
+            // focus points of the neighbouring pixels for the ray differentials
+            Point qx = getFocusPoint(x + 1.f, y);
+            Point qy = getFocusPoint(x, y + 1.f);
 
-            samplePoints.push_back(samplePoint);
-        }
+	        // distribution of rays
+            for (uint j = 0; j < raysPerSample; j++)
+                rays[j] = getLensRay(q, qx, qy, getLensPoint(_samples[i].lens, j, raysPerSample));
+	    }
 	}
 
-    // generates sample points on lens
-    // based on a n-edged form
-    // for a nice lens effect
-	void genSamples(float _aperture, int _pointsPerRing, int _numRings, bool _round)
-	{
-        samplePoints.clear();
-        for (int i = 0 ; i < _numRings; i++) {
-
-            float rd = Random::getRandomFloat(0,1);
-            float theta = 2*PI*rd; // theta angle in interval [0,360)
+private:
 
-            if (!_round && (i == (_numRings-1)))
-            {
-                theta = .5*(rd - .5); // FIXME: spiel mal mit nem konstanten Faktoren hier vielleicht..
-            }
+    // point on the focal plane which is imaged onto pixel (_x, _y)
+    Point getFocusPoint(float _x, float _y) const
+    {
+	    // lens simulation will flip the image vertically and horizontally,
+	    // therefore invert coordinates here to get a correct image afterwards
+	    _x = resX-_x;
+	    _y = resY-_y;
 
-            float r = _aperture / _numRings * (i+1);
-            float angle = 360 / _pointsPerRing;
-            for(int j=0 ; j<_pointsPerRing ; j++)
-            {
-                float2 polar = float2(r-Random::getRandomFloat(0,1)*(_aperture / _numRings) * sqrt(Random::getRandomFloat(0,1)), theta + j*angle);
-                float x = polar.x * cos(polar.y);
-                float y = polar.x * sin(polar.y);
-                Point samplePoint = m_center + (m_lensCenter + m_right * x + m_up * y);
-                samplePoints.push_back(samplePoint);
+        // source point on image plane
+        Point p = m_center + (m_topLeft + _x * m_stepX + _y * m_stepY);
 
-            }
+        float o = (focalLength*lensDistance) /  (lensDistance-focalLength);
+        Point lensCenter = m_center+m_lensCenter;
+        Vector pc = Vector(lensCenter-p);
+        float ratio = (pc.len()) / (lensDistance);
 
-            //std::cout << "heyho lets go " << lensAperture << std::endl;
-            //float r = 0.5f*lensAperture*sqrt(rd2); // random distance between 0 and radius of lens (0.5f*aperture)
-	    }
-	}
+        return lensCenter + o*ratio* (~pc);
+    }
+
+    // ray from a point on the lens through the focus point _q of a pixel,
+    // _qx and _qy are the focus points of the neighbouring pixels
+    Ray getLensRay(const Point &_q, const Point &_qx, const Point &_qy, const Point &_lensPoint) const
+    {
+        Ray sampleRay;
+        sampleRay.o = _lensPoint;
+        sampleRay.d = ~(_q-_lensPoint);
+
+        // the auxiliary rays go through the same lens point
+        sampleRay.hasDifferentials = true;
+        sampleRay.rxOrigin = sampleRay.ryOrigin = _lensPoint;
+        sampleRay.rxDirection = ~(_qx-_lensPoint);
+        sampleRay.ryDirection = ~(_qy-_lensPoint);
+        return sampleRay;
+    }
+
+    // point _i of _n points on the lens. The points are a hammersley set,
+    // shifted by the lens position of the camera sample (wrapping around)
+    Point getLensPoint(const float2 &_lens, uint _i, uint _n) const
+    {
+        float rd = (float)_i / (float)_n + _lens.x;
+        float rd2 = _lens.y;
+        float digit = 0.5f;
+        for (uint i = _i; i != 0; i >>= 1, digit *= 0.5f)
+            rd2 += (float)(i & 1) * digit;
+        rd -= floorf(rd);
+        rd2 -= floorf(rd2);
+
+        // convert to polar coordinates
+        // theta = 2*PI*rand1
+        // r = aperture*sqrt(rand2)*0.5
+        float theta = 2*PI*rd; // theta angle in interval [0,360)
+        float r = 0.5f*lensAperture*sqrt(rd2); // distance between 0 and radius of lens (0.5f*aperture)
+
+        // convert polar coordinates to carthesian coodinates
+        // use up vector as x-coordinate for polar coordinates
+        float x = r * cos(theta);
+        float y = r * sin(theta);
+
+        return m_center + (m_lensCenter + m_right * x + m_up * y);
+    }
 };
 
 
@@ -6,6 +6,7 @@
 
 
 #include "../rt/shading_basics.h"
+#include "../rt/texture.h"
 #include "perlin.h"
 
 #define DELTA  0.00000001
@@ -24,22 +25,135 @@ struct DefaultAmbientShader : public PluggableShader
 	virtual ~DefaultAmbientShader() {}
 };
 
-//A base class for a phong shader.
+//A base class for a phong shader. The normal and the coefficients are
+//	computed on first use and cached for the rest of the hit, since
+//	they are queried once per light and again by the integrators.
+//The shading is done by static kernel functions of the material and a
+//	hit, so the integrators can shade the attributes of a hit with the
+//	material itself (see KernelHit and visitShaderKernel). A hit gives
+//	the attributes with hitAttributes() and the normal and coefficients
+//	with getNormal() and getCoeff(). A shader cloned for a hit is a hit
+//	too: its virtual functions run the kernels on itself, with the
+//	normal and the coefficients of the virtual computeNormal and
+//	computeCoeff, which derived shaders may override.
 class PhongShaderBase : public PluggableShader
 {
+	//The cached attributes of the current hit. A copy starts empty, so
+	//	a shader cloned for a new hit never sees those of its prototype
+	struct AttributeCache
+	{
+		bool hasNormal, hasCoeff;
+		Vector normal;
+		float4 diffuseCoef, specularCoef;
+		float specularExponent;
+
+		AttributeCache() : hasNormal(false), hasCoeff(false) {}
+		AttributeCache(const AttributeCache&) : hasNormal(false), hasCoeff(false) {}
+		AttributeCache& operator=(const AttributeCache&)
+		{
+			hasNormal = hasCoeff = false;
+			return *this;
+		}
+
+		//The normal and the coefficients from the kernels of ta_shader
+		template<class ta_shader>
+		const Vector& getNormal(const ta_shader &_shader, const HitAttributes &_attr)
+		{
+			if(!hasNormal)
+			{
+				normal = ta_shader::kernelNormal(_shader, _attr);
+				hasNormal = true;
+				ShadingCacheStats::get().evaluations++;
+			}
+			else
+				ShadingCacheStats::get().saved++;
+
+			return normal;
+		}
+
+		template<class ta_shader>
+		void getCoeff(const ta_shader &_shader, const HitAttributes &_attr,
+			float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent)
+		{
+			if(!hasCoeff)
+			{
+				ta_shader::kernelCoeff(_shader, _attr, diffuseCoef, specularCoef, specularExponent);
+				hasCoeff = true;
+				ShadingCacheStats::get().evaluations++;
+			}
+			else
+				ShadingCacheStats::get().saved++;
+
+			_diffuseCoef = diffuseCoef;
+			_specularCoef = specularCoef;
+			_specularExponent = specularExponent;
+		}
+	};
+
+	mutable AttributeCache m_cache;
+
+protected:
+	//The hit of a shader cloned for it, filled by the setters
+	HitAttributes m_attr;
+
+	//Compute the attributes of the hit. Called at most once per hit
+	//	through getCoeff and getNormal
+	virtual void computeCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const = 0;
+	virtual Vector computeNormal() const = 0;
+
+	//Drops the cached attributes. Called by the setters of the hit data
+	void invalidateCache()
+	{
+		m_cache.hasNormal = false;
+		m_cache.hasCoeff = false;
+	}
+
 public:
+	//A hit shaded by the kernels of ta_shader, with the material _material
+	//	and the attributes _attr returned by Primitive::getMaterialHit. Both
+	//	need to outlive the hit
+	template<class ta_shader>
+	class KernelHit
+	{
+		const ta_shader &m_material;
+		const HitAttributes &m_attr;
+		mutable AttributeCache m_cache;
 
-	virtual void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const = 0;
-	virtual Vector getNormal() const = 0;
+	public:
+		KernelHit(const ta_shader &_material, const HitAttributes &_attr)
+			: m_material(_material), m_attr(_attr) {}
 
-	virtual float4 getReflectance(const Vector &_outDir, const Vector &_inDir) const
+		const HitAttributes& hitAttributes() const { return m_attr; }
+		Vector getNormal() const { return m_cache.getNormal(m_material, m_attr); }
+		void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+		{
+			m_cache.getCoeff(m_material, m_attr, _diffuseCoef, _specularCoef, _specularExponent);
+		}
+	};
+
+	//The kernels of the normal and the coefficients of a cloned shader
+	//	call the virtual functions
+	static Vector kernelNormal(const PhongShaderBase &_shader, const HitAttributes &_attr)
+	{
+		return _shader.computeNormal();
+	}
+
+	static void kernelCoeff(const PhongShaderBase &_shader, const HitAttributes &_attr,
+		float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent)
+	{
+		_shader.computeCoeff(_diffuseCoef, _specularCoef, _specularExponent);
+	}
+
+	template<class ta_hit>
+	static float4 kernelReflectance(const PhongShaderBase &_shader, const ta_hit &_hit,
+		const Vector &_outDir, const Vector &_inDir)
 	{
 		float4 Cs, Cd;
 		float Ce;
 
-		getCoeff(Cd, Cs, Ce);
+		_hit.getCoeff(Cd, Cs, Ce);
 
-		Vector normal = getNormal();
+		Vector normal = _hit.getNormal();
 		Vector halfVect = ~(~_inDir + ~_outDir);
 		float specCoeff = std::max(halfVect * normal, 0.f);
 		specCoeff = exp(log(specCoeff) * Ce);
@@ -48,15 +162,193 @@ public:
 		return float4::rep(diffCoeff) * Cd + float4::rep(specCoeff) * Cs;
 	}
 
+	//The kernels of the Shader functions a phong shader does not support
+	template<class ta_hit>
+	static float4 kernelIndirectRadiance(const PhongShaderBase &_shader, const ta_hit &_hit,
+		const Vector &_out, Integrator *_integrator)
+	{
+		return float4::rep(0.f);
+	}
+
+	template<class ta_hit>
+	static bool kernelSecondaryRays(const PhongShaderBase &_shader, const ta_hit &_hit,
+		const Vector &_out, float _refractionIndex, SecondaryRays &_rays)
+	{
+		return false;
+	}
+
+	template<class ta_hit>
+	static float4 kernelTransparency(const PhongShaderBase &_shader, const ta_hit &_hit,
+		ShadowRay &_in, Integrator *_integrator)
+	{
+		return float4::rep(0.f);
+	}
+
+	//An indirect radiance kernel for shaders with a secondary rays kernel
+	template<class ta_shader, class ta_hit>
+	static float4 kernelTraceSecondaryRays(const ta_shader &_shader, const ta_hit &_hit,
+		const Vector &_out, Integrator *_integrator)
+	{
+		SecondaryRays rays;
+		ta_shader::kernelSecondaryRays(_shader, _hit, _out, _integrator->getCurrentRefractionIndex(), rays);
+		return rays.getRadiance(_integrator);
+	}
+
+	const HitAttributes& hitAttributes() const { return m_attr; }
+
+	void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+	{
+		m_cache.getCoeff(*this, m_attr, _diffuseCoef, _specularCoef, _specularExponent);
+	}
+
+	Vector getNormal() const
+	{
+		return m_cache.getNormal(*this, m_attr);
+	}
+
+	virtual void setPosition(const Point& _point) { m_attr.position = _point; invalidateCache(); }
+
+	virtual void setNormal(const Vector& _normal)
+	{
+		m_attr.hasNormal = true;
+		m_attr.normal = _normal;
+		invalidateCache();
+	}
+
+	virtual void setTextureCoord(const float2& _texCoord)
+	{
+		m_attr.hasTexCoord = true;
+		m_attr.texCoord = _texCoord;
+		invalidateCache();
+	}
+
+	virtual void setVertices(const Point& _v1, const Point& _v2, const Point& _v3)
+	{
+		m_attr.hasVertices = true;
+		m_attr.v1 = _v1;
+		m_attr.v2 = _v2;
+		m_attr.v3 = _v3;
+		invalidateCache();
+	}
+
+	virtual void setTexels(float2 _tex1, float2 _tex2, float2 _tex3)
+	{
+		m_attr.tex1 = _tex1;
+		m_attr.tex2 = _tex2;
+		m_attr.tex3 = _tex3;
+		invalidateCache();
+	}
+
+	virtual void setTextureFootprint(const float2& _dx, const float2& _dy)
+	{
+		m_attr.texDx = _dx;
+		m_attr.texDy = _dy;
+		invalidateCache();
+	}
+
+	virtual void setDifferentials(const HitDifferentials& _diff)
+	{
+		m_attr.hasDifferentials = true;
+		m_attr.differentials = _diff;
+		invalidateCache();
+	}
+
+	virtual float4 getReflectance(const Vector &_outDir, const Vector &_inDir) const
+	{
+		return kernelReflectance(*this, *this, _outDir, _inDir);
+	}
+
 	virtual ~PhongShaderBase() {}
 };
 
 
+_DECLARE_SHADER_KERNEL(DefaultPhongShader, SK_DefaultPhong)
+_DECLARE_SHADER_KERNEL(TexturedPhongShader, SK_TexturedPhong)
+_DECLARE_SHADER_KERNEL(MirrorPhongShader, SK_MirrorPhong)
+_DECLARE_SHADER_KERNEL(TexturedBumpPhongShader, SK_TexturedBumpPhong)
+_DECLARE_SHADER_KERNEL(RefractivePhongShader, SK_RefractivePhong)
+_DECLARE_SHADER_KERNEL(ProceduralBumpShader, SK_ProceduralBump)
+
 //The default phong shader
 class DefaultPhongShader : public PhongShaderBase
 {
 protected:
-	Vector m_normal; //Stored normalized
+	//World space size of the pixel footprint at the hit, 0 if unknown
+	static float getFootprint(const HitAttributes &_attr)
+	{
+		if(!_attr.hasDifferentials)
+			return 0.f;
+		return std::max(_attr.differentials.dPdx.len(), _attr.differentials.dPdy.len());
+	}
+
+	float getFootprint() const { return getFootprint(m_attr); }
+
+	//Mirrors _out (pointing away from the surface) at the normal
+	static Vector reflect(const Vector &_out, const Vector &_n)
+	{
+		Vector v = _n * fabs(_n * _out);
+		return _out + 2 * (v - _out);
+	}
+
+	//Refracts the normalized _out (pointing away from the surface) using the
+	//	normal on its side and the ratio of refraction indices. Returns false
+	//	in case of total internal reflection
+	static bool refract(const Vector &_out, const Vector &_n, float _ratio, Vector &_result)
+	{
+		float cosThetaIn = fabs(_n * _out);
+		Vector tangentIn = _n * cosThetaIn - _out;
+		float sinSquare = 1.f - (_ratio * _ratio) * (1 - cosThetaIn * cosThetaIn);
+		if(sinSquare < 0)
+			return false;
+
+		_result = tangentIn * _ratio + (-sqrtf(sinSquare)) * _n;
+		return true;
+	}
+
+	//Sets the differentials of a ray mirrored at the hit _attr. The
+	//	change of the normal over the footprint is neglected
+	static void setReflectedDifferentials(const HitAttributes &_attr, Ray &_r, const Vector &_n, const Vector &_out)
+	{
+		if(!_attr.hasDifferentials)
+			return;
+
+		_r.hasDifferentials = true;
+		_r.rxOrigin = _r.o + _attr.differentials.dPdx;
+		_r.ryOrigin = _r.o + _attr.differentials.dPdy;
+		_r.rxDirection = reflect(_out - _attr.differentials.dDdx, _n);
+		_r.ryDirection = reflect(_out - _attr.differentials.dDdy, _n);
+	}
+
+	//Adds the ray mirrored at the shaded normal of _hit, with its
+	//	differentials, to _rays
+	template<class ta_hit>
+	static void addReflectedRay(const ta_hit &_hit, const Vector &_out, float _coef, SecondaryRays &_rays)
+	{
+		Ray r;
+		r.o = _hit.hitAttributes().position;
+
+		Vector n = _hit.getNormal();
+		r.d = reflect(_out, n);
+		setReflectedDifferentials(_hit.hitAttributes(), r, n, _out);
+
+		_rays.add(r, float4::rep(_coef), SecondaryRays::ST_Reflection);
+	}
+
+	//Sets the differentials of a ray refracted at the hit _attr. Auxiliary
+	//	rays that are totally reflected reuse the direction of the main ray
+	static void setRefractedDifferentials(const HitAttributes &_attr, Ray &_r, const Vector &_n, const Vector &_out, float _ratio)
+	{
+		if(!_attr.hasDifferentials)
+			return;
+
+		_r.hasDifferentials = true;
+		_r.rxOrigin = _r.o + _attr.differentials.dPdx;
+		_r.ryOrigin = _r.o + _attr.differentials.dPdy;
+		if(!refract(~(_out - _attr.differentials.dDdx), _n, _ratio, _r.rxDirection))
+			_r.rxDirection = _r.d;
+		if(!refract(~(_out - _attr.differentials.dDdy), _n, _ratio, _r.ryDirection))
+			_r.ryDirection = _r.d;
+	}
 
 public:
 	float4 diffuseCoef;
@@ -64,17 +356,33 @@ public:
 	float4 ambientCoef;
 	float specularExponent;
 
+	static Vector kernelNormal(const DefaultPhongShader &_shader, const HitAttributes &_attr)
+	{
+		return ~_attr.normal;
+	}
+
+	static void kernelCoeff(const DefaultPhongShader &_shader, const HitAttributes &_attr,
+		float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent)
+	{
+		_diffuseCoef = _shader.diffuseCoef;
+		_specularCoef = _shader.specularCoef;
+		_specularExponent = _shader.specularExponent;
+	}
+
+	template<class ta_hit>
+	static float4 kernelAmbientCoefficient(const DefaultPhongShader &_shader, const ta_hit &_hit)
+	{
+		return _shader.ambientCoef;
+	}
+
 	//Get the ambient coefficient for the material
-	virtual float4 getAmbientCoefficient() const { return ambientCoef; }
-	virtual void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+	virtual float4 getAmbientCoefficient() const { return kernelAmbientCoefficient(*this, *this); }
+	virtual void computeCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
 	{
-		_diffuseCoef = diffuseCoef;
-		_specularCoef = specularCoef;
-		_specularExponent = specularExponent;
+		kernelCoeff(*this, m_attr, _diffuseCoef, _specularCoef, _specularExponent);
 	}
 
-	virtual Vector getNormal() const { return m_normal;}
-	virtual void setNormal(const Vector& _normal) { m_normal = ~_normal;}
+	virtual Vector computeNormal() const { return kernelNormal(*this, m_attr); }
 
 	_IMPLEMENT_CLONE(DefaultPhongShader);
 
@@ -84,33 +392,48 @@ public:
 class TexturedPhongShader : public DefaultPhongShader
 {
 protected:
-	float2 m_texCoord;
+	//Samples _texture at the hit, over the texture footprint if the hit
+	//	has differentials
+	static float4 sampleTexture(const Texture &_texture, const HitAttributes &_attr)
+	{
+		if(!_attr.hasTexCoord || !_attr.hasDifferentials)
+			return _texture.sample(_attr.texCoord, float2(0.f, 0.f), float2(0.f, 0.f));
+		return _texture.sample(_attr.texCoord, _attr.texDx, _attr.texDy);
+	}
+
 public:
 	SmartPtr<Texture> diffTexture;
 	SmartPtr<Texture> ambientTexture;
 	SmartPtr<Texture> specTexture;
 
-	virtual void setTextureCoord(const float2& _texCoord) { m_texCoord = _texCoord;}
-
-	virtual float4 getAmbientCoefficient() const
+	template<class ta_hit>
+	static float4 kernelAmbientCoefficient(const TexturedPhongShader &_shader, const ta_hit &_hit)
 	{
-		float4 ret = DefaultPhongShader::getAmbientCoefficient();
+		float4 ret = DefaultPhongShader::kernelAmbientCoefficient(_shader, _hit);
 
-		if(ambientTexture.data() != NULL)
-			ret = ambientTexture->sample(m_texCoord);
+		if(_shader.ambientTexture.data() != NULL)
+			ret = sampleTexture(*_shader.ambientTexture, _hit.hitAttributes());
 
 		return ret;
 	}
 
-	virtual void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+	static void kernelCoeff(const TexturedPhongShader &_shader, const HitAttributes &_attr,
+		float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent)
 	{
-		DefaultPhongShader::getCoeff(_diffuseCoef, _specularCoef, _specularExponent);
+		DefaultPhongShader::kernelCoeff(_shader, _attr, _diffuseCoef, _specularCoef, _specularExponent);
+
+		if(_shader.diffTexture.data() != NULL)
+			_diffuseCoef = sampleTexture(*_shader.diffTexture, _attr);
 
-		if(diffTexture.data() != NULL)
-			_diffuseCoef = diffTexture->sample(m_texCoord);
+		if(_shader.specTexture.data() != NULL)
+			_specularCoef = sampleTexture(*_shader.specTexture, _attr);
+	}
+
+	virtual float4 getAmbientCoefficient() const { return kernelAmbientCoefficient(*this, *this); }
 
-		if(specTexture.data() != NULL)
-			_specularCoef = specTexture->sample(m_texCoord);
+	virtual void computeCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+	{
+		kernelCoeff(*this, m_attr, _diffuseCoef, _specularCoef, _specularExponent);
 	}
 
 
@@ -121,14 +444,10 @@ public:
 class BumpMirrorPhongShader : public DefaultPhongShader
 {
 protected:
-	float2 m_texCoord;
-	Point m_position;
 	Vector m_tang, m_biNorm;
 public:
 	float reflCoef;
 
-	virtual void setPosition(const Point& _point) { m_position = _point; }
-
 	//Set the tangent to (0, 1, 0)
 	virtual void setNormal(const Vector& _normal)
 	{
@@ -137,12 +456,13 @@ public:
 		m_biNorm = ~_normal % m_tang;
 	}
 
-	virtual Vector getNormal() const
+	virtual Vector computeNormal() const
 	{
-		Vector ret = m_normal;
+		Vector normal = DefaultPhongShader::computeNormal();
+		Vector ret = normal;
 
 		float d;
-		float2 t1 = float2(modf(m_texCoord.x, &d), modf(m_texCoord.y, &d)) - float2(0.5f, 0.5f);
+		float2 t1 = float2(modf(m_attr.texCoord.x, &d), modf(m_attr.texCoord.y, &d)) - float2(0.5f, 0.5f);
 
 		float dist = t1.x * t1.x  + t1.y * t1.y;
 		const float R = 0.25;
@@ -150,7 +470,7 @@ public:
 		if(dist < R * R)
 		{
 			Vector newNorm(t1.x / DIV, t1.y / DIV, sqrtf(R * R - dist / (DIV * DIV)));
-			ret = newNorm.x * m_tang + newNorm.y * m_biNorm + newNorm.z * m_normal;
+			ret = newNorm.x * m_tang + newNorm.y * m_biNorm + newNorm.z * normal;
 			ret = ~ret;
 		}
 
@@ -159,17 +479,14 @@ public:
 
 	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const
 	{
-		Ray r;
-		r.o = m_position;
-
-		Vector n = getNormal();
-		Vector v = n * fabs(n * _out);
-		r.d = _out + 2 * (v - _out);
-
-		return _integrator->getRadiance(r) * float4::rep(reflCoef);
+		return traceSecondaryRays(_out, _integrator);
 	}
 
-	virtual void setTextureCoord(const float2& _texCoord) { m_texCoord = _texCoord;}
+	virtual bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const
+	{
+		addReflectedRay(*this, _out, reflCoef, _rays);
+		return true;
+	}
 
 	_IMPLEMENT_CLONE(BumpMirrorPhongShader);
 
@@ -178,40 +495,43 @@ public:
 // a perfect mirror shader
 class MirrorPhongShader : public DefaultPhongShader
 {
-protected:
-	float2 m_texCoord;
-	Point m_position;
 public:
 	float reflCoef;
-
-	virtual void setPosition(const Point& _point) { m_position = _point; }
-
-	virtual Vector getNormal() const
-	{
-		return m_normal;
-	}
 
     virtual bool isReflective() const
     {
         return true;
     }
+
+	template<class ta_hit>
+	static float4 kernelIndirectRadiance(const MirrorPhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, Integrator *_integrator)
+	{
+		return kernelTraceSecondaryRays(_shader, _hit, _out, _integrator);
+	}
+
+	template<class ta_hit>
+	static bool kernelSecondaryRays(const MirrorPhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, float _refractionIndex, SecondaryRays &_rays)
+	{
+		addReflectedRay(_hit, _out, _shader.reflCoef, _rays);
+		return true;
+	}
 
 	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const
 	{
-		Ray r;
-		r.o = m_position;
-
-		Vector n = getNormal();
-		Vector v = n * fabs(n * _out);
-		r.d = _out + 2 * (v - _out);
+		return traceSecondaryRays(_out, _integrator);
+	}
 
-		return _integrator->getRadiance(r) * float4::rep(reflCoef);
+	virtual bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const
+	{
+		return kernelSecondaryRays(*this, *this, _out, _refractionIndex, _rays);
 	}
 
 	virtual void getPhotonInformation(const Vector &_out, float &_reflectionProbability, Ray &_reflection)
 	{
 	    Ray r;
-		r.o = m_position;
+		r.o = m_attr.position;
 
 		Vector n = getNormal();
 		Vector v = n * fabs(n * _out);
@@ -221,8 +541,6 @@ public:
 		_reflectionProbability = reflCoef;
 	}
 
-	virtual void setTextureCoord(const float2& _texCoord) { m_texCoord = _texCoord;}
-
 	_IMPLEMENT_CLONE(MirrorPhongShader);
 
 };
@@ -233,39 +551,27 @@ public:
 */
 class TexturedBumpPhongShader : public TexturedPhongShader
 {
-protected:
-	Point m_position;
 public:
-    Point vert0, vert1, vert2; // our vertices to calculate pertubed normal
-    float2 tex0, tex1, tex2; // texture coordinates of those vertices
-
 	SmartPtr<Texture> bumpTexture;
     float bumpIntensity;
 	float reflCoef;
 
-	virtual void setPosition(const Point& _point)
-	{
-	    m_position = _point;
-    }
-
-	virtual void setNormal(const Vector& _normal)
-	{
-	    m_normal = ~_normal;
-	}
-
-	virtual Vector getNormal() const
+	// the perturbed normal, from the vertices of the face and their
+	// texture coordinates
+	static Vector kernelNormal(const TexturedBumpPhongShader &_shader, const HitAttributes &_attr)
     {
-        Vector ret = m_normal;
+        Vector normal = ~_attr.normal;
+        Vector ret = normal;
         Vector heightNormal;
 
         // get normal from height map if supported
-        if (bumpTexture.data() == NULL) {
+        if (_shader.bumpTexture.data() == NULL) {
             std::cout << "booh! missing bump texture." << std::endl;
             return ret; // no bmp texture, return interpolated face normal
         }
         else {
             // ask texture for normal
-            heightNormal = bumpTexture->sampleBumpTexture(m_texCoord); // magic
+            heightNormal = _shader.bumpTexture->sampleBumpTexture(_attr.texCoord); // magic
         }
 
         /*
@@ -280,14 +586,14 @@ public:
 		// differences in texture coordinates
 		// we need y-axis and determinant of matrix
 		// for calculating the tangent.
-		float du1 = tex0.x - tex2.x;
-		float du2 = tex1.x - tex2.x;
-		float dv1 = tex0.y - tex2.y;
-		float dv2 = tex1.y - tex2.y;
+		float du1 = _attr.tex1.x - _attr.tex3.x;
+		float du2 = _attr.tex2.x - _attr.tex3.x;
+		float dv1 = _attr.tex1.y - _attr.tex3.y;
+		float dv2 = _attr.tex2.y - _attr.tex3.y;
 
 		// face basis vectors to calculate orthogonal later
-		Vector dp1 = vert0 - vert2;
-		Vector dp2 = vert1 - vert2;
+		Vector dp1 = _attr.v1 - _attr.v3;
+		Vector dp2 = _attr.v2 - _attr.v3;
 
 		// determinant
 		float det = du1 * dv2 - dv1 * du2;
@@ -295,46 +601,44 @@ public:
 		{
 			float inv_det = 1.0f / det;
 			tang = ~(inv_det * ( dv2 * dp1 - dv1 * dp2));
-			binorm = m_normal % tang; // binormal can be calculated by cross product of face normal and tangent, noth vectors are normalized already
+			binorm = normal % tang; // binormal can be calculated by cross product of face normal and tangent, noth vectors are normalized already
             //binorm = ~(inv_det * (-du2 * dp1 + du1 * dp2));
 		} else
             return ret;
 
 		// get our new normal in object space
 		// by rotating it
-		ret = ~(m_normal + bumpIntensity * (heightNormal.x * tang + heightNormal.y * binorm));
+		ret = ~(normal + _shader.bumpIntensity * (heightNormal.x * tang + heightNormal.y * binorm));
 
         return ret;
     }
 
-    virtual void setVertices(const Point& _v1, const Point& _v2, const Point& _v3)
-    {
-        vert0 = _v1;
-        vert1 = _v2;
-        vert2 = _v3;
-    }
-
-	virtual void setTexels(float2 _tex1, float2 _tex2, float2 _tex3)
+	template<class ta_hit>
+	static float4 kernelIndirectRadiance(const TexturedBumpPhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, Integrator *_integrator)
 	{
-        tex0 = _tex1;
-        tex1 = _tex2;
-        tex2 = _tex3;
+		return kernelTraceSecondaryRays(_shader, _hit, _out, _integrator);
 	}
 
+	template<class ta_hit>
+	static bool kernelSecondaryRays(const TexturedBumpPhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, float _refractionIndex, SecondaryRays &_rays)
+	{
+		addReflectedRay(_hit, _out, _shader.reflCoef, _rays);
+		return true;
+	}
+
+	virtual Vector computeNormal() const { return kernelNormal(*this, m_attr); }
 
 	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const
 	{
-		Ray r;
-		r.o = m_position;
-
-		Vector n = getNormal();
-		Vector v = n * fabs(n * _out);
-		r.d = _out + 2 * (v - _out);
-
-		return _integrator->getRadiance(r) * float4::rep(reflCoef);
+		return traceSecondaryRays(_out, _integrator);
 	}
 
-	virtual void setTextureCoord(const float2& _texCoord) { m_texCoord = _texCoord;}
+	virtual bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const
+	{
+		return kernelSecondaryRays(*this, *this, _out, _refractionIndex, _rays);
+	}
 
 	_IMPLEMENT_CLONE(TexturedBumpPhongShader);
 
@@ -345,36 +649,35 @@ public:
 // using snell's law and fresnel formula
 class RefractivePhongShader : public DefaultPhongShader
 {
-protected:
-	float2 m_texCoord;
-	Point m_position;
-
 public:
 	float4 transparency;
 	float refractionIndex;
 
-	virtual void setPosition(const Point& _point) { m_position = _point; }
+    virtual bool isTransparent() const { return true; };
 
-	virtual Vector getNormal() const
+	template<class ta_hit>
+	static float4 kernelIndirectRadiance(const RefractivePhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, Integrator *_integrator)
 	{
-		return m_normal;
+		return kernelTraceSecondaryRays(_shader, _hit, _out, _integrator);
 	}
 
-    virtual bool isTransparent() const { return true; };
-
-	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const
+	template<class ta_hit>
+	static bool kernelSecondaryRays(const RefractivePhongShader &_shader, const ta_hit &_hit,
+		const Vector &_out, float _refractionIndex, SecondaryRays &_rays)
 	{
+		const HitAttributes &attr = _hit.hitAttributes();
 		Ray refl,refr; // outgoing reflection + refraction rays
-        float refractionLast = _integrator->getCurrentRefractionIndex(); // refraction index of last material
-        float refractionCur = refractionIndex; // refraction index of current material
+        float refractionLast = _refractionIndex; // refraction index of last material
+        float refractionCur = _shader.refractionIndex; // refraction index of current material
         float refractionRatio, cosThetaIn, cosThetaOut;
-        Vector n = getNormal(); // current normal
+        Vector n = _hit.getNormal(); // current normal
         Vector tangentIn, tangentOut;
         Vector out = ~_out; // normalize!
 
         // new ray starting positions
-		refl.o = m_position;
-		refr.o = m_position;
+		refl.o = attr.position;
+		refr.o = attr.position;
 
         // set refraction indices
 		refl.curRefractionIndex = refractionLast;
@@ -418,13 +721,16 @@ public:
         float sinSquare = 1.f- (refractionRatio*refractionRatio) * (1-cosThetaIn*cosThetaIn);
         //float sinSquare = (refractionRatio*refractionRatio) * (1-cosThetaIn*cosThetaIn);
 
+        setReflectedDifferentials(attr, refl, n, _out);
+
 		// check total internal reflection
         if (sinSquare < 0) {
         //if (sinSquare > 1) {
             //std::cout << "Last refr: " << refractionLast << " Cur refr: " << refractionCur << std::endl;
             //std::cout << "cosThetaIn: " << cosThetaIn << std::endl;
             //std::cout << "sinSquare: " << sinSquare << std::endl;
-            return _integrator->getRadiance(refl); // only reflection!
+            _rays.add(refl, float4::rep(1.0f), SecondaryRays::ST_Reflection);
+            return true; // only reflection!
         }
 
         Vector normalCompOut = (-sqrtf(sinSquare)) * n;
@@ -433,6 +739,7 @@ public:
 
         // direction of refracted ray (using Snell's law)
 		refr.d = tangentOut + normalCompOut;
+        setRefractedDifferentials(attr, refr, n, _out, refractionRatio);
         refr.o = refr.o + Primitive::INTEPS() * refr.d;
 
         // FRESNEL ORSMNSESS
@@ -444,18 +751,43 @@ public:
 
         float np = (sPolarized+pPolarized) * 0.5f; // unpolarized light (average)
 
-		float4 reflectionRadiance = _integrator->getRadiance(refl);
-        float4 refractionRadiance = _integrator->getRadiance(refr);
-
         //std::cout <<  "refr: " << 1.0f-np << " refl: " << np << std::endl;
 
 		if (np < 0.005f) // if reflectance is smaller then 0,5%, ignore the reflection ray.
 		{
 		    //std::cout << "reflectance too low: " << np << std::endl;
-		    return refractionRadiance;
+		    _rays.add(refr, float4::rep(1.0f), SecondaryRays::ST_Refraction);
 		} else {
-            return refractionRadiance * float4::rep(1.0f-np) + float4::rep(np) * reflectionRadiance; // reflectance + refraction = 1.0
+            _rays.add(refr, float4::rep(1.0f-np), SecondaryRays::ST_Refraction);
+            _rays.add(refl, float4::rep(np), SecondaryRays::ST_Reflection); // reflectance + refraction = 1.0
 		}
+		return true;
+	}
+
+	template<class ta_hit>
+	static float4 kernelReflectance(const RefractivePhongShader &_shader, const ta_hit &_hit,
+		const Vector &_outDir, const Vector &_inDir)
+	{
+	    // no reflectance (fresnel will handle it)
+		return float4(0,0,0,1);
+	}
+
+	template<class ta_hit>
+	static float4 kernelTransparency(const RefractivePhongShader &_shader, const ta_hit &_hit,
+		ShadowRay &_in, Integrator *_integrator)
+	{
+	    //std::cout << "setting transp, hits: " << _in.hitCounts << std::endl;
+	    return _shader.transparency * _integrator->getShadow(_in);
+	}
+
+	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const
+	{
+		return traceSecondaryRays(_out, _integrator);
+	}
+
+	virtual bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const
+	{
+		return kernelSecondaryRays(*this, *this, _out, _refractionIndex, _rays);
 	}
 
     // information for the photon tracing
@@ -480,8 +812,8 @@ public:
         Vector out = ~_out; // normalize!
 
         // new ray starting positions
-		refl.o = m_position;
-		refr.o = m_position;
+		refl.o = m_attr.position;
+		refr.o = m_attr.position;
 
         // set refraction indices
 		refl.curRefractionIndex = refractionLast;
@@ -548,19 +880,14 @@ public:
 
     virtual float4 getReflectance(const Vector &_outDir, const Vector &_inDir) const
 	{
-	    // no reflectance (fresnel will handle it)
-		return float4(0,0,0,1);
+		return kernelReflectance(*this, *this, _outDir, _inDir);
 	}
 
 	virtual float4 getTransparency(ShadowRay &_in, Integrator *_integrator) const
 	{
-	    //std::cout << "setting transp, hits: " << _in.hitCounts << std::endl;
-	    return transparency * _integrator->getShadow(_in);
+		return kernelTransparency(*this, *this, _in, _integrator);
 	}
 
-
-	virtual void setTextureCoord(const float2& _texCoord) { m_texCoord = _texCoord;}
-
 	_IMPLEMENT_CLONE(RefractivePhongShader);
 
 };
@@ -581,30 +908,20 @@ public:
         bumpIntensity = proceduralTexture->bumpIntensity;
     }
 
-    virtual Vector getNormal() const
+    virtual Vector computeNormal() const
     {
+        Vector normal = DefaultPhongShader::computeNormal();
         if (proceduralTexture.data() == NULL) // woops, missing texture!
-            return m_normal;
+            return normal;
         if (bumpIntensity == 0) // nothing to do here
-            return m_normal;
+            return normal;
+
+        // variation of the bump texture in all three dimensions. It used
+        // to be probed as f(p - EPSILON) - f(p + EPSILON) on each axis,
+        // which is -2 * EPSILON times the gradient
+        Vector dif = (-2.f * EPSILON) * proceduralTexture->sampleBumpGradient(m_attr.position, getFootprint());
 
-        // probe differences in all three dimensions
-        // x-axis of sample is sufficient, because texture will only
-        // return grey values.
-        float bumpNeighborX1 = proceduralTexture->sampleBumpTexture(Point(m_position.x-EPSILON,m_position.y,m_position.z))[0];
-        float bumpNeighborX2 = proceduralTexture->sampleBumpTexture(Point(m_position.x+EPSILON,m_position.y,m_position.z))[0];
-        float bumpNeighborY1 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y-EPSILON,m_position.z))[0];
-        float bumpNeighborY2 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y+EPSILON,m_position.z))[0];
-        float bumpNeighborZ1 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y,m_position.z-EPSILON))[0];
-        float bumpNeighborZ2 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y,m_position.z+EPSILON))[0];
-
-        // compute variation on x and y axis
-        float du = bumpNeighborX1 - bumpNeighborX2;
-        float dv = bumpNeighborY1 - bumpNeighborY2;
-        float dg = bumpNeighborZ1 - bumpNeighborZ2;
-
-        Vector dif(du,dv,dg);
-        return ~(m_normal-(bumpIntensity*dif));
+        return ~(normal-(bumpIntensity*dif));
 	}
 
 	_IMPLEMENT_CLONE(ProceduralRefractiveBumpShader);
@@ -619,7 +936,6 @@ class ProceduralBumpShader : public DefaultPhongShader
 {
 protected:
     SmartPtr<ProceduralTexture> proceduralTexture;
-    Point m_position;
     float bumpIntensity;
 
 public:
@@ -634,57 +950,44 @@ public:
         bumpIntensity = proceduralTexture->bumpIntensity;
     }
 
-    virtual void setPosition(const Point& _point)
-    {
-        m_position = _point;
-    }
-
     // normal calculation from 3D textures.
     //
     // [References]
     // - http://digitalerr0r.wordpress.com/2011/05/18/xna-shader-programming-tutorial-26-bump-mapping-perlin-noise/
     // - http://www.codermind.com/articles/Raytracer-in-C++-Part-III-Textures.html
     // - http://http.developer.nvidia.com/GPUGems/gpugems_ch05.html
-    virtual Vector getNormal() const
+    static Vector kernelNormal(const ProceduralBumpShader &_shader, const HitAttributes &_attr)
     {
-        if (proceduralTexture.data() == NULL) // woops, missing texture!
-            return m_normal;
-        if (bumpIntensity == 0) // nothing to do here
-            return m_normal;
-
-        // probe differences in all three dimensions
-        // x-axis of sample is sufficient, because texture will only
-        // return grey values.
-        float bumpNeighborX1 = proceduralTexture->sampleBumpTexture(Point(m_position.x-EPSILON,m_position.y,m_position.z))[0];
-        float bumpNeighborX2 = proceduralTexture->sampleBumpTexture(Point(m_position.x+EPSILON,m_position.y,m_position.z))[0];
-        float bumpNeighborY1 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y-EPSILON,m_position.z))[0];
-        float bumpNeighborY2 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y+EPSILON,m_position.z))[0];
-        float bumpNeighborZ1 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y,m_position.z-EPSILON))[0];
-        float bumpNeighborZ2 = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y,m_position.z+EPSILON))[0];
-
-        // compute variation on x and y axis
-        float du = bumpNeighborX1 - bumpNeighborX2;
-        float dv = bumpNeighborY1 - bumpNeighborY2;
-        float dg = bumpNeighborZ1 - bumpNeighborZ2;
-
-        /*
-        float4 t = float4(1.f,0,0,du);
-        float4 b = float4(0,1.f,0,dv);
-        float4 a = float4(0,0,1.f,dg);
-        */
-
-        Vector dif(du,dv,dg);
-        return ~(m_normal-(bumpIntensity*dif));
+        Vector normal = ~_attr.normal;
+        if (_shader.proceduralTexture.data() == NULL) // woops, missing texture!
+            return normal;
+        if (_shader.bumpIntensity == 0) // nothing to do here
+            return normal;
+
+        // variation of the bump texture in all three dimensions. It used
+        // to be probed as f(p - EPSILON) - f(p + EPSILON) on each axis,
+        // which is -2 * EPSILON times the gradient
+        Vector dif = (-2.f * EPSILON) * _shader.proceduralTexture->sampleBumpGradient(_attr.position, getFootprint(_attr));
+
+        return ~(normal-(_shader.bumpIntensity*dif));
     }
 
-    virtual void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+    static void kernelCoeff(const ProceduralBumpShader &_shader, const HitAttributes &_attr,
+        float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent)
     {
         // get default shading
-        DefaultPhongShader::getCoeff(_diffuseCoef, _specularCoef, _specularExponent);
+        DefaultPhongShader::kernelCoeff(_shader, _attr, _diffuseCoef, _specularCoef, _specularExponent);
 
         // overwrite diffuse part
-        if (proceduralTexture.data() != NULL)
-            _diffuseCoef = proceduralTexture->sampleTexture(m_position);
+        if (_shader.proceduralTexture.data() != NULL)
+            _diffuseCoef = _shader.proceduralTexture->sampleTexture(_attr.position, getFootprint(_attr));
+    }
+
+    virtual Vector computeNormal() const { return kernelNormal(*this, m_attr); }
+
+    virtual void computeCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+    {
+        kernelCoeff(*this, m_attr, _diffuseCoef, _specularCoef, _specularExponent);
     }
 
     _IMPLEMENT_CLONE(ProceduralBumpShader);
@@ -703,12 +1006,13 @@ public:
     ProceduralHardBumpShader(SmartPtr<ProceduralTexture> _procTex)
     : ProceduralBumpShader(_procTex) {}
 
-    virtual Vector getNormal() const
+    virtual Vector computeNormal() const
     {
+        Vector normal = DefaultPhongShader::computeNormal();
         if (proceduralTexture.data() == NULL) // woops, missing texture!
-            return m_normal;
+            return normal;
         if (bumpIntensity == 0) // nothing to do here
-            return m_normal;
+            return normal;
 
         /*
         // get surrounding texture to calculate difference
@@ -718,28 +1022,16 @@ public:
         noiseCoef[2] = proceduralTexture->sampleBumpTexture(Point(m_position.z,m_position.x,m_position.y))[0];
         */
 
-        float4 noiseCoef;
-
-        // take samples to approximate the gradient
-        // vector of our noise function at (x, y, z)
-        noiseCoef[0] = proceduralTexture->sampleBumpTexture(m_position)[0];
-        noiseCoef[1] = proceduralTexture->sampleBumpTexture(Point(m_position.x+EPSILON,m_position.y,m_position.z))[0];
-        noiseCoef[2] = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y+EPSILON,m_position.z))[0];
-        noiseCoef[3] = proceduralTexture->sampleBumpTexture(Point(m_position.x,m_position.y,m_position.z+EPSILON))[0];
-
-        // approc. gradient vector
-        Vector gradient;
-        gradient[0] = (noiseCoef[1]-noiseCoef[0]) / EPSILON;
-        gradient[1] = (noiseCoef[2]-noiseCoef[0]) / EPSILON;
-        gradient[2] = (noiseCoef[3]-noiseCoef[0]) / EPSILON;
+        // gradient vector of our noise function at (x, y, z)
+        Vector gradient = proceduralTexture->sampleBumpGradient(m_attr.position, getFootprint());
 
         float temp = gradient*gradient;
 
         if (fabsf(temp) > 0.000001f) // shouldn't be 0
 		{
-            return ~(m_normal-(bumpIntensity*gradient));
+            return ~(normal-(bumpIntensity*gradient));
 		} else {
-            return m_normal;
+            return normal;
 		}
     }
 
@@ -757,7 +1049,7 @@ public:
     float lift;
 
 
-    virtual void getCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
+    virtual void computeCoeff(float4 &_diffuseCoef, float4 &_specularCoef, float &_specularExponent) const
       {  // Function returns generated diffuse coefficient and given specular parameters
         float noiseCoefx =
         float(PerlinNoise::noise(frequency* double(m_position.x),
@@ -766,7 +1058,7 @@ public:
 
        // diffuseCoeff = float4::rep(PerlinNoise::noise(m_position.x, m_position.y, m_position.z)) * lightColor + float4::rep(swirlDistance) * darkColor;
 
-            DefaultPhongShader::getCoeff(_diffuseCoef, _specularCoef, _specularExponent);
+            DefaultPhongShader::computeCoeff(_diffuseCoef, _specularCoef, _specularExponent);
         //std::cout << noiseCoefx << std::endl;
 
             _diffuseCoef = float4::rep(noiseCoefx+lift) ;//float4(noiseCoefx,noiseCoefy,noiseCoefz,1);
@@ -775,7 +1067,7 @@ public:
 
 
 
-	virtual Vector getNormal() const
+	virtual Vector computeNormal() const
 	{
 	    return m_normal;
         Vector noiseCoef;
@@ -825,4 +1117,36 @@ public:
 };
 */
 
+//Shades with the static kernels of ta_shader, which read the hit from
+//	_attr and the parameters from the material itself
+template<class ta_shader, class ta_op>
+float4 runShaderKernel(const PluggableShader &_material, const HitAttributes &_attr, ta_op &_op)
+{
+	return _op(StaticShaderCalls<ta_shader>(static_cast<const ta_shader&>(_material), _attr));
+}
+
+//Calls _op with the shader of a hit with the material _material. The
+//	material type is dispatched once per hit: materials with a kernel
+//	are shaded by runShaderKernel without any allocation, the others are
+//	cloned and called through the vtable. _op is a functor, which takes
+//	StaticShaderCalls<...> or VirtualShaderCalls and returns a float4
+template<class ta_op>
+float4 visitShaderKernel(const PluggableShader &_material, const HitAttributes &_attr, ta_op &_op)
+{
+	switch(_material.kernelId())
+	{
+	case SK_DefaultPhong: return runShaderKernel<DefaultPhongShader>(_material, _attr, _op);
+	case SK_TexturedPhong: return runShaderKernel<TexturedPhongShader>(_material, _attr, _op);
+	case SK_TexturedBumpPhong: return runShaderKernel<TexturedBumpPhongShader>(_material, _attr, _op);
+	case SK_MirrorPhong: return runShaderKernel<MirrorPhongShader>(_material, _attr, _op);
+	case SK_RefractivePhong: return runShaderKernel<RefractivePhongShader>(_material, _attr, _op);
+	case SK_ProceduralBump: return runShaderKernel<ProceduralBumpShader>(_material, _attr, _op);
+	default:
+		{
+			SmartPtr<Shader> shader = createHitShader(&_material, _attr);
+			return _op(VirtualShaderCalls(*shader));
+		}
+	}
+}
+
 #endif //__INCLUDE_GUARD_810F2AF5_7E81_4F1E_AA05_992B6D2C0016
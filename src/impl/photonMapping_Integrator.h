@@ -36,7 +36,7 @@ public:
     float curRefractionIndex;
 	int totalNumberOfPhotons;
 
-	PhotonMap_Integrator()
+	PhotonMap_Integrator() : scene(NULL)
 	{
 		totalNumberOfPhotons = PHOTON_NUM;
 		photonMap = createPhotonMap(totalNumberOfPhotons);
@@ -49,10 +49,15 @@ public:
         return curRefractionIndex;
     }
 
+	virtual size_t getPrimitiveCount() const
+	{
+		return scene != NULL ? scene->primitives.size() : 0;
+	}
+
 	virtual void start_photonmapping()
 	{
 	    Random::init((unsigned)42);
-        const clock_t begin_time = clock(); // for building time measurement for debug output
+        TraceSpan span("photon mapping"); // for building time measurement for debug output
 
         for(int i=0;i<256;i++)
         {
@@ -68,13 +73,14 @@ public:
 
         std::cout << "Arrr, " << totalNumberOfPhotons << " photons be fired!" << std::endl;
         std::cout << "The lot of 'em photons " << balancedPhotonMap->stored_photons << " and in the brigg as well " << balancedCausticMap->stored_photons << " caustic landlubbers!" << std::endl;
-        std::cout << "Arrdventure took " << float(clock()-begin_time)/CLOCKS_PER_SEC << " shots 'o rum!" << std::endl;
+        std::cout << "Arrdventure took " << span.end() << " shots 'o rum!" << std::endl;
         //abort();
     }
 
 	//get radiance is the same as in integrator plus considering irradiance
 	virtual float4 getRadiance(const Ray &_ray)
 	{
+		PathArena::Scope arenaScope;
 		state.value<DepthStateKey>()++;
 
 		float4 col = float4::rep(0); // storing the color
@@ -181,6 +187,7 @@ private:
 	//the photons are equali distributet, but random
 	void shootPhotons()
 	{
+		TraceSpan shootSpan("shoot photons");
 		int photonsLeftToShoot = totalNumberOfPhotons;
 		int photonsPerLightsource = totalNumberOfPhotons / lightSources.size();
 
@@ -202,6 +209,9 @@ private:
 			}
 		}
 
+		shootSpan.end();
+
+		TraceSpan balanceSpan("balance photon maps");
 		balancedPhotonMap = balancePhotonMap(photonMap);
 		balancedCausticMap = balancePhotonMap(causticMap);
 	}
@@ -218,6 +228,7 @@ private:
 
 		if(weight >0.2 && state.value<DepthStateKey>() < 5)
 		{
+			_STAT_INC(SC_PhotonRays);
 			Primitive::IntRet ret = scene->intersect(ray, FLT_MAX);
 			if(ret.distance < FLT_MAX && ret.distance >= Primitive::INTEPS())
 			{
@@ -372,6 +383,7 @@ private:
 	bool visibleLS(const Point& _pt, const Point& _pls)
 	{
 		Ray r; r.o = _pt; r.d = _pls - _pt;
+		_STAT_INC(SC_ShadowRays);
 		Primitive::IntRet ret = scene->intersect(r, 1.1f);
 		return ret.distance <= Primitive::INTEPS() || ret.distance >= 1 - Primitive::INTEPS();
 	}
@@ -6,38 +6,95 @@
 
 
 #include "../rt/renderer.h"
+#include "sobol.h"
 
-//The default sampler which samples a pixel with a ray through it's center
+//The radical inverse of _num in base _radix, which is the _num-th
+//	point of the van der Corput sequence in that base
+inline float inverseRadical(uint _num, uint _radix)
+{
+	float ret = 0;
+	float curRadix = (float)_radix;
+
+	while(_num != 0)
+	{
+		ret += (float)(_num % _radix) / curRadix;
+		_num /= _radix;
+		curRadix *= (float)_radix;
+	}
+
+	return ret;
+}
+
+//Adds _shift to _value, wrapping around at 1. The deterministic
+//	samplers shift their points by the van der Corput point of the
+//	round, so that every round gives different points and round 0
+//	gives the unshifted ones
+inline float shiftWrapped(float _value, float _shift)
+{
+	float ret = _value + _shift;
+	return ret >= 1.f ? ret - 1.f : ret;
+}
+
+//The default sampler which samples a pixel with a ray through it's center.
+//	The later rounds of adaptive sampling move the ray away from the center
 struct DefaultSampler : public Sampler
 {
 	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result)
+	{
+		getRoundSamples(_x, _y, 0, _result);
+	}
+
+	virtual void getRoundSamples(uint _x, uint _y, uint _round, std::vector<Sample> &_result)
 	{
 		Sample s;
-		s.position = float2(0.5f, 0.5f);
+		s.position = float2(shiftWrapped(0.5f, inverseRadical(_round, 2)), shiftWrapped(0.5f, inverseRadical(_round, 3)));
 		s.weight = 1.f;
+		s.lens = float2(shiftWrapped(0.5f, inverseRadical(_round, 5)), shiftWrapped(0.5f, inverseRadical(_round, 7)));
 		_result.push_back(s);
 	}
 
 };
 
 
+//Samples the centers of a grid of samplesX x samplesY cells. The later
+//	rounds of adaptive sampling move the samples by the same offset
+//	within their cells
 struct RegularSampler : public Sampler
 {
 	uint samplesX, samplesY;
 
 	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result)
 	{
+		getRoundSamples(_x, _y, 0, _result);
+	}
+
+	virtual void getRoundSamples(uint _x, uint _y, uint _round, std::vector<Sample> &_result)
+	{
+		float2 offset = float2(shiftWrapped(0.5f, inverseRadical(_round, 2)), shiftWrapped(0.5f, inverseRadical(_round, 3)));
+		float2 lensShift = float2(inverseRadical(_round, 5), inverseRadical(_round, 7));
+
 		for(uint x = 0; x < samplesX; x++)
 			for(uint y = 0; y < samplesY; y++)
 			{
 				float2 pos = float2((float)(x), (float)(y));
-				pos = (pos + float2(0.5, 0.5)) / float2((float)samplesX, (float)samplesY);
+				pos = (pos + offset) / float2((float)samplesX, (float)samplesY);
 				Sample s;
 				s.position = pos;
 				s.weight = 1.f / (float)(samplesX * samplesY);
+				// the lens positions are not on a grid, so that they are
+				//	not correlated with the positions in the pixel
+				s.lens = float2(
+					shiftWrapped(inverseRadical(x * samplesY + y, 2), lensShift.x),
+					shiftWrapped(inverseRadical(x * samplesY + y, 3), lensShift.y));
 				_result.push_back(s);
 			}
 	}
+
+	virtual void hashSettings(SettingsHash &_hash) const
+	{
+		_hash.add(samplesX);
+		_hash.add(samplesY);
+	}
 };
 
 struct RandomSampler : public Sampler
@@ -51,9 +108,16 @@ struct RandomSampler : public Sampler
 			s.position.x = ((float)rand()) / (float)RAND_MAX;
 			s.position.y = ((float)rand()) / (float)RAND_MAX;
 			s.weight = 1.f / (float)sampleCount;
+			s.lens.x = ((float)rand()) / (float)RAND_MAX;
+			s.lens.y = ((float)rand()) / (float)RAND_MAX;
 			_result.push_back(s);
 		}
 	}
+
+	virtual void hashSettings(SettingsHash &_hash) const
+	{
+		_hash.add(sampleCount);
+	}
 };
 
 struct StratifiedSampler : public Sampler
@@ -61,6 +125,8 @@ struct StratifiedSampler : public Sampler
 	uint samplesX, samplesY;
 	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result)
 	{
+		size_t first = _result.size();
+
 		for(uint x = 0; x < samplesX; x++)
 			for(uint y = 0; y < samplesY; y++)
 			{
@@ -72,48 +138,108 @@ struct StratifiedSampler : public Sampler
 				Sample s;
 				s.position = pos;
 				s.weight = 1.f / (float)(samplesX * samplesY);
+				float2 lensOffset = float2(((float)rand()) / (float)RAND_MAX, ((float)rand()) / (float)RAND_MAX);
+				s.lens = (float2((float)(x), (float)(y)) + lensOffset) / float2((float)samplesX, (float)samplesY);
 
 				_result.push_back(s);
 			}
+
+		// the lens positions are stratified in the same way, shuffle them
+		//	so that they are not correlated with the positions in the pixel
+		for(size_t i = _result.size() - first; i > 1; i--)
+			std::swap(_result[first + i - 1].lens, _result[first + (size_t)rand() % i].lens);
+	}
+
+	virtual void hashSettings(SettingsHash &_hash) const
+	{
+		_hash.add(samplesX);
+		_hash.add(samplesY);
 	}
 };
 
 
+//The dimensions of a sample are the dimensions of one halton
+//	sequence: base 2 and 3 for the pixel and 5 and 7 for the lens
 class HaltonSampleGenerator : public Sampler
 {
-	float inverseRadical(uint _num, uint _radix)
+public:
+
+	size_t sampleCount;
+
+	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result)
 	{
-		float ret = 0;
-		float curRadix = (float)_radix;
+		static _THREAD_LOCAL uint cur = 0;
 
-		while(_num != 0)
+		for(size_t i = 0; i < sampleCount; i++)
 		{
-			ret += (float)(_num % _radix) / curRadix;
-			_num /= _radix;
-			curRadix *= (float)_radix;
+			Sample s;
+			s.position.x = inverseRadical(cur, 2);
+			s.position.y = inverseRadical(cur, 3);
+			s.lens.x = inverseRadical(cur, 5);
+			s.lens.y = inverseRadical(cur++, 7);
+			s.weight = 1 / (float)sampleCount;
+			_result.push_back(s);
 		}
+	}
 
-		return ret;
-
+	virtual void hashSettings(SettingsHash &_hash) const
+	{
+		_hash.add((uint)sampleCount);
 	}
+};
 
+//A sampler using the sobol sequence: dimensions 0 and 1 for the pixel
+//	and 2 and 3 for the lens. Each pixel gets its own owen scrambling
+//	and order of the points, derived from the pixel coordinates and
+//	seed, so the samples do not depend on the order of the pixels.
+//	Powers of two for sampleCount give the best stratification
+class SobolSampler : public Sampler
+{
 public:
+	uint sampleCount;
+	uint seed;
 
-	size_t sampleCount;
+	SobolSampler() : sampleCount(16), seed(0) {}
 
 	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result)
 	{
-		static _THREAD_LOCAL uint cur = 0;
+		getRoundSamples(_x, _y, 0, _result);
+	}
 
-		for(size_t i = 0; i < sampleCount; i++)
+	//The rounds are the following blocks of sampleCount points
+	//	of the sequence of the pixel
+	virtual void getRoundSamples(uint _x, uint _y, uint _round, std::vector<Sample> &_result)
+	{
+		uint pixelSeed = SobolSequence::hash(seed ^ SobolSequence::hash(_x ^ SobolSequence::hash(_y)));
+
+		for(uint i = _round * sampleCount; i < (_round + 1) * sampleCount; i++)
 		{
+			// the scrambled index of a point in an aligned block of
+			//	points is in an aligned block of the same size
+			uint index = SobolSequence::scramble(i, pixelSeed);
+
 			Sample s;
-			s.position.x = inverseRadical(cur, 2);
-			s.position.y = inverseRadical(cur++, 3);
-			s.weight = 1 / (float)sampleCount;
+			s.position.x = getDimension(index, 0, pixelSeed);
+			s.position.y = getDimension(index, 1, pixelSeed);
+			s.lens.x = getDimension(index, 2, pixelSeed);
+			s.lens.y = getDimension(index, 3, pixelSeed);
+			s.weight = 1.f / (float)sampleCount;
 			_result.push_back(s);
 		}
 	}
+
+	virtual void hashSettings(SettingsHash &_hash) const
+	{
+		_hash.add(sampleCount);
+		_hash.add(seed);
+	}
+
+private:
+	static float getDimension(uint _index, uint _dim, uint _pixelSeed)
+	{
+		uint seed = SobolSequence::hash(_pixelSeed + _dim);
+		return SobolSequence::toFloat(SobolSequence::scramble(SobolSequence::sample(_index, _dim), seed));
+	}
 };
 
 #endif //__INCLUDE_GUARD_EA5235C2_ADC9_40B5_9859_473C44497D3A
@@ -0,0 +1,166 @@
+#ifndef __INCLUDE_GUARD_2A77293F_DEED_4BAE_BD48_2E797678EAD6
+#define __INCLUDE_GUARD_2A77293F_DEED_4BAE_BD48_2E797678EAD6
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "../core/defs.h"
+
+#define _SOBOL_DIMENSIONS 8
+
+//The sobol sequence in base 2, with owen scrambling. The direction
+//	numbers of the first dimensions are the ones of Joe and Kuo
+//	(new-joe-kuo-6.21201), expanded to one 32 bit matrix per dimension.
+//	The scrambling follows Burley, "Practical Hash-based Owen Scrambling"
+class SobolSequence
+{
+public:
+
+	//The _index-th point of the sequence in dimension _dim as a 32 bit
+	//	fixed point number in [0, 1)
+	static uint sample(uint _index, uint _dim)
+	{
+		_ASSERT(_dim < _SOBOL_DIMENSIONS);
+		const uint *m = matrices()[_dim];
+
+		uint ret = 0;
+		for(; _index != 0; _index >>= 1, m++)
+			if(_index & 1)
+				ret ^= *m;
+		return ret;
+	}
+
+	//Random permutation of _x, in which each bit only depends on
+	//	itself and the more significant bits. Applied to the points,
+	//	this keeps the stratification of the sequence
+	static uint scramble(uint _x, uint _seed)
+	{
+		_x = reverseBits(_x);
+		_x += _seed;
+		_x ^= _x * 0x6c50b47cu;
+		_x ^= _x * 0xb82f1e52u;
+		_x ^= _x * 0xc7afe638u;
+		_x ^= _x * 0x8d22f6e6u;
+		return reverseBits(_x);
+	}
+
+	//Integer hash, used to derive the seeds
+	static uint hash(uint _x)
+	{
+		_x ^= _x >> 16;
+		_x *= 0x7feb352du;
+		_x ^= _x >> 15;
+		_x *= 0x846ca68bu;
+		_x ^= _x >> 16;
+		return _x;
+	}
+
+	//Converts a 32 bit fixed point number to a float in [0, 1)
+	static float toFloat(uint _x)
+	{
+		return (float)(_x >> 8) * (1.f / 16777216.f);
+	}
+
+private:
+
+	static uint reverseBits(uint _x)
+	{
+		_x = (_x << 16) | (_x >> 16);
+		_x = ((_x & 0x00ff00ffu) << 8) | ((_x & 0xff00ff00u) >> 8);
+		_x = ((_x & 0x0f0f0f0fu) << 4) | ((_x & 0xf0f0f0f0u) >> 4);
+		_x = ((_x & 0x33333333u) << 2) | ((_x & 0xccccccccu) >> 2);
+		_x = ((_x & 0x55555555u) << 1) | ((_x & 0xaaaaaaaau) >> 1);
+		return _x;
+	}
+
+	//Row k of a matrix is the direction number for bit k of the index.
+	//	The first dimension is the van der Corput sequence
+	static const uint (*matrices())[32]
+	{
+		static const uint m[_SOBOL_DIMENSIONS][32] = {
+			{
+				0x80000000u, 0x40000000u, 0x20000000u, 0x10000000u,
+				0x08000000u, 0x04000000u, 0x02000000u, 0x01000000u,
+				0x00800000u, 0x00400000u, 0x00200000u, 0x00100000u,
+				0x00080000u, 0x00040000u, 0x00020000u, 0x00010000u,
+				0x00008000u, 0x00004000u, 0x00002000u, 0x00001000u,
+				0x00000800u, 0x00000400u, 0x00000200u, 0x00000100u,
+				0x00000080u, 0x00000040u, 0x00000020u, 0x00000010u,
+				0x00000008u, 0x00000004u, 0x00000002u, 0x00000001u
+			},
+			{
+				0x80000000u, 0xc0000000u, 0xa0000000u, 0xf0000000u,
+				0x88000000u, 0xcc000000u, 0xaa000000u, 0xff000000u,
+				0x80800000u, 0xc0c00000u, 0xa0a00000u, 0xf0f00000u,
+				0x88880000u, 0xcccc0000u, 0xaaaa0000u, 0xffff0000u,
+				0x80008000u, 0xc000c000u, 0xa000a000u, 0xf000f000u,
+				0x88008800u, 0xcc00cc00u, 0xaa00aa00u, 0xff00ff00u,
+				0x80808080u, 0xc0c0c0c0u, 0xa0a0a0a0u, 0xf0f0f0f0u,
+				0x88888888u, 0xccccccccu, 0xaaaaaaaau, 0xffffffffu
+			},
+			{
+				0x80000000u, 0xc0000000u, 0x60000000u, 0x90000000u,
+				0xe8000000u, 0x5c000000u, 0x8e000000u, 0xc5000000u,
+				0x68800000u, 0x9cc00000u, 0xee600000u, 0x55900000u,
+				0x80680000u, 0xc09c0000u, 0x60ee0000u, 0x90550000u,
+				0xe8808000u, 0x5cc0c000u, 0x8e606000u, 0xc5909000u,
+				0x6868e800u, 0x9c9c5c00u, 0xeeee8e00u, 0x5555c500u,
+				0x8000e880u, 0xc0005cc0u, 0x60008e60u, 0x9000c590u,
+				0xe8006868u, 0x5c009c9cu, 0x8e00eeeeu, 0xc5005555u
+			},
+			{
+				0x80000000u, 0xc0000000u, 0x20000000u, 0x50000000u,
+				0xf8000000u, 0x74000000u, 0xa2000000u, 0x93000000u,
+				0xd8800000u, 0x25400000u, 0x59e00000u, 0xe6d00000u,
+				0x78080000u, 0xb40c0000u, 0x82020000u, 0xc3050000u,
+				0x208f8000u, 0x51474000u, 0xfbea2000u, 0x75d93000u,
+				0xa0858800u, 0x914e5400u, 0xdbe79e00u, 0x25db6d00u,
+				0x58800080u, 0xe54000c0u, 0x79e00020u, 0xb6d00050u,
+				0x800800f8u, 0xc00c0074u, 0x200200a2u, 0x50050093u
+			},
+			{
+				0x80000000u, 0x40000000u, 0x20000000u, 0xb0000000u,
+				0xf8000000u, 0xdc000000u, 0x7a000000u, 0x9d000000u,
+				0x5a800000u, 0x2fc00000u, 0xa1600000u, 0xf0b00000u,
+				0xda880000u, 0x6fc40000u, 0x81620000u, 0x40bb0000u,
+				0x22878000u, 0xb3c9c000u, 0xfb65a000u, 0xddb2d000u,
+				0x78022800u, 0x9c0b3c00u, 0x5a0fb600u, 0x2d0ddb00u,
+				0xa2878080u, 0xf3c9c040u, 0xdb65a020u, 0x6db2d0b0u,
+				0x800228f8u, 0x400b3cdcu, 0x200fb67au, 0xb00ddb9du
+			},
+			{
+				0x80000000u, 0x40000000u, 0x60000000u, 0x30000000u,
+				0xc8000000u, 0x24000000u, 0x56000000u, 0xfb000000u,
+				0xe0800000u, 0x70400000u, 0xa8600000u, 0x14300000u,
+				0x9ec80000u, 0xdf240000u, 0xb6d60000u, 0x8bbb0000u,
+				0x48008000u, 0x64004000u, 0x36006000u, 0xcb003000u,
+				0x2880c800u, 0x54402400u, 0xfe605600u, 0xef30fb00u,
+				0x7e48e080u, 0xaf647040u, 0x1eb6a860u, 0x9f8b1430u,
+				0xd6c81ec8u, 0xbb249f24u, 0x80d6d6d6u, 0x40bbbbbbu
+			},
+			{
+				0x80000000u, 0xc0000000u, 0xa0000000u, 0xd0000000u,
+				0x58000000u, 0x94000000u, 0x3e000000u, 0xe3000000u,
+				0xbe800000u, 0x23c00000u, 0x1e200000u, 0xf3100000u,
+				0x46780000u, 0x67840000u, 0x78460000u, 0x84670000u,
+				0xc6788000u, 0xa784c000u, 0xd846a000u, 0x5467d000u,
+				0x9e78d800u, 0x33845400u, 0xe6469e00u, 0xb7673300u,
+				0x20f86680u, 0x104477c0u, 0xf8668020u, 0x4477c010u,
+				0x668020f8u, 0x77c01044u, 0x8020f866u, 0xc0104477u
+			},
+			{
+				0x80000000u, 0x40000000u, 0xa0000000u, 0x50000000u,
+				0x88000000u, 0x24000000u, 0x12000000u, 0x2d000000u,
+				0x76800000u, 0x9e400000u, 0x08200000u, 0x64100000u,
+				0xb2280000u, 0x7d140000u, 0xfea20000u, 0xba490000u,
+				0x1a248000u, 0x491b4000u, 0xc4b5a000u, 0xe3739000u,
+				0xf6800800u, 0xde400400u, 0xa8200a00u, 0x34100500u,
+				0x3a280880u, 0x59140240u, 0xeca20120u, 0x974902d0u,
+				0x6ca48768u, 0xd75b49e4u, 0xcc95a082u, 0x87639641u
+			}
+		};
+		return m;
+	}
+};
+
+#endif //__INCLUDE_GUARD_2A77293F_DEED_4BAE_BD48_2E797678EAD6
@@ -0,0 +1,433 @@
+#ifndef __INCLUDE_GUARD_1653922B_47E2_4B34_925B_DE500D356598
+#define __INCLUDE_GUARD_1653922B_47E2_4B34_925B_DE500D356598
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "../core/image.h"
+#include "../rt/renderer.h"
+#include "integrator.h"
+#include <algorithm>
+
+//A renderer, which traces the rays of a tile breadth first instead of
+//	recursively. All rays of a bounce are intersected in one go, the hits
+//	are shaded grouped by material and the shadow, reflection and refraction
+//	rays they spawn are collected in separate queues, which are sorted by
+//	origin and direction before they are traced.
+//The scene, the lights and the maximum recursion depth are taken from the
+//	integrator, so the images are the same as with Renderer and
+//	IntegratorImpl. The integrator also traces the rays of shaders that do
+//	not implement getSecondaryRays and the shadow rays through transparent
+//	surfaces.
+class WavefrontRenderer
+{
+public:
+	SmartPtr<Sampler> sampler;
+	SmartPtr<Camera> camera;
+	SmartPtr<IntegratorImpl> integrator;
+	SmartPtr<Image> target;
+
+	//Renders the image in tiles of _tileSize x _tileSize pixels
+	void render(int _tileSize)
+	{
+		for(int i = 0; i < WS_StageCount; i++)
+		{
+			m_stats[i].rays = 0;
+			m_stats[i].time = 0;
+		}
+		ShadingCacheStats::get().reset();
+
+		TraceSpan span("render wavefront");
+
+		int width = (int)target->width();
+		int height = (int)target->height();
+
+		for(int y = 0; y < height; y += _tileSize)
+		{
+			for(int x = 0; x < width; x += _tileSize)
+				renderTile(x, std::min(x + _tileSize, width), y, std::min(y + _tileSize, height));
+
+			std::cout << "Line: " << y << " Progress: " << y * 100 / height << " % " << "\r";
+		}
+
+		std::cout << "Time needed to render: " << span.end() << " s." << std::endl;
+		printStats();
+	}
+
+private:
+	enum Stage
+	{
+		WS_Primary,
+		WS_Reflection,
+		WS_Refraction,
+		WS_Shadow,
+		WS_Shading,
+		WS_StageCount
+	};
+
+	//A ray of a path, together with the weight of the radiance along it
+	//	in the pixel. depth counts like DepthStateKey: 1 for primary rays
+	struct PathRay
+	{
+		Ray ray;
+		float4 weight;
+		uint pixel;
+		int depth;
+	};
+
+	//A shadow ray towards a light source and the radiance, which reaches
+	//	the pixel if the light source is visible
+	struct ShadowQuery
+	{
+		Point origin;
+		Point lightSource;
+		float4 radiance;
+		uint pixel;
+	};
+
+	//A hit of a path ray. Hits of primitives without getMaterialHit have
+	//	no material, their shader is created from intRet
+	struct PathHit
+	{
+		uint ray;
+		float distance;
+		const PluggableShader *material;
+		HitAttributes attr;
+		Primitive::IntRet intRet;
+	};
+
+	//Rays (or hits for WS_Shading) processed and wall clock seconds
+	//	spent per stage
+	struct StageStats
+	{
+		ulong rays;
+		double time;
+	};
+
+	//Orders the hits by material, the hits of one material are shaded
+	//	one after another
+	struct MaterialOrder
+	{
+		const std::vector<PathHit> *hits;
+
+		bool operator()(uint _a, uint _b) const
+		{
+			return (*hits)[_a].material < (*hits)[_b].material;
+		}
+	};
+
+	//Runs shadeHit on the hit shaders through visitShaderKernel
+	struct ShadeOp
+	{
+		WavefrontRenderer *renderer;
+		const PathRay *path;
+		float distance;
+
+		template<class ta_calls>
+		float4 operator()(const ta_calls &_shader) const
+		{
+			renderer->shadeHit(_shader, *path, distance);
+			return float4::rep(0.f);
+		}
+	};
+
+	std::vector<PathRay> m_primary, m_reflected, m_refracted, m_current;
+	std::vector<ShadowQuery> m_shadows;
+	std::vector<PathHit> m_hits;
+	std::vector<uint> m_hitOrder;
+	std::vector<std::pair<uint, uint> > m_sortKeys;
+	std::vector<Sampler::Sample> m_samples;
+	std::vector<CameraSample> m_cameraSamples;
+	std::vector<Ray> m_rays;
+	std::vector<uint> m_samplePixels;
+
+	StageStats m_stats[WS_StageCount];
+
+	void renderTile(int _xStart, int _xEnd, int _yStart, int _yEnd)
+	{
+		std::ostringstream name;
+		name << "tile " << _xStart << ", " << _yStart;
+		TraceSpan span(name.str(), "tile");
+
+		double begin = Trace::now();
+
+		m_samples.clear();
+		m_cameraSamples.clear();
+		m_samplePixels.clear();
+		for(int y = _yStart; y < _yEnd; y++)
+			for(int x = _xStart; x < _xEnd; x++)
+			{
+				(*target)(x, y) = float4::rep(0.f);
+
+				size_t first = m_samples.size();
+				sampler->getSamples((uint)x, (uint)y, m_samples);
+
+				for(size_t i = first; i < m_samples.size(); i++)
+				{
+					CameraSample cs;
+					cs.image = float2(m_samples[i].position.x + x, m_samples[i].position.y + y);
+					cs.lens = m_samples[i].lens;
+					m_cameraSamples.push_back(cs);
+					m_samplePixels.push_back((uint)y * target->width() + (uint)x);
+				}
+			}
+
+		// the primary rays of the whole tile at once
+		uint raysPerSample = camera->getRaysPerSample();
+		m_rays.resize(m_cameraSamples.size() * raysPerSample);
+		_STAT_ADD(SC_PrimaryRays, m_rays.size());
+		if(!m_cameraSamples.empty())
+			camera->getPrimaryRays(&m_cameraSamples[0], (uint)m_cameraSamples.size(), &m_rays[0]);
+
+		m_primary.clear();
+		for(size_t i = 0; i < m_samples.size(); i++)
+		{
+			// the rays of a sample are averaged
+			float4 weight = float4::rep(m_samples[i].weight / raysPerSample);
+			for(uint j = 0; j < raysPerSample; j++)
+			{
+				PathRay path;
+				path.ray = m_rays[i * raysPerSample + j];
+				path.weight = weight;
+				path.pixel = m_samplePixels[i];
+				path.depth = 1;
+				m_primary.push_back(path);
+			}
+		}
+
+		m_stats[WS_Primary].time += Trace::now() - begin;
+
+		m_reflected.clear();
+		m_refracted.clear();
+		m_shadows.clear();
+
+		traceRays(m_primary, WS_Primary);
+		traceShadows();
+
+		// one bounce per iteration, the shaders fill the queues again
+		while(!m_reflected.empty() || !m_refracted.empty())
+		{
+			m_current.swap(m_reflected);
+			m_reflected.clear();
+			sortRays(m_current);
+			traceRays(m_current, WS_Reflection);
+
+			m_current.swap(m_refracted);
+			m_refracted.clear();
+			sortRays(m_current);
+			traceRays(m_current, WS_Refraction);
+
+			traceShadows();
+		}
+	}
+
+	//Intersects all rays of a queue and shades the hits
+	void traceRays(const std::vector<PathRay> &_rays, Stage _stage)
+	{
+		double begin = Trace::now();
+
+		m_hits.resize(_rays.size());
+		m_hitOrder.clear();
+
+		for(size_t i = 0; i < _rays.size(); i++)
+		{
+			PathHit &hit = m_hits[i];
+			hit.intRet = integrator->scene->intersect(_rays[i].ray, FLT_MAX);
+			if(hit.intRet.distance < FLT_MAX && hit.intRet.distance >= Primitive::INTEPS())
+			{
+				hit.ray = (uint)i;
+				hit.distance = hit.intRet.distance;
+				hit.attr = HitAttributes();
+				hit.material = integrator->scene->getMaterialHit(hit.intRet, hit.attr);
+				m_hitOrder.push_back((uint)i);
+			}
+		}
+
+		m_stats[_stage].rays += _rays.size();
+		m_stats[_stage].time += Trace::now() - begin;
+
+		begin = Trace::now();
+
+		MaterialOrder order = {&m_hits};
+		std::stable_sort(m_hitOrder.begin(), m_hitOrder.end(), order);
+
+		for(std::vector<uint>::const_iterator it = m_hitOrder.begin(); it != m_hitOrder.end(); it++)
+		{
+			const PathHit &hit = m_hits[*it];
+			ShadeOp op = {this, &_rays[hit.ray], hit.distance};
+			if(hit.material != NULL)
+				visitShaderKernel(*hit.material, hit.attr, op);
+			else
+			{
+				SmartPtr<Shader> shader = integrator->scene->getShader(hit.intRet);
+				if(shader.data() != NULL)
+					op(VirtualShaderCalls(*shader));
+			}
+		}
+
+		m_stats[WS_Shading].rays += m_hitOrder.size();
+		m_stats[WS_Shading].time += Trace::now() - begin;
+	}
+
+	//The direct illumination of a hit is queued as shadow rays, the
+	//	secondary rays go to the reflection and refraction queues
+	template<class ta_calls>
+	void shadeHit(const ta_calls &_shader, const PathRay &_path, float _distance)
+	{
+		const Ray &ray = _path.ray;
+
+		addRadiance(_path.pixel, _path.weight * (_shader.getAmbientCoefficient() * integrator->ambientLight));
+
+		Point intPt = ray.o + _distance * ray.d;
+
+		for(std::vector<PointLightSource>::const_iterator it = integrator->lightSources.begin(); it != integrator->lightSources.end(); it++)
+		{
+			Vector lightD = it->position - intPt;
+			float4 refl = _shader.getReflectance(-ray.d, lightD);
+			float dist = lightD.len();
+			float fallOff = it->falloff.x / (dist * dist) + it->falloff.y / dist + it->falloff.z;
+
+			ShadowQuery query;
+			query.origin = intPt;
+			query.lightSource = it->position;
+			query.radiance = _path.weight * (refl * float4::rep(fallOff) * it->intensity);
+			query.pixel = _path.pixel;
+			m_shadows.push_back(query);
+		}
+
+		SecondaryRays rays;
+		if(_shader.getSecondaryRays(-ray.d, ray.curRefractionIndex, rays))
+		{
+			// rays beyond the maximum depth carry no radiance
+			if(_path.depth + 1 >= IntegratorImpl::_MAX_BOUNCES)
+				return;
+
+			for(uint i = 0; i < rays.count; i++)
+			{
+				PathRay path;
+				path.ray = rays.rays[i];
+				path.weight = _path.weight * rays.weights[i];
+				path.pixel = _path.pixel;
+				path.depth = _path.depth + 1;
+				(rays.types[i] == SecondaryRays::ST_Reflection ? m_reflected : m_refracted).push_back(path);
+				_STAT_INC(rays.types[i] == SecondaryRays::ST_Reflection ? SC_ReflectionRays : SC_RefractionRays);
+			}
+		}
+		else
+		{
+			// let the integrator recurse from the depth of the path
+			integrator->state.value<DepthStateKey>() = _path.depth;
+			integrator->curRefractionIndex = ray.curRefractionIndex;
+			addRadiance(_path.pixel, _path.weight * _shader.getIndirectRadiance(-ray.d, integrator.data()));
+			integrator->state.value<DepthStateKey>() = 0;
+		}
+	}
+
+	//Traces the queued shadow rays and adds the radiance of the visible
+	//	light sources
+	void traceShadows()
+	{
+		double begin = Trace::now();
+
+		sortShadows();
+
+		for(std::vector<ShadowQuery>::const_iterator it = m_shadows.begin(); it != m_shadows.end(); it++)
+		{
+			ShadowRay r;
+			r.lightSource = it->lightSource;
+			r.d = ~(it->lightSource - it->origin);
+			r.o = it->origin + Primitive::INTEPS() * r.d;
+
+			float4 shadow = integrator->getShadow(r);
+			if(shadow[0] > 0 && shadow[1] > 0 && shadow[2] > 0 && shadow[3] > 0)
+				addRadiance(it->pixel, shadow * it->radiance);
+		}
+
+		m_stats[WS_Shadow].rays += m_shadows.size();
+		m_stats[WS_Shadow].time += Trace::now() - begin;
+
+		m_shadows.clear();
+	}
+
+	void addRadiance(uint _pixel, const float4 &_radiance)
+	{
+		target->getBits()[_pixel] += _radiance;
+	}
+
+	//Spreads the lower 8 bits of _v to every third bit
+	static uint spreadBits(uint _v)
+	{
+		_v &= 0xff;
+		_v = (_v | (_v << 8)) & 0x0f00f;
+		_v = (_v | (_v << 4)) & 0x0c30c3;
+		_v = (_v | (_v << 2)) & 0x249249;
+		return _v;
+	}
+
+	//A sort key for a ray: the octant of the direction in the upper bits,
+	//	then the Morton code of the origin quantized to 256 steps in _bounds
+	static uint rayKey(const Point &_o, const Vector &_d, const BBox &_bounds)
+	{
+		uint octant = (_d.x < 0 ? 4 : 0) | (_d.y < 0 ? 2 : 0) | (_d.z < 0 ? 1 : 0);
+
+		uint q[3];
+		for(int i = 0; i < 3; i++)
+		{
+			float extent = _bounds.max[i] - _bounds.min[i];
+			float rel = extent > 0 ? (_o[i] - _bounds.min[i]) / extent : 0.f;
+			q[i] = std::min((uint)(rel * 256.f), 255u);
+		}
+
+		return (octant << 24) | (spreadBits(q[0]) << 2) | (spreadBits(q[1]) << 1) | spreadBits(q[2]);
+	}
+
+	void sortRays(std::vector<PathRay> &_rays)
+	{
+		BBox bounds = BBox::empty();
+		for(std::vector<PathRay>::const_iterator it = _rays.begin(); it != _rays.end(); it++)
+			bounds.extend(it->ray.o);
+
+		m_sortKeys.resize(_rays.size());
+		for(size_t i = 0; i < _rays.size(); i++)
+			m_sortKeys[i] = std::make_pair(rayKey(_rays[i].ray.o, _rays[i].ray.d, bounds), (uint)i);
+		std::sort(m_sortKeys.begin(), m_sortKeys.end());
+
+		std::vector<PathRay> sorted(_rays.size());
+		for(size_t i = 0; i < _rays.size(); i++)
+			sorted[i] = _rays[m_sortKeys[i].second];
+		_rays.swap(sorted);
+	}
+
+	void sortShadows()
+	{
+		BBox bounds = BBox::empty();
+		for(std::vector<ShadowQuery>::const_iterator it = m_shadows.begin(); it != m_shadows.end(); it++)
+			bounds.extend(it->origin);
+
+		m_sortKeys.resize(m_shadows.size());
+		for(size_t i = 0; i < m_shadows.size(); i++)
+			m_sortKeys[i] = std::make_pair(rayKey(m_shadows[i].origin, m_shadows[i].lightSource - m_shadows[i].origin, bounds), (uint)i);
+		std::sort(m_sortKeys.begin(), m_sortKeys.end());
+
+		std::vector<ShadowQuery> sorted(m_shadows.size());
+		for(size_t i = 0; i < m_shadows.size(); i++)
+			sorted[i] = m_shadows[m_sortKeys[i].second];
+		m_shadows.swap(sorted);
+	}
+
+	void printStats() const
+	{
+		const char *names[WS_StageCount] = {"Primary rays", "Reflection rays", "Refraction rays", "Shadow rays", "Shaded hits"};
+
+		for(int i = 0; i < WS_StageCount; i++)
+		{
+			double seconds = m_stats[i].time;
+			std::cout << names[i] << ": " << m_stats[i].rays << " in " << seconds << " s";
+			if(seconds > 0)
+				std::cout << " (" << m_stats[i].rays / seconds << " per s)";
+			std::cout << std::endl;
+		}
+	}
+};
+
+#endif //__INCLUDE_GUARD_1653922B_47E2_4B34_925B_DE500D356598
@@ -7,9 +7,21 @@
 #include "../core/defs.h"
 #include "../core/bbox.h"
 #include "../core/memory.h"
+#include "../core/arena.h"
 #include "../core/state.h"
+#include "../core/ray_packet.h"
+#include "../core/stats.h"
+#include "../core/trace.h"
 
 
+//A sample of the camera: a position on the image plane in pixels and
+//	a position on the lens in [0..1]x[0..1]
+struct CameraSample
+{
+	float2 image;
+	float2 lens;
+};
+
 //This is the basic class for a camera, used to get a primary ray for a pixel
 class Camera : public RefCntBase
 {
@@ -17,10 +29,19 @@ public:
 	//Returns the primary ray for pixel _x, _y.
 	virtual Ray getPrimaryRay(float _x, float _y) = 0;
 
-	//Returns primary rays of a camera,
+	//Returns the number of primary rays of a camera sample,
 	// can be one with a perspective camera
 	// or more, for example with a lens camera
-    virtual std::vector<Ray> getPrimaryRays(float _x, float _y) = 0;
+	virtual uint getRaysPerSample() const { return 1; }
+
+	//Writes the primary rays of _count samples to _rays, which has
+	//	room for _count * getRaysPerSample() rays. The rays of
+	//	a sample are stored next to each other
+	virtual void getPrimaryRays(const CameraSample *_samples, uint _count, Ray *_rays)
+	{
+		for(uint i = 0; i < _count; i++)
+			_rays[i] = getPrimaryRay(_samples[i].image.x, _samples[i].image.y);
+	}
 };
 
 //This is the base class for an integrator. The integrator
@@ -32,9 +53,24 @@ struct Integrator : public RefCntBase
 	virtual float getCurrentRefractionIndex() = 0;
 	virtual float4 getRadiance(const Ray &_ray) = 0;
     virtual float4 getShadow(ShadowRay &_sr) = 0;
+
+	//The number of primitives of the scene, which a render checkpoint
+	//	is checked against. 0 if unknown
+	virtual size_t getPrimitiveCount() const { return 0; }
+
+	//Writes the radiance along the active rays of a packet to _result.
+	//	The default traces the rays one by one
+	virtual void getRadiancePacket(const RayPacket &_packet, float4 *_result)
+	{
+		for(uint i = 0; i < RayPacket::SIZE; i++)
+			if(_packet.isActive(i))
+				_result[i] = getRadiance(_packet.rays[i]);
+	}
 };
 
 struct Shader;
+struct PluggableShader;
+struct HitAttributes;
 
 //A class for a primitive
 class Primitive
@@ -49,7 +85,8 @@ public:
 		//	a pointer to a static structure, this is a bad practice
 		//	since it wont be safe in a recursive integrator. Also, heap allocations
 		//	and deallocations of objects derived from RefCntBase are very fast
-		//	and efficient.
+		//	and efficient, and objects derived from ArenaRefCntBase are taken
+		//	from the PathArena while the integrator traces a camera sample.
 		SmartPtr<RefCntBase> hitInfo;
 
 		//The distance to the intersection
@@ -66,6 +103,13 @@ public:
 	//You should create a new shader for each hit point.
 	virtual SmartPtr<Shader> getShader(IntRet _intData) const = 0;
 
+	//Fills the attributes of the hit specified by _intData and returns the
+	//	material (the prototype shader) of the primitive, without creating a
+	//	shader. Integrators use this to shade the hit with a kernel of the
+	//	material type (see impl/phong_shaders.h). Primitives that do not
+	//	support it return NULL, getShader is used for them.
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const { return NULL; }
+
 	//This function intersects a ray with a primitive. It returns the distance
 	//	to the intersection as well as (optionally) a data structure to be passed
 	//	to the getShader function. This data structure is than used to create
@@ -74,6 +118,32 @@ public:
 	//	and impl/lwobject_primitive.cpp for usage examples.
 	virtual IntRet intersect(const Ray& _ray, float _previousBestDistance) const = 0;
 
+	//Intersects the rays of group _group of a packet, which are set in _mask
+	//	(bit i for the ray GROUP_SIZE * _group + i). _ret holds the closest
+	//	intersections of the rays so far and _best their distances. The
+	//	successful intersections closer than those replace them in _ret.
+	//	Returns the mask of the rays with a new intersection.
+	//The default intersects the rays one by one, triangles test all rays
+	//	of the group at once
+	virtual uint intersectGroup(const RayPacket &_packet, uint _group, uint _mask,
+		const float8 &_best, IntRet *_ret) const
+	{
+		uint ret = 0;
+		for(uint i = 0; i < RayPacket::GROUP_SIZE; i++)
+		{
+			if((_mask >> i & 1) == 0)
+				continue;
+
+			IntRet curRet = intersect(_packet.rays[RayPacket::GROUP_SIZE * _group + i], _ret[i].distance);
+			if(curRet.distance > INTEPS() && curRet.distance < _ret[i].distance)
+			{
+				_ret[i] = std::move(curRet);
+				ret |= 1u << i;
+			}
+		}
+		return ret;
+	}
+
 	//Returns the bounding box around the primitive, and BBox::empty() if the
 	//	primitive is unbounded
 	virtual BBox getBBox() const = 0;
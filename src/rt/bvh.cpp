@@ -1,12 +1,13 @@
 #include "stdafx.h"
 #include "bvh.h"
+#include "../core/util.h"
 
 using namespace bvh_build_internal;
 
 //An iterative split in the middle build for BVHs
 void BVH::build(const std::vector<Primitive*> &_objects)
 {
-    const clock_t begin_time = clock(); // for building time measurement
+    TraceSpan span("build BVH", "build"); // for building time measurement
     int numLeafs = 0;
 
 	std::vector<BBox> objectBBoxes(_objects.size()); // vector for storing object BBoxes
@@ -144,8 +145,12 @@ void BVH::build(const std::vector<Primitive*> &_objects)
 		m_nodes.resize(rightState.nodeIndex + 1); // resize nodes by 1
 	}
 
+    double buildTime = span.end();
     std::cout << "Total no. triangles: " << _objects.size() <<
-    std::endl << "Time needed to build BVH: " << float(clock()-begin_time)/CLOCKS_PER_SEC << " s. (" << numLeafs << " leafs)"<< std::endl;
+    std::endl << "Time needed to build BVH: " << buildTime << " s. (" << numLeafs << " leafs)"<< std::endl;
+
+    Statistics::Build build = {"BVH", _objects.size(), m_nodes.size(), (size_t)numLeafs, getMemoryUsage(), buildTime};
+    Statistics::addBuild(build);
     //std::cout << begin_time  << ","<<clock() <<", " << CLOCKS_PER_SEC  << ": " << (float(clock()-begin_time)/CLOCKS_PER_SEC)<<std::endl;
 
 }
@@ -158,25 +163,35 @@ BVHStruct::IntersectionReturn BVH::intersect(const Ray &_ray, float _previousBes
 
 	Primitive *bestPrimitive = NULL;
 
-	std::stack<size_t> traverseStack;
+	traverse(_ray, 0, bestHit, bestPrimitive);
 
-	size_t curNode = 0;
-	size_t closestFace = (size_t)-1;
+	IntersectionReturn ret;
+	ret.ret = std::move(bestHit);
+	ret.primitive = bestPrimitive;
+	return ret;
+}
+
+void BVH::traverse(const Ray &_ray, size_t _root, Primitive::IntRet &_bestHit, Primitive *&_bestPrimitive) const
+{
+	std::stack<size_t> traverseStack;
 
+	size_t curNode = _root;
 	for(;;)
 	{
+		_STAT_INC(SC_NodesTraversed);
 		const BVH::Node& node = m_nodes[curNode];
 		if(node.isLeaf())
 		{
 			size_t idx = node.getLeftChildOrLeaf();
 			while(m_leafData[idx] != NULL)
 			{
-				Primitive::IntRet curRet = m_leafData[idx]->intersect(_ray, bestHit.distance);
+				_STAT_INC(SC_PrimitivesTested);
+				Primitive::IntRet curRet = m_leafData[idx]->intersect(_ray, _bestHit.distance);
 
-				if(curRet.distance > Primitive::INTEPS() && curRet.distance < bestHit.distance)
+				if(curRet.distance > Primitive::INTEPS() && curRet.distance < _bestHit.distance)
 				{
-					bestHit = curRet;
-					bestPrimitive = m_leafData[idx];
+					_bestHit = std::move(curRet);
+					_bestPrimitive = m_leafData[idx];
 				}
 
 				idx++;
@@ -197,8 +212,8 @@ BVHStruct::IntersectionReturn BVH::intersect(const Ray &_ray, float _previousBes
 			std::pair<float, float> intRight = rightNode.bbox.intersect(_ray);
 			intLeft.first = std::max(Primitive::INTEPS(), intLeft.first);
 			intRight.first = std::max(Primitive::INTEPS(), intRight.first);
-			intLeft.second = std::min(intLeft.second, bestHit.distance);
-			intRight.second = std::min(intRight.second, bestHit.distance);
+			intLeft.second = std::min(intLeft.second, _bestHit.distance);
+			intRight.second = std::min(intRight.second, _bestHit.distance);
 
 			bool descendLeft = intLeft.first < intLeft.second + Primitive::INTEPS();
 			bool descendRight = intRight.first < intRight.second + Primitive::INTEPS();
@@ -225,10 +240,193 @@ BVHStruct::IntersectionReturn BVH::intersect(const Ray &_ray, float _previousBes
 			}
 		}
 	}
+}
 
-	IntersectionReturn ret;
-	ret.ret = bestHit;
-	ret.primitive = bestPrimitive;
-	return ret;
+
+//The product of the intervals [_lo, _hi] and [_rlo, _rhi]
+static void intervalMul(float _lo, float _hi, float _rlo, float _rhi, float &_retLo, float &_retHi)
+{
+	float a = _lo * _rlo, b = _lo * _rhi, c = _hi * _rlo, d = _hi * _rhi;
+	_retLo = std::min(std::min(a, b), std::min(c, d));
+	_retHi = std::max(std::max(a, b), std::max(c, d));
+}
+
+//Returns true if no ray of the packet can enter the box before _maxDistance.
+//	Computes the entry and exit distances of the packet in interval
+//	arithmetic over the bounds of the origins and reciprocal directions.
+//	The margin covers the rounding differences to the ray by ray test
+static bool frustumMisses(const RayPacket &_packet, const BBox &_bbox, float _maxDistance)
+{
+	float entry = -FLT_MAX, exit = FLT_MAX;
+	for(int a = 0; a < 3; a++)
+	{
+		float lo1, hi1, lo2, hi2;
+		intervalMul(_bbox.min[a] - _packet.originMax[a], _bbox.min[a] - _packet.originMin[a],
+			_packet.invDirMin[a], _packet.invDirMax[a], lo1, hi1);
+		intervalMul(_bbox.max[a] - _packet.originMax[a], _bbox.max[a] - _packet.originMin[a],
+			_packet.invDirMin[a], _packet.invDirMax[a], lo2, hi2);
+		entry = std::max(entry, std::min(lo1, lo2));
+		exit = std::min(exit, std::max(hi1, hi2));
+	}
+
+	float margin = 0.0001f * (fabs(entry) + fabs(exit)) + Primitive::INTEPS();
+	return entry > exit + margin || exit < -margin || entry > _maxDistance + margin;
+}
+
+//Does the same computations as BBox::intersect, with the entry clamped to
+//	INTEPS and the INTEPS margin on the exit of BVH::intersect, so that a
+//	packet enters exactly the nodes its rays would enter one by one
+uint packetBoxMask(const RayPacket &_packet, const BBox &_bbox, uint _mask, const float8 *_best, float8 *_entry)
+{
+	const uint groupMask = (1u << RayPacket::GROUP_SIZE) - 1;
+
+	uint ret = 0;
+	for(int g = 0; g < RayPacket::GROUPS; g++)
+	{
+		if(((_mask >> (RayPacket::GROUP_SIZE * g)) & groupMask) == 0)
+			continue;
+
+		const Point8 &o = _packet.groups[g].o;
+		const Vector8 &d = _packet.boxDirs[g];
+
+		float8 t1 = (float8::rep(_bbox.min.x) - o.x) / d.x;
+		float8 t2 = (float8::rep(_bbox.max.x) - o.x) / d.x;
+		float8 entry = float8::min(t1, t2);
+		float8 exit = float8::max(t1, t2);
+
+		t1 = (float8::rep(_bbox.min.y) - o.y) / d.y;
+		t2 = (float8::rep(_bbox.max.y) - o.y) / d.y;
+		entry = float8::max(entry, float8::min(t1, t2));
+		exit = float8::min(exit, float8::max(t1, t2));
+
+		t1 = (float8::rep(_bbox.min.z) - o.z) / d.z;
+		t2 = (float8::rep(_bbox.max.z) - o.z) / d.z;
+		entry = float8::max(entry, float8::min(t1, t2));
+		exit = float8::min(exit, float8::max(t1, t2));
+
+		entry = float8::max(float8::rep(Primitive::INTEPS()), entry);
+		exit = float8::min(exit, _best[g]);
+
+		_entry[g] = entry;
+		ret |= (entry < exit + float8::rep(Primitive::INTEPS())).getMask() << (RayPacket::GROUP_SIZE * g);
+	}
+
+	return ret & _mask;
 }
 
+void BVH::intersectPacket(const RayPacket &_packet, PacketReturn &_ret, bool _anyHit) const
+{
+	const uint G = RayPacket::GROUP_SIZE;
+
+	float8 best[RayPacket::GROUPS];
+	for(uint i = 0; i < RayPacket::SIZE; i++)
+		best[i / G][i % G] = _ret.ret[i].distance;
+
+	//The rays, which still look for a hit
+	uint alive = _packet.activeMask;
+
+	std::stack<std::pair<size_t, uint> > traverseStack;
+
+	size_t curNode = 0;
+	uint curMask = alive;
+
+	for(;;)
+	{
+		curMask &= alive;
+		const BVH::Node& node = m_nodes[curNode];
+
+		if(curMask != 0 && countBits(curMask) < _PACKET_MIN_RAYS)
+		{
+			// the packet diverged, finish the subtree ray by ray
+			for(uint i = 0; i < RayPacket::SIZE; i++)
+				if(curMask >> i & 1)
+				{
+					traverse(_packet.rays[i], curNode, _ret.ret[i], _ret.primitive[i]);
+					best[i / G][i % G] = _ret.ret[i].distance;
+				}
+		}
+		else if(curMask != 0 && node.isLeaf())
+		{
+			_STAT_INC(SC_NodesTraversed);
+			// each primitive tests the groups of rays at once. A ray sees
+			//	the primitives in the same order as when traced alone
+			for(size_t idx = node.getLeftChildOrLeaf(); m_leafData[idx] != NULL; idx++)
+				for(uint g = 0; g < RayPacket::GROUPS; g++)
+				{
+					uint groupMask = ((curMask & alive) >> (G * g)) & ((1u << G) - 1);
+					if(groupMask == 0)
+						continue;
+
+					_STAT_ADD(SC_PrimitivesTested, countBits(groupMask));
+					uint hits = m_leafData[idx]->intersectGroup(_packet, g, groupMask, best[g], _ret.ret + G * g);
+					for(uint i = 0; i < G; i++)
+						if(hits >> i & 1)
+						{
+							best[g][i] = _ret.ret[G * g + i].distance;
+							_ret.primitive[G * g + i] = m_leafData[idx];
+						}
+
+					if(_anyHit)
+						alive &= ~(hits << (G * g));
+				}
+		}
+		else if(curMask != 0)
+		{
+			_STAT_INC(SC_NodesTraversed);
+			float maxBest = 0;
+			for(uint i = 0; i < RayPacket::SIZE; i++)
+				if(curMask >> i & 1)
+					maxBest = std::max(maxBest, best[i / G][i % G]);
+
+			size_t left = node.getLeftChildOrLeaf();
+			float8 entryLeft[RayPacket::GROUPS], entryRight[RayPacket::GROUPS];
+			uint maskLeft = 0, maskRight = 0;
+
+			if(!_packet.hasFrustum || !frustumMisses(_packet, m_nodes[left].bbox, maxBest))
+				maskLeft = packetBoxMask(_packet, m_nodes[left].bbox, curMask, best, entryLeft);
+			if(!_packet.hasFrustum || !frustumMisses(_packet, m_nodes[left + 1].bbox, maxBest))
+				maskRight = packetBoxMask(_packet, m_nodes[left + 1].bbox, curMask, best, entryRight);
+
+			if(maskLeft != 0 && maskRight != 0)
+			{
+				size_t nearNode = left, farNode = left + 1;
+				uint nearMask = maskLeft, farMask = maskRight;
+
+				// order the children by the first ray entering both
+				if((maskLeft & maskRight) != 0)
+				{
+					uint r = lowestBit(maskLeft & maskRight);
+					if(entryLeft[r / G][r % G] > entryRight[r / G][r % G])
+					{
+						std::swap(nearNode, farNode);
+						std::swap(nearMask, farMask);
+					}
+				}
+
+				traverseStack.push(std::make_pair(farNode, farMask));
+				curNode = nearNode;
+				curMask = nearMask;
+				continue;
+			}
+			else if(maskLeft != 0)
+			{
+				curNode = left;
+				curMask = maskLeft;
+				continue;
+			}
+			else if(maskRight != 0)
+			{
+				curNode = left + 1;
+				curMask = maskRight;
+				continue;
+			}
+		}
+
+		if(traverseStack.empty())
+			break;
+
+		curNode = traverseStack.top().first;
+		curMask = traverseStack.top().second;
+		traverseStack.pop();
+	}
+}
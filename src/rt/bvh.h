@@ -6,7 +6,17 @@
 
 #include "../core/memory.h"
 #include "basic_definitions.h"
+#include "../core/ray_packet.h"
 #include <algorithm>
+
+//Packets with less rays in a node are traversed ray by ray
+#define _PACKET_MIN_RAYS 3
+
+//Tests the rays of _mask against a box, a group of eight at a time. _best
+//	are the distances of the closest hits so far, per group. Returns the
+//	mask of the rays that enter the box and writes their entry distances
+//	to _entry
+uint packetBoxMask(const RayPacket &_packet, const BBox &_bbox, uint _mask, const float8 *_best, float8 *_entry);
 
 
 namespace bvh_build_internal
@@ -93,8 +103,40 @@ public:
 	//Intersects a ray with the BVH.
 	virtual IntersectionReturn intersect(const Ray &_ray, float _previousBestDistance) const = 0;
 
+	//The hits of the rays of a packet
+	struct PacketReturn
+	{
+		Primitive *primitive[RayPacket::SIZE];
+		Primitive::IntRet ret[RayPacket::SIZE];
+	};
+
+	//Intersects the active rays of a packet with the BVH. On input,
+	//	_ret.ret[i].distance is the previous best distance of ray i and
+	//	_ret.primitive[i] is NULL. With _anyHit, a ray may stop at any hit
+	//	closer than that instead of the closest one (for shadow rays).
+	//The default traces the rays one by one
+	virtual void intersectPacket(const RayPacket &_packet, PacketReturn &_ret, bool _anyHit) const
+	{
+		for(uint i = 0; i < RayPacket::SIZE; i++)
+			if(_packet.isActive(i))
+			{
+				IntersectionReturn r = intersect(_packet.rays[i], _ret.ret[i].distance);
+				if(r.primitive != NULL)
+				{
+					_ret.ret[i] = std::move(r.ret);
+					_ret.primitive[i] = r.primitive;
+				}
+			}
+	}
+
 	virtual BBox getSceneBBox() const { return BBox::empty(); };
 
+	// memory of the nodes and the leaf data in bytes
+	virtual size_t getMemoryUsage() const
+	{
+		return m_nodes.capacity() * sizeof(Node) + m_leafData.capacity() * sizeof(Primitive*);
+	}
+
 	// sorts a vector of centroids on a given axis
     virtual void sortOnAxis(std::vector<bvh_build_internal::CentroidWithID> &_centroids, int axis)
     {
@@ -113,11 +155,21 @@ public:
 	//Intersects a ray with the BVH.
 	virtual IntersectionReturn intersect(const Ray &_ray, float _previousBestDistance) const;
 
+	//Traverses the BVH with the whole packet, as long as at least
+	//	_PACKET_MIN_RAYS rays enter a node. Subtrees are culled with the
+	//	frustum of the packet before the rays are tested one by one
+	virtual void intersectPacket(const RayPacket &_packet, PacketReturn &_ret, bool _anyHit) const;
+
 	virtual BBox getSceneBBox() const
 	{
 	    // return BBox of root node
 	    return m_nodes[0].bbox;
     };
+
+private:
+	//Intersects a ray with the subtree below _root. The box of _root is
+	//	not tested
+	void traverse(const Ray &_ray, size_t _root, Primitive::IntRet &_bestHit, Primitive *&_bestPrimitive) const;
 };
 
 // a bounding volume hierarchy using Surface Area Heuristic to determine split point
@@ -14,7 +14,7 @@ using namespace bvh_build_internal;
 // by Ingo Wald, Solomon Boulos, Peter Shirley
 void BVHSAH::build(const std::vector<Primitive*> &_objects)
 {
-    const clock_t begin_time = clock(); // for building time measurement for debug output
+    TraceSpan span("build SAH BVH", "build"); // for building time measurement for debug output
     int numLeafs = 0; // count leafs for debug output
 
 	std::vector<BBox> objectBBoxes(_objects.size()); // vector for storing object BBoxes
@@ -261,8 +261,12 @@ void BVHSAH::build(const std::vector<Primitive*> &_objects)
 	}
 
     // debug
+    double buildTime = span.end();
     std::cout << "Total no. triangles: " << _objects.size() <<
-    std::endl << "Time needed to build SAH BVH: " << float(clock()-begin_time)/CLOCKS_PER_SEC << " s. (" << numLeafs << " leafs)" << std::endl;
+    std::endl << "Time needed to build SAH BVH: " << buildTime << " s. (" << numLeafs << " leafs)" << std::endl;
+
+    Statistics::Build build = {"SAH BVH", _objects.size(), m_nodes.size(), (size_t)numLeafs, getMemoryUsage(), buildTime};
+    Statistics::addBuild(build);
     //std::cout << begin_time  << ","<<clock() <<", " << CLOCKS_PER_SEC  << ": " << (float(clock()-begin_time)/CLOCKS_PER_SEC)<<std::endl;
 
 }
@@ -0,0 +1,211 @@
+#include "stdafx.h"
+
+#include "checkpoint.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#define _CHECKPOINT_MAGIC "MRTCHKPT"
+#define _CHECKPOINT_VERSION 2
+
+RenderCheckpoint::RenderCheckpoint()
+	: m_header(NULL), m_pixels(NULL), m_samples(NULL), m_tileBits(NULL), m_size(0),
+	m_numXTiles(0), m_numYTiles(0)
+{
+#ifdef _WIN32
+	m_file = m_mapping = NULL;
+#else
+	m_file = -1;
+#endif
+}
+
+RenderCheckpoint::~RenderCheckpoint()
+{
+	close();
+}
+
+uint RenderCheckpoint::open(const std::string &_fileName, uint _width, uint _height, uint _tileSize,
+	unsigned long long _settingsHash)
+{
+	close();
+	m_fileName = _fileName;
+
+	m_numXTiles = (_width + _tileSize - 1) / _tileSize;
+	m_numYTiles = (_height + _tileSize - 1) / _tileSize;
+
+	size_t pixelCount = (size_t)_width * _height;
+	m_size = sizeof(Header) + pixelCount * (sizeof(float4) + sizeof(uint))
+		+ (m_numXTiles * m_numYTiles + 7) / 8;
+
+	//Map the file, it is resized to m_size. A file of another size
+	//	cannot be of the same render and is cleared below
+	size_t oldSize = 0;
+#ifdef _WIN32
+	m_file = CreateFileA(_fileName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = NULL;
+		throw std::runtime_error("Error opening checkpoint file");
+	}
+	oldSize = (size_t)GetFileSize((HANDLE)m_file, NULL);
+
+	m_mapping = CreateFileMappingA((HANDLE)m_file, NULL, PAGE_READWRITE, 0, (DWORD)m_size, NULL);
+	void *data = m_mapping != NULL ? MapViewOfFile((HANDLE)m_mapping, FILE_MAP_WRITE, 0, 0, m_size) : NULL;
+	if(data == NULL)
+	{
+		close();
+		throw std::runtime_error("Error mapping checkpoint file");
+	}
+#else
+	m_file = ::open(_fileName.c_str(), O_RDWR | O_CREAT, 0644);
+	if(m_file < 0)
+		throw std::runtime_error("Error opening checkpoint file");
+
+	struct stat st;
+	if(fstat(m_file, &st) == 0)
+		oldSize = (size_t)st.st_size;
+
+	void *data = MAP_FAILED;
+	if(ftruncate(m_file, (off_t)m_size) == 0)
+		data = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+	if(data == MAP_FAILED)
+	{
+		::close(m_file);
+		m_file = -1;
+		throw std::runtime_error("Error mapping checkpoint file");
+	}
+#endif
+
+	m_header = (Header*)data;
+	m_pixels = (float4*)(m_header + 1);
+	m_samples = (uint*)(m_pixels + pixelCount);
+	m_tileBits = (byte*)(m_samples + pixelCount);
+
+	bool resume = oldSize == m_size
+		&& memcmp(m_header->magic, _CHECKPOINT_MAGIC, sizeof(m_header->magic)) == 0
+		&& m_header->version == _CHECKPOINT_VERSION
+		&& m_header->width == _width && m_header->height == _height
+		&& m_header->tileSize == _tileSize
+		&& m_header->settingsHash == _settingsHash;
+
+	if(!resume)
+	{
+		memset(data, 0, m_size);
+		memcpy(m_header->magic, _CHECKPOINT_MAGIC, sizeof(m_header->magic));
+		m_header->version = _CHECKPOINT_VERSION;
+		m_header->width = _width;
+		m_header->height = _height;
+		m_header->tileSize = _tileSize;
+		m_header->settingsHash = _settingsHash;
+		flush(data, (byte*)data + m_size);
+		return 0;
+	}
+
+	uint doneTiles = 0;
+	for(uint y = 0; y < m_numYTiles; y++)
+		for(uint x = 0; x < m_numXTiles; x++)
+			if(isTileDone(x, y))
+				doneTiles++;
+	return doneTiles;
+}
+
+bool RenderCheckpoint::isComplete() const
+{
+	for(uint y = 0; y < m_numYTiles; y++)
+		for(uint x = 0; x < m_numXTiles; x++)
+			if(!isTileDone(x, y))
+				return false;
+	return true;
+}
+
+void RenderCheckpoint::discard()
+{
+	if(!isOpen())
+		return;
+
+	close();
+	remove(m_fileName.c_str());
+}
+
+void RenderCheckpoint::close()
+{
+#ifdef _WIN32
+	if(m_header != NULL)
+		UnmapViewOfFile(m_header);
+	if(m_mapping != NULL)
+		CloseHandle((HANDLE)m_mapping);
+	if(m_file != NULL)
+		CloseHandle((HANDLE)m_file);
+	m_file = m_mapping = NULL;
+#else
+	if(m_header != NULL)
+		munmap(m_header, m_size);
+	if(m_file >= 0)
+		::close(m_file);
+	m_file = -1;
+#endif
+	m_header = NULL;
+	m_pixels = NULL;
+	m_samples = NULL;
+	m_tileBits = NULL;
+}
+
+void RenderCheckpoint::getTileRect(uint _xTile, uint _yTile, uint &_x0, uint &_x1, uint &_y0, uint &_y1) const
+{
+	uint tileSize = m_header->tileSize;
+	_x0 = _xTile * tileSize;
+	_y0 = _yTile * tileSize;
+	_x1 = std::min(_x0 + tileSize, m_header->width);
+	_y1 = std::min(_y0 + tileSize, m_header->height);
+}
+
+void RenderCheckpoint::loadTile(uint _xTile, uint _yTile, Image &_img) const
+{
+	uint x0, x1, y0, y1;
+	getTileRect(_xTile, _yTile, x0, x1, y0, y1);
+
+	for(uint y = y0; y < y1; y++)
+		for(uint x = x0; x < x1; x++)
+			_img(x, y) = m_pixels[y * m_header->width + x];
+}
+
+void RenderCheckpoint::storeTile(uint _xTile, uint _yTile, const Image &_img)
+{
+	uint x0, x1, y0, y1;
+	getTileRect(_xTile, _yTile, x0, x1, y0, y1);
+
+	for(uint y = y0; y < y1; y++)
+		for(uint x = x0; x < x1; x++)
+			m_pixels[y * m_header->width + x] = _img(x, y);
+
+	//The pixels have to be in the file before the tile is marked
+	uint width = m_header->width;
+	flush(m_pixels + y0 * width + x0, m_pixels + (y1 - 1) * width + x1);
+	flush(m_samples + y0 * width + x0, m_samples + (y1 - 1) * width + x1);
+
+	uint tile = _yTile * m_numXTiles + _xTile;
+	m_tileBits[tile / 8] |= (byte)(1 << (tile % 8));
+	flush(m_tileBits + tile / 8, m_tileBits + tile / 8 + 1);
+}
+
+void RenderCheckpoint::flush(const void *_begin, const void *_end)
+{
+#ifdef _WIN32
+	FlushViewOfFile(_begin, (size_t)((const byte*)_end - (const byte*)_begin));
+	FlushFileBuffers((HANDLE)m_file);
+#else
+	//msync needs a page aligned address
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t begin = (size_t)((const byte*)_begin - (const byte*)m_header) / pageSize * pageSize;
+	size_t end = (size_t)((const byte*)_end - (const byte*)m_header);
+	msync((byte*)m_header + begin, end - begin, MS_SYNC);
+#endif
+}
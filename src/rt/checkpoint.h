@@ -0,0 +1,113 @@
+#ifndef __INCLUDE_GUARD_6F1C2B7E_3A94_4D58_9E2F_C41B8D07A5E3
+#define __INCLUDE_GUARD_6F1C2B7E_3A94_4D58_9E2F_C41B8D07A5E3
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "../core/image.h"
+
+//A FNV-1a hash of the settings of a render. A checkpoint is only
+//	resumed by a render with the same settings hash
+class SettingsHash
+{
+	unsigned long long m_value;
+
+public:
+	SettingsHash() : m_value(14695981039346656037ULL) {}
+
+	void add(const void *_data, size_t _size)
+	{
+		const byte *data = (const byte*)_data;
+		for(size_t i = 0; i < _size; i++)
+		{
+			m_value ^= data[i];
+			m_value *= 1099511628211ULL;
+		}
+	}
+
+	void add(const std::string &_str) { add(_str.data(), _str.size()); }
+	void add(uint _value) { add(&_value, sizeof(_value)); }
+	void add(float _value) { add(&_value, sizeof(_value)); }
+	void add(const Point &_p) { add(_p.x); add(_p.y); add(_p.z); }
+	void add(const Vector &_v) { add(_v.x); add(_v.y); add(_v.z); }
+
+	unsigned long long value() const { return m_value; }
+};
+
+//A checkpoint of a tile render, kept in a memory mapped file: the
+//	colors of the pixels as floats, the number of samples of each pixel
+//	and a bitmap of the complete tiles. A tile is marked complete only
+//	after its pixels were flushed to the file, so after a crash the
+//	render can resume with all tiles that are not marked.
+class RenderCheckpoint
+{
+	struct Header
+	{
+		char magic[8];
+		uint version;
+		uint width, height, tileSize;
+		unsigned long long settingsHash;
+	};
+
+	Header *m_header;
+	float4 *m_pixels;
+	uint *m_samples;
+	byte *m_tileBits;
+	size_t m_size;
+	uint m_numXTiles, m_numYTiles;
+	std::string m_fileName;
+
+#ifdef _WIN32
+	void *m_file, *m_mapping;
+#else
+	int m_file;
+#endif
+
+	RenderCheckpoint(const RenderCheckpoint&);
+	RenderCheckpoint& operator=(const RenderCheckpoint&);
+
+public:
+	RenderCheckpoint();
+	~RenderCheckpoint();
+
+	//Opens the checkpoint _fileName for an image of the given size
+	//	rendered with the given tile size and settings (see
+	//	SettingsHash). A file of an earlier render with the same sizes
+	//	and settings is resumed, otherwise a new one is created.
+	//	Returns the number of complete tiles
+	uint open(const std::string &_fileName, uint _width, uint _height, uint _tileSize,
+		unsigned long long _settingsHash);
+	void close();
+
+	//Closes the checkpoint and deletes its file, for example once the
+	//	render is finished and there is nothing to resume
+	void discard();
+
+	//True once all tiles are complete
+	bool isComplete() const;
+
+	bool isOpen() const { return m_header != NULL; }
+
+	bool isTileDone(uint _xTile, uint _yTile) const
+	{
+		uint tile = _yTile * m_numXTiles + _xTile;
+		return (m_tileBits[tile / 8] >> (tile % 8) & 1) != 0;
+	}
+
+	uint &sampleCount(uint _x, uint _y) { return m_samples[_y * m_header->width + _x]; }
+
+	//Copies the pixels of a complete tile to _img
+	void loadTile(uint _xTile, uint _yTile, Image &_img) const;
+
+	//Copies the pixels of a tile from _img, flushes them and the sample
+	//	counts to the file and then marks the tile as complete
+	void storeTile(uint _xTile, uint _yTile, const Image &_img);
+
+private:
+	void getTileRect(uint _xTile, uint _yTile, uint &_x0, uint &_x1, uint &_y0, uint &_y1) const;
+
+	//Writes the pages of [_begin, _end) to the file
+	void flush(const void *_begin, const void *_end);
+};
+
+#endif //__INCLUDE_GUARD_6F1C2B7E_3A94_4D58_9E2F_C41B8D07A5E3
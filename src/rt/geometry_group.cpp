@@ -6,10 +6,79 @@ SmartPtr<Shader> GeometryGroup::getShader(IntRet _intData) const
 {
 	//Dereference the intersection info and ask the contained primitive
 	//	for the shader
-	SmartPtr<GGHitPoint> hit = _intData.hitInfo;
+	const GGHitPoint *hit = static_cast<const GGHitPoint*>(_intData.hitInfo.data());
 	return hit->innerPrimitive->getShader(hit->intRet);
 }
 
+const PluggableShader* GeometryGroup::getMaterialHit(IntRet _intData, HitAttributes &_attr) const
+{
+	const GGHitPoint *hit = static_cast<const GGHitPoint*>(_intData.hitInfo.data());
+	return hit->innerPrimitive->getMaterialHit(hit->intRet, _attr);
+}
+
+void GeometryGroup::intersectPacket(const RayPacket &_packet, IntRet *_ret, bool _anyHit) const
+{
+	BVHStruct::PacketReturn packetRet;
+
+	//The not bounded primitives are intersected ray by ray
+	for(uint i = 0; i < RayPacket::SIZE; i++)
+	{
+		packetRet.primitive[i] = NULL;
+		packetRet.ret[i].distance = _ret[i].distance;
+
+		if(!_packet.isActive(i))
+			continue;
+
+		_STAT_ADD(SC_PrimitivesTested, m_nonIdxPrimitives.size());
+		for(std::vector<Primitive*>::const_iterator it = m_nonIdxPrimitives.begin(); it != m_nonIdxPrimitives.end(); it++)
+		{
+			IntRet curRet = (*it)->intersect(_packet.rays[i], packetRet.ret[i].distance);
+
+			if(curRet.distance < packetRet.ret[i].distance && curRet.distance > Primitive::INTEPS())
+			{
+				packetRet.ret[i] = std::move(curRet);
+				packetRet.primitive[i] = *it;
+			}
+		}
+	}
+
+	if (!indexCreated)
+		std::cout << "No index has been created for this geometry group. Build index first before traversing indexable primitives!" << std::endl;
+	else
+	{
+		if(!_anyHit)
+			m_bvh->intersectPacket(_packet, packetRet, false);
+		else
+		{
+			//Rays with a hit are done already
+			RayPacket remaining = _packet;
+			for(uint i = 0; i < RayPacket::SIZE; i++)
+				if(packetRet.primitive[i] != NULL)
+					remaining.activeMask &= ~(1u << i);
+
+			if(remaining.activeMask != 0)
+				m_bvh->intersectPacket(remaining, packetRet, true);
+		}
+	}
+
+	for(uint i = 0; i < RayPacket::SIZE; i++)
+	{
+		if(!_packet.isActive(i))
+			continue;
+
+		if(packetRet.primitive[i] != NULL)
+		{
+			SmartPtr<GGHitPoint> hp = new GGHitPoint;
+			hp->intRet = std::move(packetRet.ret[i]);
+			hp->innerPrimitive = packetRet.primitive[i];
+			_ret[i].distance = hp->intRet.distance;
+			_ret[i].hitInfo = std::move(hp);
+		}
+		else
+			_ret[i] = packetRet.ret[i];
+	}
+}
+
 Primitive::IntRet GeometryGroup::intersect(const Ray& _ray, float _previousBestDistance) const
 {
     IntRet bestRet;
@@ -18,6 +87,7 @@ Primitive::IntRet GeometryGroup::intersect(const Ray& _ray, float _previousBestD
 
 	Primitive *bestPrimitive = NULL;
 	//Find closest primitive
+	_STAT_ADD(SC_PrimitivesTested, m_nonIdxPrimitives.size());
 	for(std::vector<Primitive*>::const_iterator it = m_nonIdxPrimitives.begin(); it != m_nonIdxPrimitives.end(); it++)
 	{
 
@@ -25,7 +95,7 @@ Primitive::IntRet GeometryGroup::intersect(const Ray& _ray, float _previousBestD
 
 		if(curRet.distance < bestRet.distance && curRet.distance > Primitive::INTEPS())
 		{
-			bestRet = curRet;
+			bestRet = std::move(curRet);
 			bestPrimitive = *it;
 		}
 	}
@@ -44,17 +114,16 @@ Primitive::IntRet GeometryGroup::intersect(const Ray& _ray, float _previousBestD
 	if(intRet.ret.distance < bestRet.distance)
 	{
 		bestPrimitive = intRet.primitive;
-		bestRet = intRet.ret;
+		bestRet = std::move(intRet.ret);
 	}
 
 
 	//Encapsulate the intersection info together with the primtive it belongs to
 	SmartPtr<GGHitPoint> hp = new GGHitPoint;
-	hp->intRet = bestRet;
+	hp->intRet = std::move(bestRet);
 	hp->innerPrimitive = bestPrimitive;
-	bestRet.hitInfo = hp;
-
-	volatile Primitive::IntRet pp = bestRet;
+	bestRet.distance = hp->intRet.distance;
+	bestRet.hitInfo = std::move(hp);
 
 	return bestRet;
 }
@@ -16,7 +16,7 @@ class GeometryGroup : public Primitive
 {
 	//Intersection info which encapsulates the intersection info
 	//	of a contained primitive, toghether with a reference to the primitive
-	struct GGHitPoint : public RefCntBase
+	struct GGHitPoint : public ArenaRefCntBase
 	{
 		Primitive::IntRet intRet;
 		Primitive* innerPrimitive;
@@ -74,11 +74,21 @@ public:
     }
 
 	virtual SmartPtr<Shader> getShader(IntRet _intData) const;
+	virtual const PluggableShader* getMaterialHit(IntRet _intData, HitAttributes &_attr) const;
 	virtual IntRet intersect(const Ray& _ray, float _previousBestDistance ) const;
+
+	//Intersects the active rays of a packet. On input, _ret[i].distance is
+	//	the previous best distance of ray i. With _anyHit, a ray may return
+	//	any hit closer than that instead of the closest one. Unlike
+	//	intersect, rays without a hit get no hit info
+	void intersectPacket(const RayPacket &_packet, IntRet *_ret, bool _anyHit) const;
 	virtual BBox getBBox() const;
 
 	//Rebuilds the BVH and updated m_nonIdxPrimitives
 	void rebuildIndex();
+
+	//The memory of the acceleration structure in bytes
+	size_t getIndexMemoryUsage() const { return m_bvh->getMemoryUsage(); }
 };
 
 #endif //__INCLUDE_GUARD_3862487A_DF63_478D_99C2_652B7C66442E
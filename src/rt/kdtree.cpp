@@ -14,7 +14,7 @@ using namespace bvh_build_internal;
 
 void KDTree::build(const std::vector<Primitive*> &_objects)
 {
-    const clock_t begin_time = clock(); // for building time measurement for debug output
+    TraceSpan span("build SAH KD-Tree", "build"); // for building time measurement for debug output
     int numLeafs = 0;
     int numFaces = 0;
 
@@ -204,8 +204,12 @@ void KDTree::build(const std::vector<Primitive*> &_objects)
 	}
 
     // debug
+    double buildTime = span.end();
     std::cout << "Total no. triangles: " << _objects.size() << " Total no. faces: " << numFaces <<
-    std::endl << "Time needed to build SAH KD-Tree: " << float(clock()-begin_time)/CLOCKS_PER_SEC << " s. (" << numLeafs << " leafs)" << std::endl;
+    std::endl << "Time needed to build SAH KD-Tree: " << buildTime << " s. (" << numLeafs << " leafs)" << std::endl;
+
+    Statistics::Build build = {"SAH KD-Tree", _objects.size(), m_nodes.size(), (size_t)numLeafs, getMemoryUsage(), buildTime};
+    Statistics::addBuild(build);
 }
 
 // determines best split axis, mininum cost and split value
@@ -404,6 +408,7 @@ BVHStruct::IntersectionReturn KDTree::intersect(const Ray &_ray, float _previous
             break;
 
         // if not, go on and get next node to proceed
+		_STAT_INC(SC_NodesTraversed);
 		const KDNode& node = m_nodes[curNode.nodeIndex];
 
 		// check if node is a leaf
@@ -498,11 +503,12 @@ BVHStruct::IntersectionReturn KDTree::intersect(const Ray &_ray, float _previous
             // intersect with all primtives of leaf
 			while(m_leafData[idx] != NULL)
 			{
+				_STAT_INC(SC_PrimitivesTested);
 				Primitive::IntRet curRet = m_leafData[idx]->intersect(_ray, bestHit.distance);
 
 				if(curRet.distance > Primitive::INTEPS() && curRet.distance < bestHit.distance)
 				{
-					bestHit = curRet;
+					bestHit = std::move(curRet);
 					bestPrimitive = m_leafData[idx];
 				}
                 // ... and to the next primitive!
@@ -520,7 +526,7 @@ BVHStruct::IntersectionReturn KDTree::intersect(const Ray &_ray, float _previous
 	}
 
     // update information
-	ret.ret = bestHit;
+	ret.ret = std::move(bestHit);
 	ret.primitive = bestPrimitive;
 
 	// .. and return!
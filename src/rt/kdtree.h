@@ -150,6 +150,14 @@ public:
 	    // return BBox of root node
 	    return m_nodes[0].bbox;
     };
+
+	// memory of the nodes, the leaf data and the object boxes and
+	// centroids kept from the build in bytes
+	virtual size_t getMemoryUsage() const
+	{
+		return m_nodes.capacity() * sizeof(KDNode) + m_leafData.capacity() * sizeof(Primitive*)
+			+ objectBBoxes.capacity() * sizeof(BBox) + centroids.capacity() * sizeof(bvh_build_internal::CentroidWithID);
+	}
 };
 
 // a balanced kd-tree implementation,
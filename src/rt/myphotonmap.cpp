@@ -8,6 +8,7 @@
 #include <assert.h>
 #include <sys/stat.h>
 #include "myphotonmap.h"
+#include "../core/stats.h"
 
 
 
@@ -344,6 +345,8 @@ static void locatePhotons(
   float dist1;
   float dist2;
 
+  _STAT_INC(SC_PhotonNodesVisited);
+
   if (index<map->half_stored_photons) {
     dist1 = np->pos[ p->plane ] - p->pos[ p->plane ];
 
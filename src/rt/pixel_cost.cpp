@@ -0,0 +1,82 @@
+#include "stdafx.h"
+
+#include "pixel_cost.h"
+#include <algorithm>
+
+struct CostInfo
+{
+	const char *suffix; //Of the file name
+	const char *label; //In the output
+};
+
+static const CostInfo s_costInfo[PC_Count] =
+{
+	{".time.png", "seconds"},
+	{".nodes.png", "nodes traversed"},
+	{".primitives.png", "primitives tested"},
+	{".photonNodes.png", "photon nodes visited"}
+};
+
+PixelCost PixelCost::now()
+{
+	PixelCost ret;
+	ret.values[PC_Time] = omp_get_wtime();
+#if STATISTICS
+	ret.values[PC_Nodes] = (double)Statistics::value(SC_NodesTraversed);
+	ret.values[PC_Primitives] = (double)Statistics::value(SC_PrimitivesTested);
+	ret.values[PC_PhotonNodes] = (double)Statistics::value(SC_PhotonNodesVisited);
+#endif
+	return ret;
+}
+
+float4 CostImages::falseColor(float _value)
+{
+	//black, blue, cyan, green, yellow, red
+	static const float4 s_stops[] =
+	{
+		float4(0, 0, 0, 0), float4(0, 0, 1, 0), float4(0, 1, 1, 0),
+		float4(0, 1, 0, 0), float4(1, 1, 0, 0), float4(1, 0, 0, 0)
+	};
+	static const int s_stopCount = sizeof(s_stops) / sizeof(s_stops[0]);
+
+	float pos = std::min(std::max(_value, 0.f), 1.f) * (s_stopCount - 1);
+	int stop = std::min((int)pos, s_stopCount - 2);
+	float t = pos - (float)stop;
+	return s_stops[stop] * float4::rep(1.f - t) + s_stops[stop + 1] * float4::rep(t);
+}
+
+void CostImages::write(const std::string &_prefix) const
+{
+	if(m_pixels.empty())
+		return;
+
+	std::vector<double> sorted(m_pixels.size());
+	Image img(m_width, m_height);
+
+	for(int kind = 0; kind < PC_Count; kind++)
+	{
+		if(kind != PC_Time && !STATISTICS)
+			break;
+
+		double sum = 0;
+		for(size_t i = 0; i < m_pixels.size(); i++)
+		{
+			sorted[i] = m_pixels[i].values[kind];
+			sum += sorted[i];
+		}
+
+		size_t percentile = (sorted.size() - 1) * 99 / 100;
+		std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+		double scale = sorted[percentile] > 0 ? 1.0 / sorted[percentile] : 0.0;
+
+		for(uint y = 0; y < m_height; y++)
+			for(uint x = 0; x < m_width; x++)
+				img(x, y) = falseColor((float)(m_pixels[(size_t)y * m_width + x].values[kind] * scale));
+
+		std::string fileName = _prefix + s_costInfo[kind].suffix;
+		img.writePNG(fileName);
+		std::cout << "Cost image " << fileName << ": " << s_costInfo[kind].label << " per pixel "
+			<< sum / m_pixels.size() << " on average, " << sorted[percentile]
+			<< " at the 99th percentile (red)" << std::endl;
+	}
+}
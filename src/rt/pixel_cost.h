@@ -0,0 +1,86 @@
+#ifndef __INCLUDE_GUARD_AF1CF929_0949_4AED_88ED_2DE4B173EA94
+#define __INCLUDE_GUARD_AF1CF929_0949_4AED_88ED_2DE4B173EA94
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "../core/image.h"
+#include "../core/stats.h"
+#include <string>
+
+//The costs recorded for every pixel
+enum PixelCostKind
+{
+	PC_Time, //Wall clock seconds
+	PC_Nodes, //BVH and kd-tree nodes traversed
+	PC_Primitives, //Ray/primitive intersection tests
+	PC_PhotonNodes, //Photon map nodes visited by nearest photon searches
+	PC_Count
+};
+
+//The cost of rendering a pixel, summed over all its samples and rounds.
+//	The counts come from Statistics and stay 0 without STATISTICS
+struct PixelCost
+{
+	double values[PC_Count];
+
+	PixelCost()
+	{
+		for(int i = 0; i < PC_Count; i++)
+			values[i] = 0;
+	}
+
+	//The current time and counters of the calling thread
+	static PixelCost now();
+
+	//Adds the cost between two calls of now
+	void add(const PixelCost &_begin, const PixelCost &_end)
+	{
+		for(int i = 0; i < PC_Count; i++)
+			values[i] += _end.values[i] - _begin.values[i];
+	}
+};
+
+//The costs of all pixels of an image, written as false color images
+class CostImages
+{
+	std::vector<PixelCost> m_pixels;
+	uint m_width, m_height;
+
+public:
+	CostImages() : m_width(0), m_height(0) {}
+
+	//Starts recording the costs of an image of the given size, all 0
+	void init(uint _width, uint _height)
+	{
+		m_width = _width;
+		m_height = _height;
+		m_pixels.assign((size_t)_width * _height, PixelCost());
+	}
+
+	void clear()
+	{
+		m_pixels.clear();
+		m_width = m_height = 0;
+	}
+
+	bool empty() const { return m_pixels.empty(); }
+
+	PixelCost& operator() (uint _x, uint _y)
+	{
+		_ASSERT(_x < m_width && _y < m_height);
+		return m_pixels[(size_t)_y * m_width + _x];
+	}
+
+	//Writes an image per cost to _prefix + ".time.png", ".nodes.png",
+	//	".primitives.png" and ".photonNodes.png", from black (no cost) over
+	//	blue, cyan, green and yellow to red (expensive). Each is scaled to the 99th percentile of its
+	//	cost, so that a few outliers do not hide the rest. The counts
+	//	are only written with STATISTICS
+	void write(const std::string &_prefix) const;
+
+	//The false color of _value in [0..1]
+	static float4 falseColor(float _value);
+};
+
+#endif //__INCLUDE_GUARD_AF1CF929_0949_4AED_88ED_2DE4B173EA94
@@ -6,21 +6,90 @@
 
 #include "../core/image.h"
 #include "basic_definitions.h"
+#include "shading_basics.h"
+#include "checkpoint.h"
+#include "pixel_cost.h"
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <typeinfo>
 
 //A sampler telling how to sample a pixel
 struct Sampler : public RefCntBase
 {
 	//A sample is a poisition [0..1]x[0..1] within the pixel
 	//	as well as a weight, telling how much this sample
-	//	contributes to the final value of the pixel
+	//	contributes to the final value of the pixel.
+	//	lens is a position [0..1]x[0..1] on the lens of the camera.
+	//	Samplers take it from other dimensions of the same sample
+	//	sequence as the position, so that a single camera ray per
+	//	sample covers the pixel and the lens
 	struct Sample
 	{
 		float2 position;
 		float weight;
+		float2 lens;
 	};
 
 	//Pushes all samples to _result
 	virtual void getSamples(uint _x, uint _y, std::vector<Sample> &_result) = 0;
+
+	//Pushes the samples of round _round to _result. Adaptive sampling
+	//	asks for further rounds of samples for a pixel, which have to
+	//	differ from the earlier rounds, or the pixel looks converged.
+	//	Round 0 are the samples of getSamples. The default gives them
+	//	in every round, which is only right for samplers drawing new
+	//	random samples on every call. Deterministic samplers override it
+	virtual void getRoundSamples(uint _x, uint _y, uint _round, std::vector<Sample> &_result)
+	{
+		getSamples(_x, _y, _result);
+	}
+
+	//Adds the parameters the samples depend on to _hash, which a render
+	//	checkpoint uses to recognize the settings. The type of the
+	//	sampler is added by the renderer
+	virtual void hashSettings(SettingsHash &_hash) const {}
+};
+
+//The samples of a pixel accumulated over several rounds,
+//	used by adaptive sampling
+struct PixelStats
+{
+	//The sum of the weighted sample colors of all rounds
+	float4 color;
+	uint rounds, samples;
+	//The sums of the luminance of the samples and its square
+	float lumSum, lumSqSum;
+
+	PixelStats() : color(float4::rep(0.f)), rounds(0), samples(0), lumSum(0.f), lumSqSum(0.f) {}
+
+	void addSample(const float4 &_color, float _weight)
+	{
+		color += _color * float4::rep(_weight);
+		float lum = 0.2126f * _color.x + 0.7152f * _color.y + 0.0722f * _color.z;
+		lumSum += lum;
+		lumSqSum += lum * lum;
+		samples++;
+	}
+
+	//The average of the rounds
+	float4 getColor() const
+	{
+		return color * float4::rep(1.f / (float)rounds);
+	}
+
+	//The standard error of the mean luminance relative to the mean,
+	//	which is clamped for dark pixels. 0 with less than two samples
+	float getRelativeError() const
+	{
+		if(samples < 2)
+			return 0.f;
+
+		float n = (float)samples;
+		float mean = lumSum / n;
+		float variance = std::max(lumSqSum / n - mean * mean, 0.f) * n / (n - 1.f);
+		return sqrtf(variance / n) / std::max(mean, 0.01f);
+	}
 };
 
 //A renderer class
@@ -31,57 +100,66 @@ public:
 	SmartPtr<Camera> camera;
 	SmartPtr<Integrator> integrator;
 	SmartPtr<Image> target;
+
+	//Adaptive sampling of the tile renderer: afterwards, pixels with a
+	//	relative error above adaptiveThreshold get further rounds of
+	//	samples, at most adaptiveRounds. rayBudget limits the primary
+	//	rays of the whole image, 0 for no limit. Off with 0 rounds
+	uint adaptiveRounds;
+	float adaptiveThreshold;
+	size_t rayBudget;
+
+	//Progressive rendering stops after progressivePasses passes, after
+	//	timeBudget seconds of wall clock time or once the mean relative
+	//	error of the pixels is below targetError, 0 disables a limit.
+	//	Every writeInterval seconds the image is written to progressiveFile
+	uint progressivePasses;
+	float timeBudget, targetError, writeInterval;
+	std::string progressiveFile;
+
+	//With a checkpoint file, the tile renderer stores every finished
+	//	tile to it and resumes an interrupted render with the same
+	//	settings from it. The file is deleted once all tiles are done.
+	//	Adaptive sampling needs the luminance of the samples of every
+	//	pixel, which the checkpoint does not keep, so it is not used
+	//	with adaptiveRounds
+	std::string checkpointFile;
+
+	//With costImagePrefix set, the time, nodes and primitive tests of
+	//	every pixel are recorded and written as false color images to
+	//	costImagePrefix + ".time.png" and so on at the end of a render
+	//	(see CostImages). The counts need STATISTICS (make _STATS=1).
+	//	The pixels are traced one by one then, so that the cost of a
+	//	ray packet does not have to be split between its pixels
+	std::string costImagePrefix;
+
+	Renderer() : adaptiveRounds(0), adaptiveThreshold(0.05f), rayBudget(0),
+		progressivePasses(16), timeBudget(0.f), targetError(0.f), writeInterval(10.f),
+		progressiveFile("progressive.png"), m_primaryRays(0), m_checkpoint(NULL) {}
 
     // renders the whole image
     // line-wise
 	void render()
 	{
-        const clock_t begin_time = clock(); // for building time measurement
+        TraceSpan span("render"); // for building time measurement
+        ShadingCacheStats::get().reset();
+        initCosts();
 
 		//Loop through all pixels in the scene and determine their color
 		//	from the integrator
 //#pragma omp parallel
 		{
-			std::vector<Sampler::Sample> samples;
             int progress;
 //#pragma omp for schedule(dynamic, 10)
 			for(int y = 0; y < (int)target->height(); y++) {
 				for(int x = 0; x < (int)target->width(); x++)
 				{
-					float4 color = float4::rep(0.f);
-
-					samples.clear();
-					sampler->getSamples((uint)x, (uint)y, samples);
-
-					//Accumulate the samples
-					for(size_t i = 0; i < samples.size(); i++)
-					{
-
-					    std::vector<Ray> rays = camera->getPrimaryRays(samples[i].position.x + x, samples[i].position.y + y);
-
-					    float4 tempColor = float4::rep(0.f);
-
-					    for (size_t j = 0; j < rays.size(); j++)
-					    {
-					        tempColor += integrator->getRadiance(rays[j]);
-                            //std::cout <<"Sent sample ray #" << i << ": "<< sampleRay.o[0] << "," <<sampleRay.o[1] << "," <<sampleRay.o[2]
-                            //<< " to: " << sampleRay.d[0] << "," <<sampleRay.d[1] << "," << sampleRay.d[2]  << std::endl;
-					        //std::cout << "sample " << j << ": " << tempColor[0] << "," << tempColor[1] << "," << tempColor[2] << "," << tempColor[3] << std::endl;
-					    }
-
-                        float rayWeight = 1.f/rays.size();
-					    tempColor *= float4::rep(rayWeight);
-
-                        //std::cout << "color: " << tempColor[0] << "," << tempColor[1] << "," << tempColor[2] << "," << tempColor[3] << std::endl;
-
+					m_samples.clear();
+					m_cameraSamples.clear();
+					addPixelSamples(x, y);
 
-						//Ray r = camera->getPrimaryRay(samples[i].position.x + x, samples[i].position.y + y);
-                        //color += integrator->getRadiance(r) * float4::rep(samples[i].weight);
-
-                        color += tempColor * float4::rep(samples[i].weight);
-					}
-
-					(*target)(x, y) = color;
+					uint raysPerSample = generateRays();
+					(*target)(x, y) = renderPixel(0, m_samples.size(), raysPerSample, NULL, getPixelCost(x, y));
 				}
 
 				progress = y*100 / (int)target->height() +0.5;
@@ -89,7 +167,9 @@ public:
 			}
 		}
 
-        std::cout << "Time needed to render: " << float(clock()-begin_time)/CLOCKS_PER_SEC << " s."<< std::endl;
+        std::cout << "Time needed to render: " << span.end() << " s."<< std::endl;
+        printShadingCacheStats();
+        writeCosts();
 	}
 
     // will render the image in tiles
@@ -99,8 +179,16 @@ public:
         if (tileSize<=0)
             render();
 
-        const clock_t begin_time = clock(); // for building time measurement
+        TraceSpan span("render tiles"); // for building time measurement
         int progress; // # of tile being rendered right now
+        ShadingCacheStats::get().reset();
+        initCosts();
+
+        // the samples of each pixel are kept for adaptive sampling
+        m_primaryRays = 0;
+        m_pixelStats.clear();
+        if (adaptiveRounds > 0)
+            m_pixelStats.resize(target->width() * target->height());
 
         int height = (int)target->height(); // image height
         int width = (int)target->width(); // image width
@@ -121,6 +209,18 @@ public:
         if (lastXTile > 0)
             numXTiles++;
 
+        // tiles finished by an earlier run are taken from the checkpoint
+        RenderCheckpoint checkpoint;
+        if (!checkpointFile.empty() && adaptiveRounds > 0)
+            std::cout << "Checkpoint " << checkpointFile << " not used with adaptive sampling" << std::endl;
+        else if (!checkpointFile.empty())
+        {
+            uint resumed = checkpoint.open(checkpointFile, (uint)width, (uint)height, (uint)tileSize, getSettingsHash());
+            std::cout << "Checkpoint " << checkpointFile << ": " << resumed << " of "
+                << numXTiles * numYTiles << " tiles done" << std::endl;
+            m_checkpoint = &checkpoint;
+        }
+
         // iteratre through all tiles
         for (int yTile = yStart; yTile < numYTiles; yTile++)
         {
@@ -140,73 +240,418 @@ public:
                 else
                     tileXSize = tileSize;
 
+                if (m_checkpoint != NULL && m_checkpoint->isTileDone(xTile, yTile))
+                {
+                    m_checkpoint->loadTile(xTile, yTile, *target);
+                    continue;
+                }
+
                 // render the tile
                 renderTile(xTile*tileSize, xTile*tileSize+tileXSize,
                            yTile*tileSize, yTile*tileSize+tileYSize);
+
+                if (m_checkpoint != NULL)
+                    m_checkpoint->storeTile(xTile, yTile, *target);
             }
 
             // progress information output
             progress = ((yTile)*100) / (numYTiles);
             std::cout << "Rendered Y-tile " << yTile << " of " << numYTiles << ". Progress: " << progress << " % " << std::endl;
 
-            std::ostringstream osstream;
-            osstream << yTile << ".png";
-            target->writePNG(osstream.str());
+            // the checkpoint already has the tiles
+            if (m_checkpoint == NULL)
+            {
+                std::ostringstream osstream;
+                osstream << yTile << ".png";
+                target->writePNG(osstream.str());
+            }
         }
 
+        // a finished render has nothing to resume. A render started
+        // at a later y-tile keeps the checkpoint of the missing tiles
+        if (m_checkpoint != NULL && m_checkpoint->isComplete())
+            m_checkpoint->discard();
+
+        m_checkpoint = NULL;
+
+        if (adaptiveRounds > 0)
+            renderAdaptive();
+
         // time information output
-        std::cout << std::endl << "Time needed to render: " << float(clock()-begin_time)/CLOCKS_PER_SEC << " s."<< std::endl;
+        std::cout << std::endl << "Time needed to render: " << span.end() << " s."<< std::endl;
+        printShadingCacheStats();
+        writeCosts();
+    }
+
+    // renders the image progressively in tiles. Every pass adds a round
+    // of samples to all pixels, the image is the average of the rounds.
+    // The time budget is checked after each tile, the error after each pass
+    void renderProgressive(int tileSize)
+    {
+        TraceSpan span("render progressive");
+        double beginTime = Trace::now(); // wall clock, not cpu time
+        double lastWrite = beginTime;
+        ShadingCacheStats::get().reset();
+        initCosts();
+
+        m_primaryRays = 0;
+        m_pixelStats.clear();
+        m_pixelStats.resize(target->width() * target->height());
+
+        int height = (int)target->height(); // image height
+        int width = (int)target->width(); // image width
+        int numYTiles = (height + tileSize - 1) / tileSize; // last tiles are cropped
+        int numXTiles = (width + tileSize - 1) / tileSize;
+
+        bool stop = false;
+        for (uint pass = 0; !stop && (progressivePasses == 0 || pass < progressivePasses); pass++)
+        {
+            for (int yTile = 0; yTile < numYTiles && !stop; yTile++)
+                for (int xTile = 0; xTile < numXTiles && !stop; xTile++)
+                {
+                    renderTile(xTile*tileSize, std::min((xTile+1)*tileSize, width),
+                               yTile*tileSize, std::min((yTile+1)*tileSize, height), pass);
+
+                    double now = Trace::now();
+                    stop = timeBudget > 0 && now - beginTime >= timeBudget;
+
+                    if (writeInterval > 0 && now - lastWrite >= writeInterval)
+                    {
+                        target->writePNG(progressiveFile);
+                        lastWrite = now;
+                    }
+                }
+
+            // a pass that was stopped leaves some pixels with a round less
+            float error = getMeanRelativeError();
+            std::cout << "Pass " << pass << ": mean relative error " << error << " after "
+                << Trace::now() - beginTime << " s" << std::endl;
+            stop = stop || (targetError > 0 && error <= targetError);
+        }
+
+        target->writePNG(progressiveFile);
+
+        std::cout << "Primary rays: " << m_primaryRays << std::endl;
+        printShadingCacheStats();
+        writeCosts();
     }
 
+    // the primary rays traced by the last render
+    size_t getPrimaryRays() const { return m_primaryRays; }
+
 private:
 
+    // the mean relative error of all pixels
+    float getMeanRelativeError() const
+    {
+        double sum = 0;
+        for (size_t i = 0; i < m_pixelStats.size(); i++)
+            sum += m_pixelStats[i].getRelativeError();
+        return m_pixelStats.empty() ? 0.f : (float)(sum / m_pixelStats.size());
+    }
+
+    // shading attributes (normals, coefficients) computed during the
+    // frame and the evaluations the per-hit caches saved
+    void printShadingCacheStats() const
+    {
+        const ShadingCacheStats &stats = ShadingCacheStats::get();
+        std::cout << "Shading attributes computed: " << stats.evaluations
+            << ", evaluations saved by caching: " << stats.saved << std::endl;
+    }
+
+    // starts recording the pixel costs if costImagePrefix is set
+    void initCosts()
+    {
+        if (costImagePrefix.empty())
+            m_costs.clear();
+        else
+            m_costs.init(target->width(), target->height());
+    }
+
+    void writeCosts()
+    {
+        if (!m_costs.empty())
+            m_costs.write(costImagePrefix);
+    }
+
+    // the settings a checkpoint has to be rendered with to be resumed:
+    // the types and parameters of the sampler, the types of the camera
+    // and integrator, a few camera rays and the primitives of the scene.
+    // Nothing is sampled, so that the samples of the render stay the same
+    unsigned long long getSettingsHash()
+    {
+        SettingsHash hash;
+        hash.add(std::string(typeid(*sampler).name()));
+        hash.add(std::string(typeid(*camera).name()));
+        hash.add(std::string(typeid(*integrator).name()));
+
+        sampler->hashSettings(hash);
+
+        // the rays of a fixed sample in the corners and the center
+        // of the image, also through the lens of a lens camera
+        uint raysPerSample = camera->getRaysPerSample();
+        hash.add(raysPerSample);
+        std::vector<Ray> rays(raysPerSample);
+        float width = (float)target->width(), height = (float)target->height();
+        float2 points[] = {float2(0.f, 0.f), float2(width, 0.f), float2(0.f, height),
+            float2(width, height), float2(0.5f * width, 0.5f * height)};
+        for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++)
+        {
+            CameraSample sample;
+            sample.image = points[i];
+            sample.lens = float2(0.25f, 0.75f);
+            camera->getPrimaryRays(&sample, 1, &rays[0]);
+            for (uint j = 0; j < raysPerSample; j++)
+            {
+                hash.add(rays[j].o);
+                hash.add(rays[j].d);
+            }
+        }
+
+        hash.add((uint)integrator->getPrimitiveCount());
+        return hash.value();
+    }
+
     // renders a given tile specified by xStart, xEnd
-    // and yStart, yEnd
-    void renderTile(int xStart, int xEnd, int yStart, int yEnd)
+    // and yStart, yEnd in blocks of 4x4 pixels,
+    // with the samples of round _round
+    void renderTile(int xStart, int xEnd, int yStart, int yEnd, uint _round = 0)
 	{
-		//Loop through all pixels in the tile and determine their color
-		//	from the integrator
-//#pragma omp parallel
+		std::ostringstream name;
+		name << "tile " << xStart << ", " << yStart;
+		TraceSpan span(name.str(), "tile");
+
+		for(int y = yStart; y < yEnd; y += 4)
+			for(int x = xStart; x < xEnd; x += 4)
+				renderBlock(x, std::min(x + 4, xEnd), y, std::min(y + 4, yEnd), _round);
+	}
+
+    // the samples of the current pixel or block, the camera samples
+    // and the primary rays generated from them
+    std::vector<Sampler::Sample> m_samples;
+    std::vector<CameraSample> m_cameraSamples;
+    std::vector<Ray> m_rays;
+    size_t m_primaryRays;
+
+    // the samples of each pixel, empty without adaptive sampling
+    std::vector<PixelStats> m_pixelStats;
+
+    // the checkpoint of the current tile render, or NULL
+    RenderCheckpoint *m_checkpoint;
+
+    // the costs of each pixel, empty without costImagePrefix
+    CostImages m_costs;
+
+    PixelStats *getPixelStats(int _x, int _y)
+	{
+		return m_pixelStats.empty() ? NULL : &m_pixelStats[(size_t)_y * target->width() + _x];
+	}
+
+    PixelCost *getPixelCost(int _x, int _y)
+	{
+		return m_costs.empty() ? NULL : &m_costs((uint)_x, (uint)_y);
+	}
+
+    // renders further rounds of samples for the pixels whose relative
+    // error is above adaptiveThreshold. If the ray budget does not
+    // suffice for all of them, the pixels with the highest error come first
+    void renderAdaptive()
+	{
+		TraceSpan span("adaptive sampling");
+		int width = (int)target->width();
+		std::vector<std::pair<float, uint> > pixels;
+
+		for(uint round = 1; round <= adaptiveRounds; round++)
+		{
+			pixels.clear();
+			for(size_t i = 0; i < m_pixelStats.size(); i++)
+			{
+				float error = m_pixelStats[i].getRelativeError();
+				if(error > adaptiveThreshold)
+					pixels.push_back(std::make_pair(error, (uint)i));
+			}
+			std::sort(pixels.begin(), pixels.end(), std::greater<std::pair<float, uint> >());
+
+			size_t rendered = 0;
+			for(; rendered < pixels.size(); rendered++)
+			{
+				int x = (int)(pixels[rendered].second % width), y = (int)(pixels[rendered].second / width);
+				PixelStats &stats = m_pixelStats[pixels[rendered].second];
+
+				// a round takes about as many rays as the first one
+				size_t rays = stats.samples / stats.rounds * camera->getRaysPerSample();
+				if(rayBudget > 0 && m_primaryRays + rays > rayBudget)
+					break;
+
+				m_samples.clear();
+				m_cameraSamples.clear();
+				addPixelSamples(x, y, round);
+
+				uint raysPerSample = generateRays();
+				renderPixel(0, m_samples.size(), raysPerSample, &stats, getPixelCost(x, y));
+			}
+
+			std::cout << "Adaptive round " << round << ": " << rendered << " of " << pixels.size()
+				<< " pixels above the threshold rendered" << std::endl;
+
+			if(rendered < pixels.size() || pixels.empty())
+				break;
+		}
+
+		for(size_t i = 0; i < m_pixelStats.size(); i++)
+			if(m_pixelStats[i].rounds > 0)
+				(*target)((int)(i % width), (int)(i / width)) = m_pixelStats[i].getColor();
+
+		std::cout << "Primary rays: " << m_primaryRays << std::endl;
+	}
+
+    // gets new samples of round _round for pixel (_x, _y) from the
+    // Sampler and appends them to m_samples and m_cameraSamples
+    void addPixelSamples(int _x, int _y, uint _round = 0)
+	{
+		size_t first = m_samples.size();
+		sampler->getRoundSamples((uint)_x, (uint)_y, _round, m_samples);
+
+		for(size_t i = first; i < m_samples.size(); i++)
+		{
+			CameraSample cs;
+			cs.image = float2(m_samples[i].position.x + _x, m_samples[i].position.y + _y);
+			cs.lens = m_samples[i].lens;
+			m_cameraSamples.push_back(cs);
+		}
+	}
+
+    // generates the primary rays of all camera samples into m_rays,
+    // returns the number of rays per sample
+    uint generateRays()
+	{
+		uint raysPerSample = camera->getRaysPerSample();
+		m_rays.resize(m_cameraSamples.size() * raysPerSample);
+		m_primaryRays += m_rays.size();
+		_STAT_ADD(SC_PrimaryRays, m_rays.size());
+		if(!m_cameraSamples.empty())
+			camera->getPrimaryRays(&m_cameraSamples[0], (uint)m_cameraSamples.size(), &m_rays[0]);
+		return raysPerSample;
+	}
+
+    // renders a block of up to 4x4 pixels. The i-th samples of all pixels
+    // are traced as one ray packet, if all pixels have the same number of
+    // samples and the camera gives one ray per sample. Otherwise the
+    // pixels are rendered one by one. With pixel stats, the block adds
+    // a round to them and shows the average of the rounds
+    void renderBlock(int xStart, int xEnd, int yStart, int yEnd, uint _round)
+	{
+		int blockWidth = xEnd - xStart;
+		uint pixelCount = (uint)(blockWidth * (yEnd - yStart));
+
+		// the samples of pixel p are [first[p], first[p + 1])
+		size_t first[RayPacket::SIZE + 1];
+		m_samples.clear();
+		m_cameraSamples.clear();
+		for(uint p = 0; p < pixelCount; p++)
 		{
-			std::vector<Sampler::Sample> samples;
-//#pragma omp for schedule(dynamic, 10)
-			for(int y = yStart; y < yEnd; y++) {
-				for(int x = xStart; x < xEnd; x++)
-				{
-					float4 color = float4::rep(0.f);
-
-                    // clear samples vector
-					samples.clear();
-					// get new samples from Sampler
-					sampler->getSamples((uint)x, (uint)y, samples);
-
-					//Accumulate the samples
-					for(size_t i = 0; i < samples.size(); i++)
-					{
-					    // can be more than a ray, i.e. when using lens camera model
-					    std::vector<Ray> rays = camera->getPrimaryRays(samples[i].position.x + x, samples[i].position.y + y);
-
-					    float4 tempColor = float4::rep(0.f);
-
-                        // go through all rays the camera gave us
-					    for (size_t j = 0; j < rays.size(); j++)
-					    {
-					        tempColor += integrator->getRadiance(rays[j]);
-                        }
-
-                        // weight those rays averaged
-                        float rayWeight = 1.f/rays.size();
-					    tempColor *= float4::rep(rayWeight);
-
-					    // add weighted color to overall color
-                        color += tempColor * float4::rep(samples[i].weight);
-					}
-
-                    // write color to image
-					(*target)(x, y) = color;
-				}
+			first[p] = m_samples.size();
+			addPixelSamples(xStart + p % blockWidth, yStart + p / blockWidth, _round);
+		}
+		first[pixelCount] = m_samples.size();
+
+		if(m_checkpoint != NULL)
+			for(uint p = 0; p < pixelCount; p++)
+				m_checkpoint->sampleCount(xStart + p % blockWidth, yStart + p / blockWidth) = (uint)(first[p + 1] - first[p]);
+
+		uint raysPerSample = generateRays();
+		size_t sampleCount = first[1] - first[0];
+		bool usePackets = raysPerSample == 1 && m_costs.empty();
+		for(uint p = 0; p < pixelCount; p++)
+			usePackets = usePackets && first[p + 1] - first[p] == sampleCount;
+
+		if(!usePackets)
+		{
+			for(uint p = 0; p < pixelCount; p++)
+			{
+				int x = xStart + p % blockWidth, y = yStart + p / blockWidth;
+				PixelStats *stats = getPixelStats(x, y);
+				float4 color = renderPixel(first[p], first[p + 1], raysPerSample, stats, getPixelCost(x, y));
+				(*target)(x, y) = stats != NULL ? stats->getColor() : color;
+			}
+			return;
+		}
+
+		float4 color[RayPacket::SIZE];
+		PixelStats *stats[RayPacket::SIZE];
+		for(uint p = 0; p < pixelCount; p++)
+		{
+			color[p] = float4::rep(0.f);
+			stats[p] = getPixelStats(xStart + p % blockWidth, yStart + p / blockWidth);
+		}
+
+		for(size_t i = 0; i < sampleCount; i++)
+		{
+			RayPacket packet;
+			for(uint p = 0; p < pixelCount; p++)
+				packet.setRay(p, m_rays[first[p] + i]);
+
+			packet.prepare();
+			float4 radiance[RayPacket::SIZE];
+			integrator->getRadiancePacket(packet, radiance);
+
+			for(uint p = 0; p < pixelCount; p++)
+			{
+				color[p] += radiance[p] * float4::rep(m_samples[first[p] + i].weight);
+				if(stats[p] != NULL)
+					stats[p]->addSample(radiance[p], m_samples[first[p] + i].weight);
 			}
 		}
+
+		for(uint p = 0; p < pixelCount; p++)
+		{
+			if(stats[p] != NULL)
+				stats[p]->rounds++;
+			(*target)(xStart + p % blockWidth, yStart + p / blockWidth) = stats[p] != NULL ? stats[p]->getColor() : color[p];
+		}
+	}
+
+    // renders a pixel from the samples [_first, _end) and their rays,
+    // and adds them as a round to _stats and the cost of tracing
+    // them to _cost if these are not NULL
+    float4 renderPixel(size_t _first, size_t _end, uint _raysPerSample, PixelStats *_stats = NULL, PixelCost *_cost = NULL)
+	{
+		float4 color = float4::rep(0.f);
+		PixelCost begin;
+		if (_cost != NULL)
+		    begin = PixelCost::now();
+
+		//Accumulate the samples
+		for(size_t i = _first; i < _end; i++)
+		{
+		    // can be more than a ray, i.e. when using lens camera model
+		    const Ray *rays = &m_rays[i * _raysPerSample];
+
+		    float4 tempColor = float4::rep(0.f);
+
+            // go through all rays the camera gave us
+		    for (uint j = 0; j < _raysPerSample; j++)
+		    {
+		        tempColor += integrator->getRadiance(rays[j]);
+            }
+
+            // weight those rays averaged
+            float rayWeight = 1.f/_raysPerSample;
+		    tempColor *= float4::rep(rayWeight);
+
+		    // add weighted color to overall color
+            color += tempColor * float4::rep(m_samples[i].weight);
+            if (_stats != NULL)
+                _stats->addSample(tempColor, m_samples[i].weight);
+		}
+
+		if (_stats != NULL)
+		    _stats->rounds++;
+
+		if (_cost != NULL)
+		    _cost->add(begin, PixelCost::now());
+
+		return color;
 	}
 };
 
@@ -7,10 +7,52 @@
 
 #include "../rt/basic_definitions.h"
 
+//The rays a shader traces to compute its indirect radiance, together with
+//	the weights of the radiance along them. The indirect radiance is the
+//	weighted sum of these radiances.
+struct SecondaryRays
+{
+	enum { MAX_RAYS = 2 };
+
+	enum Type
+	{
+		ST_Reflection,
+		ST_Refraction
+	};
+
+	uint count;
+	Ray rays[MAX_RAYS];
+	float4 weights[MAX_RAYS];
+	Type types[MAX_RAYS];
+
+	SecondaryRays() : count(0) {}
+
+	void add(const Ray &_ray, const float4 &_weight, Type _type)
+	{
+		_ASSERT(count < MAX_RAYS);
+		rays[count] = _ray;
+		weights[count] = _weight;
+		types[count] = _type;
+		count++;
+	}
+
+	//Traces the rays recursively with _integrator
+	float4 getRadiance(Integrator *_integrator) const
+	{
+		float4 ret = float4::rep(0.f);
+		for(uint i = 0; i < count; i++)
+		{
+			_STAT_INC(types[i] == ST_Reflection ? SC_ReflectionRays : SC_RefractionRays);
+			ret += _integrator->getRadiance(rays[i]) * weights[i];
+		}
+		return ret;
+	}
+};
+
 //The base interface of a shader to an integrator. The integrator only understands
 //	and queries the functions defined in this class. All functions work in the context
 //	of the current intersection and are immutable (always return the same value).
-struct Shader : RefCntBase
+struct Shader : ArenaRefCntBase
 {
 	//Returns the reflectance of the surface at the point for which the shader
 	//	is invoked when illuminating from a point light source. The cosine term to the
@@ -28,6 +70,22 @@ struct Shader : RefCntBase
 	//Return float4::rep(0.f) if the shader does not support this functionality
 	virtual float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const { return float4::rep(0.f);}
 
+	//Pushes the rays, that getIndirectRadiance would trace, to _rays. Used by
+	//	integrators that trace them on their own (see impl/wavefront_renderer.h).
+	//	_refractionIndex is the current refraction index of the incoming ray.
+	//Return false if the shader does not support this functionality. The
+	//	integrator calls getIndirectRadiance then
+	virtual bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const { return false; }
+
+	//An implementation of getIndirectRadiance for shaders that implement
+	//	getSecondaryRays
+	float4 traceSecondaryRays(const Vector &_out, Integrator *_integrator) const
+	{
+		SecondaryRays rays;
+		getSecondaryRays(_out, _integrator->getCurrentRefractionIndex(), rays);
+		return rays.getRadiance(_integrator);
+	}
+
     // returns if the shader is transparent
     virtual bool isTransparent() const { return false; };
 
@@ -46,6 +104,82 @@ struct Shader : RefCntBase
     }
 };
 
+//Counts the shading attributes computed by the shaders and the queries
+//	answered from their per-hit caches. The counters are per thread
+struct ShadingCacheStats
+{
+	ulong evaluations;
+	ulong saved;
+
+	static ShadingCacheStats& get()
+	{
+		static _THREAD_LOCAL ShadingCacheStats stats;
+		return stats;
+	}
+
+	void reset()
+	{
+		evaluations = 0;
+		saved = 0;
+	}
+};
+
+//The attributes of a hit, as passed to the setters of a PluggableShader.
+//	Filled by Primitive::getMaterialHit, so that a hit can be shaded
+//	without creating a shader for it
+struct HitAttributes
+{
+	Point position;
+
+	bool hasNormal;
+	Vector normal; //Not necessarily normalized
+
+	bool hasDifferentials;
+	HitDifferentials differentials;
+
+	bool hasVertices;
+	Point v1, v2, v3;
+
+	bool hasTexCoord;
+	float2 texCoord;
+	float2 tex1, tex2, tex3;
+
+	//The texture space footprint, valid if the hit has texture coordinates
+	//	and differentials
+	float2 texDx, texDy;
+
+	HitAttributes()
+		: hasNormal(false), hasDifferentials(false), hasVertices(false), hasTexCoord(false)
+	{}
+};
+
+//The shader types, which the integrators can run with static kernels on the
+//	material itself instead of a clone (see visitShaderKernel in
+//	impl/phong_shaders.h). A shader type is mapped to its id by a
+//	specialization of ShaderKernelTraits, all others are SK_Custom. The id
+//	belongs to the exact type, derived shaders are SK_Custom unless they
+//	declare their own id.
+enum ShaderKernelId
+{
+	SK_Custom,
+	SK_DefaultPhong,
+	SK_TexturedPhong,
+	SK_TexturedBumpPhong,
+	SK_MirrorPhong,
+	SK_RefractivePhong,
+	SK_ProceduralBump
+};
+
+template<class ta_shader> struct ShaderKernelTraits
+{
+	enum { id = SK_Custom };
+};
+
+//Maps a shader type to its kernel id. Use before the definition of the shader
+#define _DECLARE_SHADER_KERNEL(_NAME, _ID)                                     \
+	class _NAME;                                                               \
+	template<> struct ShaderKernelTraits<_NAME> { enum { id = _ID }; };       \
+
 //A class that defines the interface between a shader and a primitive. Used for primitive
 //	independent shaders.
 struct PluggableShader : public Shader
@@ -57,6 +191,9 @@ struct PluggableShader : public Shader
 	//	intersections.
 	virtual SmartPtr<PluggableShader> clone() const = 0;
 
+	//The kernel id of the exact type of the shader. Implemented by _IMPLEMENT_CLONE
+	virtual ShaderKernelId kernelId() const { return SK_Custom; }
+
 	//Sets the surface point which is shaded
 	virtual void setPosition(const Point& _point) {};
 	//Sets the normal to the surface point which is shaded
@@ -72,6 +209,76 @@ struct PluggableShader : public Shader
     //Sets the tex coordinates of the vertices
     // needed for bump mapping
 	virtual void setTexels(float2 _tex1, float2 _tex2, float2 _tex3) {};
+
+	//Sets the texture space footprint of the pixel at the intersection:
+	//	the change of the texture coordinates for a step of one pixel in
+	//	x and y direction. Used for mip level selection
+	virtual void setTextureFootprint(const float2& _dx, const float2& _dy) {};
+
+	//Sets the ray differentials at the intersection. Only called for
+	//	rays that carry differentials
+	virtual void setDifferentials(const HitDifferentials& _diff) {};
+
+	//Sets all attributes of a hit, in the order the primitives used to
+	void setHitAttributes(const HitAttributes &_attr)
+	{
+		setPosition(_attr.position);
+		if(_attr.hasNormal)
+			setNormal(_attr.normal);
+		if(_attr.hasDifferentials)
+			setDifferentials(_attr.differentials);
+		if(_attr.hasVertices)
+			setVertices(_attr.v1, _attr.v2, _attr.v3);
+		if(_attr.hasTexCoord)
+		{
+			setTextureCoord(_attr.texCoord);
+			setTexels(_attr.tex1, _attr.tex2, _attr.tex3);
+			if(_attr.hasDifferentials)
+				setTextureFootprint(_attr.texDx, _attr.texDy);
+		}
+	}
+};
+
+//Creates the shader of a hit from the material and the attributes returned
+//	by Primitive::getMaterialHit
+inline SmartPtr<Shader> createHitShader(const PluggableShader *_material, const HitAttributes &_attr)
+{
+	SmartPtr<PluggableShader> ret = _material->clone();
+	ret->setHitAttributes(_attr);
+	return ret;
+}
+
+//The shader functions called by the integrators. StaticShaderCalls binds them
+//	to the static kernels of ta_shader at compile time, which shade the hit
+//	_attr with the parameters of the material, VirtualShaderCalls calls
+//	them through the vtable. Integrators write their shading code once as a
+//	template over these.
+template<class ta_shader>
+struct StaticShaderCalls
+{
+	const ta_shader &material;
+	typename ta_shader::template KernelHit<ta_shader> hit;
+
+	StaticShaderCalls(const ta_shader &_material, const HitAttributes &_attr) : material(_material), hit(_material, _attr) {}
+
+	float4 getAmbientCoefficient() const { return ta_shader::kernelAmbientCoefficient(material, hit); }
+	float4 getReflectance(const Vector &_outDir, const Vector &_inDir) const { return ta_shader::kernelReflectance(material, hit, _outDir, _inDir); }
+	float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const { return ta_shader::kernelIndirectRadiance(material, hit, _out, _integrator); }
+	float4 getTransparency(ShadowRay &_in, Integrator *_integrator) const { return ta_shader::kernelTransparency(material, hit, _in, _integrator); }
+	bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const { return ta_shader::kernelSecondaryRays(material, hit, _out, _refractionIndex, _rays); }
+};
+
+struct VirtualShaderCalls
+{
+	const Shader &shader;
+
+	explicit VirtualShaderCalls(const Shader &_shader) : shader(_shader) {}
+
+	float4 getAmbientCoefficient() const { return shader.getAmbientCoefficient(); }
+	float4 getReflectance(const Vector &_outDir, const Vector &_inDir) const { return shader.getReflectance(_outDir, _inDir); }
+	float4 getIndirectRadiance(const Vector &_out, Integrator *_integrator) const { return shader.getIndirectRadiance(_out, _integrator); }
+	float4 getTransparency(ShadowRay &_in, Integrator *_integrator) const { return shader.getTransparency(_in, _integrator); }
+	bool getSecondaryRays(const Vector &_out, float _refractionIndex, SecondaryRays &_rays) const { return shader.getSecondaryRays(_out, _refractionIndex, _rays); }
 };
 
 //A helper macro to implement default cloning
@@ -83,6 +290,10 @@ struct PluggableShader : public Shader
 		                                                                       \
 		return ret;                                                            \
 	}                                                                          \
+	virtual ShaderKernelId kernelId() const                                    \
+	{                                                                          \
+		return (ShaderKernelId)ShaderKernelTraits<_NAME>::id;                  \
+	}                                                                          \
 
 
 #endif //__INCLUDE_GUARD_EA166321_FE56_436D_9533_087DA72CB708
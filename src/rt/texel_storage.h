@@ -0,0 +1,247 @@
+#ifndef __INCLUDE_GUARD_4DFDAEA5_80E4_4B23_93FD_91AE9C90BF54
+#define __INCLUDE_GUARD_4DFDAEA5_80E4_4B23_93FD_91AE9C90BF54
+#ifdef _MSC_VER
+	#pragma once
+#endif
+
+#include "../core/image.h"
+#include <algorithm>
+
+//The memory format of a single texel
+enum TexelFormat
+{
+	TF_Float, //float4, 16 bytes per texel
+	TF_RGBA8, //8 bit unsigned normalized components, 4 bytes per texel
+	TF_Half //16 bit floats, 8 bytes per texel
+};
+
+//The order of the texels in memory
+enum TexelLayout
+{
+	TL_Linear, //Row-major, like Image
+	TL_Tiled //Row-major 4x4 tiles, Morton (Z) order inside a tile
+};
+
+//Converts a float to a 16 bit float (1 sign, 5 exponent, 10 mantissa bits).
+//	Rounds half up, flushes values below the half subnormal range to 0
+inline ushort floatToHalf(float _f)
+{
+	union { float f; uint u; } v;
+	v.f = _f;
+
+	uint sign = (v.u >> 16) & 0x8000;
+	uint fexp = (v.u >> 23) & 0xff;
+	uint mant = v.u & 0x7fffff;
+	int exp = (int)fexp - 127 + 15;
+
+	if(fexp == 0xff) // inf and nan
+		return (ushort)(sign | 0x7c00 | (mant != 0 ? 0x200 : 0));
+	if(exp >= 31) // too big, becomes inf
+		return (ushort)(sign | 0x7c00);
+	if(exp <= 0) // subnormal half
+	{
+		if(exp < -10)
+			return (ushort)sign;
+		mant |= 0x800000;
+		uint shift = (uint)(14 - exp);
+		uint h = mant >> shift;
+		if((mant >> (shift - 1)) & 1)
+			h++;
+		return (ushort)(sign | h);
+	}
+
+	// a carry out of the mantissa correctly bumps the exponent
+	uint h = sign | ((uint)exp << 10) | (mant >> 13);
+	if(mant & 0x1000)
+		h++;
+	return (ushort)h;
+}
+
+//Converts a 16 bit float back to a float. The exponent is rebased by a
+//	multiplication with 2^112, which also handles the subnormals
+inline float halfToFloat(ushort _h)
+{
+	union { float f; uint u; } v;
+	v.u = (uint)(_h & 0x7fff) << 13;
+	v.f *= 5.192296858534828e+33f;
+	if(v.f >= 65536.f) // was inf or nan
+		v.u |= 0x7f800000;
+	v.u |= (uint)(_h & 0x8000) << 16;
+	return v.f;
+}
+
+//Encoding and decoding of the texel formats
+template<TexelFormat ta_format> struct TexelFormatTraits;
+
+template<> struct TexelFormatTraits<TF_Float>
+{
+	typedef float4 t_texel;
+
+	static t_texel encode(const float4 &_c) { return _c; }
+	static float4 decode(const t_texel &_t) { return _t; }
+};
+
+template<> struct TexelFormatTraits<TF_RGBA8>
+{
+	struct t_texel { byte x, y, z, w; };
+
+	static byte encodeComponent(float _c)
+	{
+		return (byte)(std::min(std::max(_c, 0.f), 1.f) * 255.f + 0.5f);
+	}
+
+	static t_texel encode(const float4 &_c)
+	{
+		t_texel ret;
+		ret.x = encodeComponent(_c.x);
+		ret.y = encodeComponent(_c.y);
+		ret.z = encodeComponent(_c.z);
+		ret.w = encodeComponent(_c.w);
+		return ret;
+	}
+
+	static float4 decode(const t_texel &_t)
+	{
+		const float s = 1.f / 255.f;
+		return float4((float)_t.x * s, (float)_t.y * s, (float)_t.z * s, (float)_t.w * s);
+	}
+};
+
+template<> struct TexelFormatTraits<TF_Half>
+{
+	struct t_texel { ushort x, y, z, w; };
+
+	static t_texel encode(const float4 &_c)
+	{
+		t_texel ret;
+		ret.x = floatToHalf(_c.x);
+		ret.y = floatToHalf(_c.y);
+		ret.z = floatToHalf(_c.z);
+		ret.w = floatToHalf(_c.w);
+		return ret;
+	}
+
+	static float4 decode(const t_texel &_t)
+	{
+		return float4(halfToFloat(_t.x), halfToFloat(_t.y), halfToFloat(_t.z), halfToFloat(_t.w));
+	}
+};
+
+//Mapping of texel coordinates to memory offsets for the texel layouts.
+//	_tilesX is the number of tiles in a row of a tiled level
+template<TexelLayout ta_layout> struct TexelLayoutTraits;
+
+template<> struct TexelLayoutTraits<TL_Linear>
+{
+	static size_t index(uint _x, uint _y, uint _width, uint _tilesX)
+	{
+		return (size_t)_y * _width + _x;
+	}
+};
+
+template<> struct TexelLayoutTraits<TL_Tiled>
+{
+	static size_t index(uint _x, uint _y, uint _width, uint _tilesX)
+	{
+		size_t tile = (size_t)(_y >> 2) * _tilesX + (_x >> 2);
+		// interleave the two low bits of x and y: x0 y0 x1 y1
+		uint inTile = (_x & 1) | ((_y & 1) << 1) | ((_x & 2) << 1) | ((_y & 2) << 2);
+		return (tile << 4) | inTile;
+	}
+};
+
+//A single (mip) level of a texture, stored in one of the texel formats
+//	and layouts. A float linear level references the source image
+//	instead of copying it.
+class TexelLevel : public RefCntBase
+{
+	std::vector<byte> m_storage;
+	SmartPtr<Image> m_image;
+
+	// texels points into m_storage
+	TexelLevel(const TexelLevel&);
+	TexelLevel& operator=(const TexelLevel&);
+
+public:
+	TexelFormat format;
+	TexelLayout layout;
+	uint width, height;
+	uint tilesX; //Number of 4x4 tiles per row, only used by TL_Tiled
+	const void *texels;
+
+	TexelLevel()
+		: format(TF_Float), layout(TL_Linear), width(0), height(0), tilesX(0), texels(NULL)
+	{}
+
+	//Encodes an image in the given format and layout
+	void encode(const SmartPtr<Image> &_img, TexelFormat _format, TexelLayout _layout)
+	{
+		format = _format;
+		layout = _layout;
+		width = _img->width();
+		height = _img->height();
+		tilesX = (width + 3) / 4;
+
+		if(_format == TF_Float && _layout == TL_Linear)
+		{
+			m_storage.clear();
+			m_image = _img;
+			texels = _img->getBits();
+			return;
+		}
+
+		m_image = SmartPtr<Image>();
+		switch(_format)
+		{
+		case TF_Float: encodeTexels<TF_Float>(*_img); break;
+		case TF_RGBA8: encodeTexels<TF_RGBA8>(*_img); break;
+		case TF_Half: encodeTexels<TF_Half>(*_img); break;
+		}
+	}
+
+	//Makes the level a float linear view of an image without taking
+	//	a reference to it
+	void view(const Image &_img)
+	{
+		format = TF_Float;
+		layout = TL_Linear;
+		width = _img.width();
+		height = _img.height();
+		tilesX = (width + 3) / 4;
+		texels = _img.getBits();
+	}
+
+	//The number of bytes used by the texels
+	size_t memorySize() const
+	{
+		return m_image.data() != NULL ? (size_t)width * height * sizeof(float4) : m_storage.size();
+	}
+
+private:
+	template<TexelFormat ta_format>
+	void encodeTexels(const Image &_img)
+	{
+		typedef TexelFormatTraits<ta_format> t_traits;
+		typedef typename t_traits::t_texel t_texel;
+
+		// tiled levels are padded to full tiles with the edge texels
+		uint w = layout == TL_Tiled ? tilesX * 4 : width;
+		uint h = layout == TL_Tiled ? ((height + 3) / 4) * 4 : height;
+
+		m_storage.resize((size_t)w * h * sizeof(t_texel));
+		t_texel *dst = reinterpret_cast<t_texel*>(&m_storage[0]);
+
+		for(uint y = 0; y < h; y++)
+			for(uint x = 0; x < w; x++)
+			{
+				size_t idx = layout == TL_Tiled ?
+					TexelLayoutTraits<TL_Tiled>::index(x, y, width, tilesX) :
+					TexelLayoutTraits<TL_Linear>::index(x, y, width, tilesX);
+				dst[idx] = t_traits::encode(_img(std::min(x, width - 1), std::min(y, height - 1)));
+			}
+
+		texels = dst;
+	}
+};
+
+#endif //__INCLUDE_GUARD_4DFDAEA5_80E4_4B23_93FD_91AE9C90BF54
@@ -10,6 +10,7 @@
 #include <iostream>
 #include <algorithm>
 #include "../impl/random.h"
+#include "texel_storage.h"
 
 //Specifies where the center of the texel is.
 //Currently the value 0.5 means that (0.5, 0.5)
@@ -21,6 +22,13 @@
 //	whereas texel(0.5, 0.5) will be = pixel(0, 0) of the imagge
 #define _TEXEL_CENTER_OFFS 0.5f
 
+//Maximal number of noise octaves evaluated by a procedural texture
+#define _MAX_NOISE_OCTAVES 16
+
+//Step of the central differences used for bump gradients of procedural
+//	textures without an analytic gradient
+#define _BUMP_GRADIENT_DELTA 0.01f
+
 //A texture class
 class Texture : public RefCntBase
 {
@@ -35,11 +43,15 @@ public:
 		TAM_Repeat	//Results in the border pixels repeated
 	};
 
-	//The texture filtering mode. It affects magnifaction only
+	//The texture filtering mode. Point and bilinear affect magnifaction only,
+	//	trilinear and anisotropic also filter minified textures using the
+	//	mip pyramid (see generateMipMaps) and the footprint passed to sample()
 	enum TextureFilterMode
 	{
 		TFM_Point,
-		TFM_Bilinear
+		TFM_Bilinear,
+		TFM_Trilinear, //Bilinear lookups in the two closest mip levels
+		TFM_Anisotropic //Several trilinear lookups along the major axis of the footprint
 	};
 
     // determines texture type
@@ -56,12 +68,52 @@ public:
 	TextureFilterMode filterMode;
 	TextureType textureType;
 
+	//Maximal number of trilinear lookups done by TFM_Anisotropic
+	uint maxAnisotropy;
+
+	//The format and memory layout the texels are stored in. Only
+	//	used by buildStorage and generateMipMaps. Until one of them
+	//	is called, the texture is sampled from the image directly
+	TexelFormat texelFormat;
+	TexelLayout texelLayout;
+
 	Texture()
 	{
 		addressModeX = TAM_Wrap;
 		addressModeY = TAM_Wrap;
 		filterMode = TFM_Point;
 		textureType = TT_Texture;
+		maxAnisotropy = 8;
+		texelFormat = TF_Float;
+		texelLayout = TL_Linear;
+	}
+
+	//Stores the image (and the mip pyramid, if it was generated before)
+	//	in texelFormat and texelLayout. Needs to be called again if the
+	//	image is replaced. Once the storage is built, the texture is
+	//	sampled from the stored levels only, so image can be released
+	//	to save its memory.
+	void buildStorage()
+	{
+		buildLevels(m_levels.size() > 1);
+	}
+
+	//Builds the mip pyramid of the image by repeated 2x2 box filtering
+	//	and stores it like buildStorage. Level 0 is the image itself.
+	void generateMipMaps()
+	{
+		buildLevels(true);
+	}
+
+	size_t mipLevelCount() const { return m_levels.size(); }
+
+	//The number of bytes used by the stored levels
+	size_t memorySize() const
+	{
+		size_t ret = 0;
+		for(size_t i = 0; i < m_levels.size(); i++)
+			ret += m_levels[i]->memorySize();
+		return ret;
 	}
 
 	//Sample the texture. Coordinates are normalized:
@@ -70,49 +122,91 @@ public:
 	//	if doing point sampling
 	float4 sample(const float2& _pos) const
 	{
-		//Denormalize the texture coordinates and offset the center
-		//	of the texel
-		float2 pos =
-			_pos * float2((float)image->width(), (float)image->height())
-			+ float2(_TEXEL_CENTER_OFFS, _TEXEL_CENTER_OFFS);
-
         if (textureType == TT_Texture) {
-            return sampleDenormalized(pos);
+            TexelLevel view;
+            const TexelLevel &level = baseLevel(view);
+
+            //Denormalize the texture coordinates and offset the center
+            //	of the texel
+            float2 pos =
+                _pos * float2((float)level.width, (float)level.height)
+                + float2(_TEXEL_CENTER_OFFS, _TEXEL_CENTER_OFFS);
+
+            return getLevelSampler(level, filterMode != TFM_Point)(level, pos);
         } else {
             // not supported here
             return float4::rep(0);
         }
 	}
 
+	//Sample the texture over a footprint. _dx and _dy are the changes of the
+	//	normalized texture coordinates when moving one pixel in x and y
+	//	direction on the image plane. The footprint is only used by the
+	//	trilinear and anisotropic filter modes and if mip maps exist.
+	float4 sample(const float2& _pos, const float2& _dx, const float2& _dy) const
+	{
+		if(textureType != TT_Texture)
+			return float4::rep(0);
+
+		if((filterMode != TFM_Trilinear && filterMode != TFM_Anisotropic) || m_levels.size() < 2)
+			return sample(_pos);
+
+		// all levels share the storage, so the lookup is selected once
+		t_levelSampler sampler = getLevelSampler(*m_levels[0], true);
+
+		// footprint axes in texels of the finest level
+		float2 size((float)m_levels[0]->width, (float)m_levels[0]->height);
+		float2 dx = _dx * size, dy = _dy * size;
+		float lenX = sqrtf(dx.x * dx.x + dx.y * dx.y);
+		float lenY = sqrtf(dy.x * dy.x + dy.y * dy.y);
+
+		if(filterMode == TFM_Trilinear)
+			return sampleLod(sampler, _pos, log2f(std::max(lenX, lenY)));
+
+		// anisotropic: the minor axis selects the level, the major
+		// axis is covered by several probes
+		float2 majorAxis = lenX > lenY ? _dx : _dy;
+		float majorLen = std::max(lenX, lenY);
+		float minorLen = std::min(lenX, lenY);
+
+		uint probes = 1;
+		if(majorLen > minorLen * (float)maxAnisotropy)
+			probes = std::max(maxAnisotropy, 1u);
+		else if(minorLen > 0.f)
+			probes = (uint)ceilf(majorLen / minorLen);
+
+		float lod = log2f(majorLen / (float)probes);
+		float4 ret = float4::rep(0.f);
+		for(uint i = 0; i < probes; i++)
+			ret += sampleLod(sampler, _pos + majorAxis * (((float)i + 0.5f) / (float)probes - 0.5f), lod);
+
+		return ret * float4::rep(1.f / (float)probes);
+	}
+
     // samples all four neighbors of the point to
     // create a normal vector out of the variance in height difference
     // taking normalized coordinates
 	Vector sampleBumpTexture(const float2& _pos) const {
-	    //Denormalize the texture coordinates and offset the center
-		//	of the texel
-		float2 pos =
-			_pos * float2((float)image->width(), (float)image->height())
-			+ float2(_TEXEL_CENTER_OFFS, _TEXEL_CENTER_OFFS);
-
         if (textureType == TT_HateMap) {
                 // if we are sampling a bump texture,
-                // sample all the neighbors
-                float neighbor1x = pos.x-1.f;
-                float neighbor2x = pos.x+1.f;
-                float neighbor3y = pos.y-1.f;
-                float neighbor4y = pos.y+1.f;
-
-                // get correct neighbor coordinates according to texture address mode
-                fixAddress(neighbor1x,(float)image->width(),addressModeX);
-                fixAddress(neighbor2x,(float)image->width(),addressModeX);
-                fixAddress(neighbor3y,(float)image->height(),addressModeY);
-                fixAddress(neighbor4y,(float)image->height(),addressModeY);
+                // sample all the neighbors. The lookup wraps or
+                // clamps them according to the texture address mode
+                TexelLevel view;
+                const TexelLevel &level = baseLevel(view);
+
+                //Denormalize the texture coordinates and offset the center
+                //	of the texel
+                float2 pos =
+                    _pos * float2((float)level.width, (float)level.height)
+                    + float2(_TEXEL_CENTER_OFFS, _TEXEL_CENTER_OFFS);
+
+                t_levelSampler sampler = getLevelSampler(level, filterMode != TFM_Point);
 
                 // sample the points
-                float4 bumpNeighbor1 = sampleDenormalized(float2(neighbor1x,pos.y));
-                float4 bumpNeighbor2 = sampleDenormalized(float2(neighbor2x,pos.y));
-                float4 bumpNeighbor3 = sampleDenormalized(float2(pos.x,neighbor3y));
-                float4 bumpNeighbor4 = sampleDenormalized(float2(pos.x,neighbor4y));
+                float4 bumpNeighbor1 = sampler(level, float2(pos.x-1.f,pos.y));
+                float4 bumpNeighbor2 = sampler(level, float2(pos.x+1.f,pos.y));
+                float4 bumpNeighbor3 = sampler(level, float2(pos.x,pos.y-1.f));
+                float4 bumpNeighbor4 = sampler(level, float2(pos.x,pos.y+1.f));
 
                 // compute variation on x and y axis
                 float du = bumpNeighbor2.x - bumpNeighbor1.x;
@@ -135,65 +229,190 @@ public:
 	}
 
 private:
-    // taking denormalized coordinates
-    float4 sampleDenormalized(float2 pos) const
-    {
-        if(filterMode == TFM_Point)
-			return lookupTexel(pos.x, pos.y);
-		else if(filterMode == TFM_Bilinear)
-		{
-			float x_lo = floor(pos.x);
-			float y_lo = floor(pos.y);
-			float x_hi = ceil(pos.x);
-			float y_hi = ceil(pos.y);
-
-			float4 pix[2][2];
-			pix[0][0] = lookupTexel(x_lo, y_lo);
-			pix[1][0] = lookupTexel(x_hi, y_lo);
-			pix[0][1] = lookupTexel(x_lo, y_hi);
-			pix[1][1] = lookupTexel(x_hi, y_hi);
-
-			float4 xhw = float4::rep(pos.x - x_lo);
-			float4 yhw = float4::rep(pos.y - y_lo);
-			float4 xlw = float4::rep(1 - xhw.x);
-			float4 ylw = float4::rep(1 - yhw.x);
+	//A point or bilinear lookup in a single level. Denormalized coordinates
+	typedef float4 (*t_levelSampler)(const TexelLevel&, const float2&);
+
+	//The stored levels, finest first. Holds only level 0 if no mip maps
+	//	were generated and is empty if the storage was never built
+	std::vector<SmartPtr<TexelLevel> > m_levels;
 
-			return
-				ylw * (xlw * pix[0][0] + xhw * pix[1][0]) +
-				yhw * (xlw * pix[0][1] + xhw * pix[1][1]);
-		}
-		else
-			return float4::rep(0.f);
-    }
+	void buildLevels(bool _mipMaps)
+	{
+		_ASSERT(image.data() != NULL);
+		m_levels.clear();
+
+		SmartPtr<Image> src = image;
+		for(;;)
+		{
+			SmartPtr<TexelLevel> level = new TexelLevel;
+			level->encode(src, texelFormat, texelLayout);
+			m_levels.push_back(level);
+
+			if(!_mipMaps || (src->width() <= 1 && src->height() <= 1))
+				break;
+
+			src = downsample(*src);
+		}
+	}
+
+	//The next mip level, 2x2 box filtered
+	static SmartPtr<Image> downsample(const Image &_src)
+	{
+		uint w = std::max(_src.width() / 2, 1u);
+		uint h = std::max(_src.height() / 2, 1u);
+		SmartPtr<Image> ret = new Image(w, h);
+
+		for(uint y = 0; y < h; y++)
+		{
+			uint y0 = std::min(2 * y, _src.height() - 1);
+			uint y1 = std::min(2 * y + 1, _src.height() - 1);
+			for(uint x = 0; x < w; x++)
+			{
+				uint x0 = std::min(2 * x, _src.width() - 1);
+				uint x1 = std::min(2 * x + 1, _src.width() - 1);
+				(*ret)(x, y) = float4::rep(0.25f) *
+					(_src(x0, y0) + _src(x1, y0) + _src(x0, y1) + _src(x1, y1));
+			}
+		}
+
+		return ret;
+	}
+
+	//The finest level. Falls back to a float view of the image in _view
+	//	if the storage was never built
+	const TexelLevel& baseLevel(TexelLevel &_view) const
+	{
+		if(!m_levels.empty())
+			return *m_levels[0];
+
+		_view.view(*image);
+		return _view;
+	}
+
+	//Trilinear lookup at a fractional mip level. Normalized coordinates
+	float4 sampleLod(t_levelSampler _sampler, const float2& _pos, float _lod) const
+	{
+		size_t maxLevel = m_levels.size() - 1;
+
+		if(!(_lod > 0.f)) // also catches NaN from degenerate footprints
+			return sampleLevel(_sampler, 0, _pos);
+		if(_lod >= (float)maxLevel)
+			return sampleLevel(_sampler, maxLevel, _pos);
+
+		size_t lo = (size_t)_lod;
+		float4 hiw = float4::rep(_lod - (float)lo);
+
+		return (float4::rep(1.f) - hiw) * sampleLevel(_sampler, lo, _pos) + hiw * sampleLevel(_sampler, lo + 1, _pos);
+	}
+
+	//Lookup in a single mip level. Normalized coordinates
+	float4 sampleLevel(t_levelSampler _sampler, size_t _level, const float2& _pos) const
+	{
+		const TexelLevel &level = *m_levels[_level];
+		float2 pos =
+			_pos * float2((float)level.width, (float)level.height)
+			+ float2(_TEXEL_CENTER_OFFS, _TEXEL_CENTER_OFFS);
+
+		return _sampler(level, pos);
+	}
+
+	//Selects the lookup specialized for the storage of the level and
+	//	the address modes. Wrap and repeat address the same texels
+	t_levelSampler getLevelSampler(const TexelLevel &_level, bool _bilinear) const
+	{
+		switch(_level.format)
+		{
+		case TF_RGBA8: return selectLayout<TF_RGBA8>(_level.layout, _bilinear);
+		case TF_Half: return selectLayout<TF_Half>(_level.layout, _bilinear);
+		default: return selectLayout<TF_Float>(_level.layout, _bilinear);
+		}
+	}
+
+	template<TexelFormat ta_format>
+	t_levelSampler selectLayout(TexelLayout _layout, bool _bilinear) const
+	{
+		if(_layout == TL_Tiled)
+			return selectAddressX<ta_format, TL_Tiled>(_bilinear);
+		return selectAddressX<ta_format, TL_Linear>(_bilinear);
+	}
+
+	template<TexelFormat ta_format, TexelLayout ta_layout>
+	t_levelSampler selectAddressX(bool _bilinear) const
+	{
+		if(addressModeX == TAM_Border)
+			return selectAddressY<ta_format, ta_layout, TAM_Border>(_bilinear);
+		return selectAddressY<ta_format, ta_layout, TAM_Wrap>(_bilinear);
+	}
 
+	template<TexelFormat ta_format, TexelLayout ta_layout, TextureAddressMode ta_addrX>
+	t_levelSampler selectAddressY(bool _bilinear) const
+	{
+		if(addressModeY == TAM_Border)
+			return _bilinear ?
+				&lookupBilinear<ta_format, ta_layout, ta_addrX, TAM_Border> :
+				&lookupPoint<ta_format, ta_layout, ta_addrX, TAM_Border>;
+		return _bilinear ?
+			&lookupBilinear<ta_format, ta_layout, ta_addrX, TAM_Wrap> :
+			&lookupPoint<ta_format, ta_layout, ta_addrX, TAM_Wrap>;
+	}
+
+	//Correct the texel address to be inside the texture. The address
+	//	mode is known at compile time, so the branch is folded away
+	template<TextureAddressMode ta_mode>
+	static uint fixAddress(int _addr, uint _size)
+	{
+		if(ta_mode == TAM_Border)
+			return (uint)std::min(std::max(_addr, 0), (int)_size - 1);
+
+		int ret = _addr % (int)_size;
+		return (uint)(ret < 0 ? ret + (int)_size : ret);
+	}
 
-	//Correct the sampling address to be inside the texture
-	static void fixAddress(float &_addr, float _max, TextureAddressMode _tam)
+	//Fetches and decodes a single texel
+	template<TexelFormat ta_format, TexelLayout ta_layout, TextureAddressMode ta_addrX, TextureAddressMode ta_addrY>
+	static float4 lookupTexel(const TexelLevel &_level, int _x, int _y)
 	{
-		if(_tam == TAM_Wrap) {
-			_addr = fmodf(_addr, _max);
-			if (_addr < 0) // hack because fmodf sucks
-                _addr+=_max;
-		}
-		else if(_tam == TAM_Border)
-			_addr = std::min(std::max(_addr, 0.f), _max);
-        else if(_tam == TAM_Repeat)
-            _addr = _addr - floorf(_addr/ _max) * _max;
+		typedef TexelFormatTraits<ta_format> t_format;
+		typedef typename t_format::t_texel t_texel;
+
+		uint x = fixAddress<ta_addrX>(_x, _level.width);
+		uint y = fixAddress<ta_addrY>(_y, _level.height);
+
+		const t_texel *texels = static_cast<const t_texel*>(_level.texels);
+		return t_format::decode(texels[TexelLayoutTraits<ta_layout>::index(x, y, _level.width, _level.tilesX)]);
 	}
 
 	//Lookup a texel using point sampling. Coordinates are
 	//	denormalized and texel center is at (0, 0) of image
 	//	pixel's center
-	float4 lookupTexel(float _x, float _y) const
+	template<TexelFormat ta_format, TexelLayout ta_layout, TextureAddressMode ta_addrX, TextureAddressMode ta_addrY>
+	static float4 lookupPoint(const TexelLevel &_level, const float2 &_pos)
+	{
+		return lookupTexel<ta_format, ta_layout, ta_addrX, ta_addrY>(_level, (int)floorf(_pos.x), (int)floorf(_pos.y));
+	}
+
+	// taking denormalized coordinates
+	template<TexelFormat ta_format, TexelLayout ta_layout, TextureAddressMode ta_addrX, TextureAddressMode ta_addrY>
+	static float4 lookupBilinear(const TexelLevel &_level, const float2 &_pos)
 	{
-		float realX = _x, realY = _y;
-		fixAddress(realX, (float)image->width(), addressModeX);
-		fixAddress(realY, (float)image->height(), addressModeY);
+		float x_lo = floorf(_pos.x);
+		float y_lo = floorf(_pos.y);
+		int x = (int)x_lo, y = (int)y_lo;
 
-		uint x = (uint)floor(realX);
-		uint y = (uint)floor(realY);
+		float4 pix[2][2];
+		pix[0][0] = lookupTexel<ta_format, ta_layout, ta_addrX, ta_addrY>(_level, x, y);
+		pix[1][0] = lookupTexel<ta_format, ta_layout, ta_addrX, ta_addrY>(_level, x + 1, y);
+		pix[0][1] = lookupTexel<ta_format, ta_layout, ta_addrX, ta_addrY>(_level, x, y + 1);
+		pix[1][1] = lookupTexel<ta_format, ta_layout, ta_addrX, ta_addrY>(_level, x + 1, y + 1);
 
-		return (*image)(x, y);
+		float4 xhw = float4::rep(_pos.x - x_lo);
+		float4 yhw = float4::rep(_pos.y - y_lo);
+		float4 xlw = float4::rep(1 - xhw.x);
+		float4 ylw = float4::rep(1 - yhw.x);
+
+		return
+			ylw * (xlw * pix[0][0] + xhw * pix[1][0]) +
+			yhw * (xlw * pix[0][1] + xhw * pix[1][1]);
 	}
 
 };
@@ -228,26 +447,51 @@ public:
     virtual float4 sampleBumpTexture(const Point &_pos) const { return float4::rep(0.f); }
     */
 
-    float4 sampleTexture(const Point& _pos) const {
-        return getTexel(_pos, color1, color2);
+    // _footprint is the world space size of a pixel at _pos. Noise octaves
+    // finer than the footprint are skipped, 0 evaluates all of them
+    float4 sampleTexture(const Point& _pos, float _footprint = 0.f) const {
+        return getTexel(_pos, color1, color2, _footprint);
     }
 
     // returns inverted texture in black/white
-	virtual float4 sampleBumpTexture(const Point& _pos) const {
+	virtual float4 sampleBumpTexture(const Point& _pos, float _footprint = 0.f) const {
 	    float4 black = float4::rep(0);
 	    float4 white = float4::rep(1);
-        return getTexel(_pos, white, black);
+        return getTexel(_pos, white, black, _footprint);
 	}
 
+    // gradient of the bump texture (the .x component of sampleBumpTexture).
+    // Uses central differences, textures built from noise override it with
+    // the analytic gradient, which costs about one texture evaluation
+    virtual Vector sampleBumpGradient(const Point& _pos, float _footprint = 0.f) const {
+        const float d = _BUMP_GRADIENT_DELTA;
+        float x1 = sampleBumpTexture(Point(_pos.x+d,_pos.y,_pos.z), _footprint)[0];
+        float x2 = sampleBumpTexture(Point(_pos.x-d,_pos.y,_pos.z), _footprint)[0];
+        float y1 = sampleBumpTexture(Point(_pos.x,_pos.y+d,_pos.z), _footprint)[0];
+        float y2 = sampleBumpTexture(Point(_pos.x,_pos.y-d,_pos.z), _footprint)[0];
+        float z1 = sampleBumpTexture(Point(_pos.x,_pos.y,_pos.z+d), _footprint)[0];
+        float z2 = sampleBumpTexture(Point(_pos.x,_pos.y,_pos.z-d), _footprint)[0];
+        return Vector(x1 - x2, y1 - y2, z1 - z2) / (2.f * d);
+    }
+
     // set main colors of texture
 	virtual void setColor(float4 _color1, float4 _color2) {
         color1 = _color1;
         color2 = _color2;
 	}
 
+protected:
+
+    // weight of a noise octave of the given frequency. Octaves fade out
+    // between 4 and 2 footprints per period and vanish below the Nyquist limit
+    static float octaveWeight(float _frequency, float _footprint)
+    {
+        return std::min(std::max(2.f - 4.f * _frequency * _footprint, 0.f), 1.f);
+    }
+
 private:
 
-    virtual float4 getTexel(const Point& _pos, float4 _color1, float4 _color2) const {
+    virtual float4 getTexel(const Point& _pos, float4 _color1, float4 _color2, float _footprint) const {
         return float4::rep(0.f);
     }
 };
@@ -271,7 +515,7 @@ public:
     }
 
 private:
-    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2) const
+    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2, float _footprint) const
     {
         /*
         float noise = 0;
@@ -289,7 +533,7 @@ private:
         float gap = scale * 10.0f;  // gap between "rings" of wood
 
         // distribution of noise
-        float dist = sqrt(_pos.x * _pos.x + _pos.y * _pos.y) + fac * turbulence(_pos.x,_pos.y,_pos.z);
+        float dist = sqrt(_pos.x * _pos.x + _pos.y * _pos.y) + fac * turbulence(_pos.x,_pos.y,_pos.z,_footprint);
         dist *= gap;
         dist -= floor(dist); // reduce distance to small interval
 
@@ -302,14 +546,51 @@ private:
         return texelColor;
     }
 
+    // the bump value is f from getTexel, differentiated along dist.
+    // The jumps of dist at the ring borders are ignored
+    Vector sampleBumpGradient(const Point& _pos, float _footprint) const
+    {
+        float fac = .25f;
+        float gap = scale * 10.0f;
+
+        Vector turbGrad;
+        float r = sqrt(_pos.x * _pos.x + _pos.y * _pos.y);
+        float dist = r + fac * turbulence(_pos.x,_pos.y,_pos.z,_footprint,&turbGrad);
+        dist *= gap;
+        dist -= floor(dist);
+
+        Vector radiusGrad = r > 0.f ? Vector(_pos.x / r, _pos.y / r, 0.f) : Vector(0.f, 0.f, 0.f);
+        Vector distGrad = gap * (radiusGrad + fac * turbGrad);
+
+        Vector n;
+        PerlinNoise::noiseGrad(10*dist, 9*dist, 11*dist, n);
+        float df = 2 * (-2.f * dist / 5 - 0.2f * (10 * n.x + 9 * n.y + 11 * n.z));
+
+        return df * distGrad;
+    }
 
-    float turbulence(float x, float y, float z) const
+    // wooden turbulence. Also returns its gradient if _gradient is set
+    float turbulence(float x, float y, float z, float footprint, Vector *_gradient = NULL) const
     {
-        // wooden turbulence
+        float freq[5] = {}, noise[5];
+        Vector grad[5];
+        uint octaves = 0;
+        for (int i = 1; i < 6 && octaveWeight((float)i, footprint) > 0.f; i++)
+            freq[octaves++] = (float)i;
+
+        if (_gradient != NULL) {
+            PerlinNoise::noiseGradOctaves(x, y, z, freq, noise, grad, octaves);
+            *_gradient = Vector(0.f, 0.f, 0.f);
+        } else
+            PerlinNoise::noiseOctaves(x, y, z, freq, noise, octaves);
+
         float t = 0.f;
         int j = 2;
-        for (int i = 1; i < 6; i++) {
-            t += PerlinNoise::noise(i * x, i * y, i * z) / j;
+        for (uint i = 0; i < octaves; i++) {
+            float a = octaveWeight(freq[i], footprint) / j;
+            t += a * noise[i];
+            if (_gradient != NULL)
+                *_gradient += a * grad[i];
             j *= 2;
         }
         return t;
@@ -337,18 +618,32 @@ public:
 private:
     float frequency;
 
-    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2) const
+    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2, float _footprint) const
     {
         return float4::rep(stripes(PerlinNoise::noise(_pos.x,_pos.y,_pos.z),frequency));
         //return float4::rep((cos(PerlinNoise::noise(_pos.x,_pos.y,_pos.z))));
     }
 
+    Vector sampleBumpGradient(const Point& _pos, float _footprint) const
+    {
+        Vector n;
+        float noise = PerlinNoise::noiseGrad(_pos.x,_pos.y,_pos.z,n);
+        return stripesDerivative(noise,frequency) * n;
+    }
+
     // stripe function
     float stripes(float x, float f) const
     {
         float t = .5 + .5 * sinf(f * 2 * M_PI * x);
         return t * t - .5;
     }
+
+    // derivative of the stripe function with respect to x
+    float stripesDerivative(float x, float f) const
+    {
+        float t = .5 + .5 * sinf(f * 2 * M_PI * x);
+        return t * cosf(f * 2 * M_PI * x) * f * 2 * M_PI;
+    }
 };
 
 // a 3d texture for marble
@@ -372,7 +667,7 @@ public:
     }
 
 private:
-    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2) const
+    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2, float _footprint) const
     {
         /*
         float marb = abs(cos(6*( _pos.x + PerlinNoise::noise(_pos.x,_pos.y,_pos.z)) ));
@@ -383,12 +678,19 @@ private:
         */
 
         //.03 * noise(x, y, z, 8); //LUMPY
-        float marble = (stripes(_pos.x + 2 * turbulence(_pos.x, _pos.y, _pos.z, 1), frequency));  //MARBLED
+        float marble = (stripes(_pos.x + 2 * turbulence(_pos.x, _pos.y, _pos.z, 1, _footprint), frequency));  //MARBLED
         //-.10 * turbulence(x, y, z, 1);                       //CRINKLED
         //std::cout << "posix: " << _pos.x << " marble turb: " << turbulence(_pos.x, _pos.y, _pos.z, 1) << std::endl;
         return _color1*float4::rep(marble) +  _color2*float4::rep(1-marble);
     }
 
+    Vector sampleBumpGradient(const Point& _pos, float _footprint) const
+    {
+        Vector turbGrad;
+        float s = _pos.x + 2 * turbulence(_pos.x, _pos.y, _pos.z, 1, _footprint, &turbGrad);
+        return stripesDerivative(s, frequency) * (Vector(1.f, 0.f, 0.f) + 2 * turbGrad);
+    }
+
     // stripe function
     float stripes(float x, float f) const
     {
@@ -396,15 +698,37 @@ private:
         return t * t - .5;
     }
 
-    // turbulence function
-    float turbulence(float x, float y, float z, float f) const
+    // derivative of the stripe function with respect to x
+    float stripesDerivative(float x, float f) const
     {
+        float t = .5 + .5 * sinf(f * 2 * M_PI * x);
+        return t * cosf(f * 2 * M_PI * x) * f * 2 * M_PI;
+    }
+
+    // turbulence function. Also returns its gradient if _gradient is set
+    float turbulence(float x, float y, float z, float f, float footprint, Vector *_gradient = NULL) const
+    {
+        float freq[_MAX_NOISE_OCTAVES] = {}, noise[_MAX_NOISE_OCTAVES];
+        Vector grad[_MAX_NOISE_OCTAVES];
+        uint octaves = 0;
+        for ( ; f <= width/12 && octaves < _MAX_NOISE_OCTAVES ; f *= 2) {
+            if (octaveWeight(f, footprint) == 0.f)
+                break;
+            freq[octaves++] = f;
+        }
+
+        if (_gradient != NULL) {
+            PerlinNoise::noiseGradOctaves(x, y, z, freq, noise, grad, octaves);
+            *_gradient = Vector(0.f, 0.f, 0.f);
+        } else
+            PerlinNoise::noiseOctaves(x, y, z, freq, noise, octaves);
+
         float t = -.5;
-        //int i = 0;
-        //for (int i = 0 ; i < 10 ; i++)m
-        for ( ; f <= width/12 ; f *= 2) {
-            t += abs(PerlinNoise::noise(f*x,f*y,f*z) / f);
-            //t += abs(PerlinNoise::noise(++i*x,i*y,i*z) / f);
+        for (uint i = 0; i < octaves; i++) {
+            float a = octaveWeight(freq[i], footprint) / freq[i];
+            t += a * abs(noise[i]);
+            if (_gradient != NULL)
+                *_gradient += (noise[i] < 0 ? -a : a) * grad[i];
         }
         return t;
     }
@@ -449,7 +773,7 @@ private:
         //landColors.push_back(landColor4);
     }
 
-    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2) const
+    float4 getTexel(const Point& _pos, float4 _color1, float4 _color2, float _footprint) const
     {
         // some texture parameters
         float lacunarity = 0.95f;
@@ -471,7 +795,7 @@ private:
         float purt, chaos;
         float4 ct;
 
-        float bumpy = fBm(_pos, filtwidth, octaves, lacunarity);
+        float bumpy = fBm(_pos, filtwidth, octaves, lacunarity, _footprint);
 
         // bump height
         chaos = bumpy + offset;
@@ -482,7 +806,7 @@ private:
             chaos *= mtn_scale;
             float bumpiness = bump_scale * bumpy;
             p2 = _pos + Vector(bumpiness,bumpiness,bumpiness); // * normalize(N);
-            purt = fBm(p2, mottle_scale*filtwidth, 6, 2); //, mottle_dim);
+            purt = fBm(p2, mottle_scale*filtwidth, 6, 2, _footprint); //, mottle_dim);
 
             // colorize
             float random = Random::getRandomFloat(0,3);
@@ -535,30 +859,46 @@ private:
     * "H" is the fractal increment parameter
     * "lacunarity" is the gap between successive frequencies
     * "octaves" is the number of frequencies in the fBm
+    * "footprint" is the pixel size, finer frequencies are skipped
     *
     * Also see "Texturing and Modeling - A Procedural Approach"
     * by Ebert, Musgrave, Peachey, Perlin & Worley
     */
-    float fBm(Point point, float H, float lacunarity, float octaves) const
+    float fBm(Point point, float H, float lacunarity, float octaves, float footprint) const
     {
+        float freq[_MAX_NOISE_OCTAVES + 1] = {}, amp[_MAX_NOISE_OCTAVES + 1], noise[_MAX_NOISE_OCTAVES + 1];
         float value, remainder;//, Noise();
+        float frequency = 1.f, w = 1.f;
+        uint count = 0;
+        bool complete = true;
         int i;
 
-        value = 0.0;
-
-        /* inner loop of fractal construction */
+        /* frequencies and amplitudes of the fractal construction */
         for (i=0; i<octaves; i++) {
-            value += PerlinNoise::noise(point.x,point.y,point.z) * pow(lacunarity, -H*i);
-            point.x *= lacunarity;
-            point.y *= lacunarity;
-            point.z *= lacunarity;
+            w = octaveWeight(frequency, footprint);
+            if (w == 0.f || count == _MAX_NOISE_OCTAVES) {
+                complete = false;
+                break;
+            }
+            freq[count] = frequency;
+            amp[count++] = w * pow(lacunarity, -H*i);
+            frequency *= lacunarity;
         }
 
         remainder = octaves - (int)octaves;
+        w = octaveWeight(frequency, footprint);
 
-        if (remainder) /* add in "octaves" remainder */
+        if (complete && remainder && w > 0.f) { /* add in "octaves" remainder */
             /* i and spatial freq. are preset in loop above */
-            value += remainder * PerlinNoise::noise(point.x,point.y,point.z) * pow(lacunarity, -H*i);
+            freq[count] = frequency;
+            amp[count++] = w * remainder * pow(lacunarity, -H*i);
+        }
+
+        PerlinNoise::noiseOctaves(point.x, point.y, point.z, freq, noise, count);
+
+        value = 0.0;
+        for (uint k = 0; k < count; k++)
+            value += amp[k] * noise[k];
 
         return value;
     }